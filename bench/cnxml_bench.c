@@ -0,0 +1,1220 @@
+#include "cnxml.h"
+#include "cnxml_hash.h"
+#include "cnxml_hashmap.h"
+#include "cnxml_intern.h"
+#include "cnxml_push.h"
+#include "cnxml_scan.h"
+#include "cnxml_source.h"
+#include "cnxml_thread.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #include <psapi.h>
+#else
+  #include <sys/resource.h>
+  #include <time.h>
+#endif
+
+// throughput benchmark for the tokenizer, parser, serializer and free
+//
+// runs over a generated corpus by default, or over the given files
+// (paths, or @list for a file with one path per line). every phase is
+// run --iterations times and the best run is reported, as a table or
+// with --json as one object for tracking results between releases.
+
+static const char* usage =
+  "usage: cnxml_bench [options] [file | @list ...]\n"
+  "\n"
+  "corpus (when no files are given):\n"
+  "  --depth N        levels of nesting (default 5)\n"
+  "  --fanout N       children per element (default 8)\n"
+  "  --attrs N        attributes per element (default 3)\n"
+  "  --text N         bytes of text in each leaf (default 32)\n"
+  "  --comments N     percent of elements preceded by a comment (default 5)\n"
+  "  --seed N         generator seed (default 1)\n"
+  "  --dump PATH      write the generated corpus to PATH and exit\n"
+  "\n"
+  "large files:\n"
+  "  --large-file PATH  check parsing a sparse file past 4 GB at PATH and exit\n"
+  "  --large-mb N       megabytes of text in it (default 4352)\n"
+  "\n"
+  "hashing:\n"
+  "  --hash-keys PATH   time the name hash and attribute map over the keys\n"
+  "                     in PATH (one per line) and exit\n"
+  "\n"
+  "checks:\n"
+  "  --check NAME       run a randomized self-check and exit, uses --seed.\n"
+  "                     NAME is one of: map, push, intern\n"
+  "\n"
+  "run:\n"
+  "  --iterations N   runs per phase, the best is reported (default 5)\n"
+  "  --heap           parse into a plain heap context instead of an arena\n"
+  "  --intern         intern names into a shared symbol table\n"
+  "  --json           print results as JSON\n";
+
+/*** ALLOCATION COUNTING ***/
+
+typedef struct {
+  uint64_t count;
+  uint64_t bytes;
+} bench_alloc_stats;
+
+static bench_alloc_stats bench_allocs;
+
+static void* bench_alloc(size_t size) {
+  bench_allocs.count++;
+  bench_allocs.bytes += size;
+  return malloc(size);
+}
+
+static void* bench_realloc(void* ptr, size_t new_size) {
+  bench_allocs.count++;
+  bench_allocs.bytes += new_size;
+  return realloc(ptr, new_size);
+}
+
+static void bench_dealloc(void* ptr) {
+  free(ptr);
+}
+
+/*** PLATFORM ***/
+
+static double bench_now(void) {
+#ifdef _WIN32
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static uint64_t bench_peak_rss(void) {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+  return (uint64_t)counters.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+  return (uint64_t)usage.ru_maxrss;
+#else
+  return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+/*** CORPUS GENERATOR ***/
+
+typedef struct {
+  int depth;
+  int fanout;
+  int attrs;
+  int text;
+  int comments;
+  uint64_t seed;
+} bench_corpus_options;
+
+typedef struct {
+  char* ptr;
+  size_t len;
+  size_t capacity;
+} bench_buffer;
+
+static void bench_buffer_write(bench_buffer* buf, const char* data, size_t len) {
+  if (len == 0) return;
+  if (buf->len + len > buf->capacity) {
+    size_t capacity = buf->capacity == 0 ? 64 * 1024 : buf->capacity;
+    while (buf->len + len > capacity) capacity *= 2;
+    char* ptr = realloc(buf->ptr, capacity);
+    if (ptr == NULL) {
+      fprintf(stderr, "out of memory generating corpus\n");
+      exit(1);
+    }
+    buf->ptr = ptr;
+    buf->capacity = capacity;
+  }
+  memcpy(buf->ptr + buf->len, data, len);
+  buf->len += len;
+}
+
+static void bench_buffer_print(bench_buffer* buf, const char* str) {
+  bench_buffer_write(buf, str, strlen(str));
+}
+
+static uint64_t bench_rand(uint64_t* state) {
+  // xorshift64*
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+static const char* bench_names[] = {
+  "item", "entry", "node", "record", "field", "group", "value", "component",
+  "property", "section", "data", "link", "meta", "row", "cell", "option"
+};
+#define BENCH_NAME_COUNT (sizeof(bench_names) / sizeof(bench_names[0]))
+
+static void bench_generate_open(bench_buffer* buf, const bench_corpus_options* opts, uint64_t* rng, const char* name, int indent) {
+  char tmp[64];
+  for (int i = 0; i < indent; i++) bench_buffer_print(buf, "  ");
+  if (opts->comments > 0 && (int)(bench_rand(rng) % 100) < opts->comments) {
+    bench_buffer_print(buf, "<!-- generated ");
+    bench_buffer_print(buf, name);
+    bench_buffer_print(buf, " -->");
+  }
+  bench_buffer_print(buf, "<");
+  bench_buffer_print(buf, name);
+  for (int a = 0; a < opts->attrs; a++) {
+    snprintf(tmp, sizeof(tmp), " %s%d=\"%u\"", bench_names[a % BENCH_NAME_COUNT], a, (unsigned)(bench_rand(rng) % 100000));
+    bench_buffer_print(buf, tmp);
+  }
+}
+
+static void bench_generate_text(bench_buffer* buf, const bench_corpus_options* opts, uint64_t* rng) {
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz      ";
+  char tmp[256];
+  int left = opts->text;
+  while (left > 0) {
+    int n = left < (int)sizeof(tmp) ? left : (int)sizeof(tmp);
+    for (int i = 0; i < n; i++) tmp[i] = alphabet[bench_rand(rng) % (sizeof(alphabet) - 1)];
+    // text runs shouldn't start or end on a space, the parser trims those
+    tmp[0] = 'x';
+    tmp[n - 1] = 'x';
+    bench_buffer_write(buf, tmp, (size_t)n);
+    left -= n;
+  }
+}
+
+// depth first with an explicit stack of remaining child counts, so deep
+// corpora don't need a deep C stack either
+static void bench_generate(bench_buffer* buf, const bench_corpus_options* opts) {
+  uint64_t rng = opts->seed * 0x9e3779b97f4a7c15ull + 1;
+  int depth = opts->depth < 1 ? 1 : opts->depth;
+  int* remaining = calloc((size_t)depth, sizeof(int));
+  const char** names = calloc((size_t)depth, sizeof(char*));
+  if (remaining == NULL || names == NULL) {
+    fprintf(stderr, "out of memory generating corpus\n");
+    exit(1);
+  }
+
+  int level = 0;
+  names[0] = "root";
+  remaining[0] = opts->fanout;
+  bench_generate_open(buf, opts, &rng, names[0], 0);
+  bench_buffer_print(buf, depth == 1 ? ">" : ">\n");
+  if (depth == 1) bench_generate_text(buf, opts, &rng);
+
+  while (level >= 0) {
+    if (level + 1 < depth && remaining[level] > 0) {
+      remaining[level]--;
+      level++;
+      names[level] = bench_names[bench_rand(&rng) % BENCH_NAME_COUNT];
+      remaining[level] = opts->fanout;
+      bench_generate_open(buf, opts, &rng, names[level], level);
+      if (level + 1 == depth) {
+        // leaves carry the text
+        bench_buffer_print(buf, ">");
+        bench_generate_text(buf, opts, &rng);
+      } else {
+        bench_buffer_print(buf, ">\n");
+      }
+      continue;
+    }
+
+    if (level + 1 < depth) {
+      for (int i = 0; i < level; i++) bench_buffer_print(buf, "  ");
+    }
+    bench_buffer_print(buf, "</");
+    bench_buffer_print(buf, names[level]);
+    bench_buffer_print(buf, ">\n");
+    level--;
+  }
+
+  free(remaining);
+  free(names);
+}
+
+/*** INPUTS ***/
+
+typedef struct {
+  const char* data;
+  size_t len;
+  cnxml_source* source; // NULL FOR THE GENERATED CORPUS
+} bench_input;
+
+typedef struct {
+  bench_input* ptr;
+  int len;
+  int capacity;
+} bench_input_list;
+
+static void bench_input_list_add(bench_input_list* list, const char* data, size_t len, cnxml_source* source) {
+  if (list->len == list->capacity) {
+    int capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+    bench_input* ptr = realloc(list->ptr, sizeof(bench_input) * (size_t)capacity);
+    if (ptr == NULL) {
+      fprintf(stderr, "out of memory loading inputs\n");
+      exit(1);
+    }
+    list->ptr = ptr;
+    list->capacity = capacity;
+  }
+  list->ptr[list->len++] = (bench_input){data, len, source};
+}
+
+// sources stay open for the whole run, the parsed strings point into them
+static bool bench_load_file(cnxml_context* ctx, bench_input_list* list, const char* path) {
+  cnxml_source* source = cnxml_source_open(ctx, path);
+  if (CNXML_IS_ERROR(source)) {
+    fprintf(stderr, "couldn't open %s\n", path);
+    return false;
+  }
+  bench_input_list_add(list, source->data, source->data_len, source);
+  return true;
+}
+
+static bool bench_load_list(cnxml_context* ctx, bench_input_list* list, const char* list_path) {
+  FILE* f = fopen(list_path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "couldn't open %s\n", list_path);
+    return false;
+  }
+  char line[4096];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), f) != NULL) {
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+    if (len == 0) continue;
+    ok = bench_load_file(ctx, list, line);
+  }
+  fclose(f);
+  return ok;
+}
+
+/*** LARGE FILE CHECK ***/
+
+// a document whose single text run is a hole in a sparse file, so it
+// takes no disk space but puts the tail of the document past every
+// 32-bit offset. the zero bytes of the hole read back as text. off
+// Windows nothing is written for the hole; on Windows it may be
+// written out in full, which is slower but checks the same thing
+
+static const char bench_large_head[] = "<root>\n<a x=\"1\">";
+static const char bench_large_tail[] = "</a>\n<b y=\"2\"/>\n</c>\n</root>\n";
+
+static bool bench_large_write(const char* path, uint64_t hole) {
+  FILE* f = fopen(path, "wb");
+  if (f == NULL) return false;
+  bool ok = fwrite(bench_large_head, 1, sizeof(bench_large_head) - 1, f) == sizeof(bench_large_head) - 1;
+  int64_t tail_offset = (int64_t)(sizeof(bench_large_head) - 1 + hole);
+#ifdef _WIN32
+  ok = ok && _fseeki64(f, tail_offset, SEEK_SET) == 0;
+#else
+  ok = ok && fseeko(f, (off_t)tail_offset, SEEK_SET) == 0;
+#endif
+  ok = ok && fwrite(bench_large_tail, 1, sizeof(bench_large_tail) - 1, f) == sizeof(bench_large_tail) - 1;
+  return fclose(f) == 0 && ok;
+}
+
+static bool bench_large_expect(bool cond, const char* what) {
+  if (!cond) fprintf(stderr, "large file: %s\n", what);
+  return cond;
+}
+
+static bool bench_large_check(cnxml_parser* parser, cnxml_element_list* roots, uint64_t hole) {
+  size_t head_len = sizeof(bench_large_head) - 1;
+  size_t close_c = head_len + (size_t)hole + strlen("</a>\n<b y=\"2\"/>\n");
+  bool ok = true;
+
+  ok &= bench_large_expect(!CNXML_IS_ERROR(roots) && roots->len == 1, "expected one root");
+  if (!ok) return false;
+  cnxml_element* root = roots->ptr;
+  ok &= bench_large_expect(root->children != NULL && root->children->len == 2, "expected two children");
+  if (!ok) return false;
+
+  cnxml_element* a = root->children->ptr;
+  cnxml_element* b = root->children->ptr + 1;
+  cnxml_string value;
+  ok &= bench_large_expect(a->text_content.len == hole, "text length doesn't match the hole");
+  ok &= bench_large_expect(cnxml_element_get_attribute(a, cnxml_string_new("x"), &value) == CNXML_MAP_OK
+    && cnxml_string_cequal(value, "1"), "lost the attribute before the hole");
+  ok &= bench_large_expect(cnxml_string_cequal(b->name, "b"), "lost the element after the hole");
+  ok &= bench_large_expect(cnxml_element_get_attribute(b, cnxml_string_new("y"), &value) == CNXML_MAP_OK
+    && cnxml_string_cequal(value, "2"), "lost the attribute after the hole");
+
+  // </c> doesn't close <root>, and its error has to point past the hole
+  ok &= bench_large_expect(parser->error_count > 0
+    && parser->error_buffer[0]->type == CNXML_PARSER_ERROR_MISMATCHED_CLOSING_TAG, "expected a mismatched tag error");
+  if (!ok) return false;
+  cnxml_parser_error* err = parser->error_buffer[0];
+  size_t line;
+  size_t column;
+  cnxml_parser_error_position(err, &line, &column);
+  ok &= bench_large_expect(err->offset >= close_c && err->offset <= close_c + 4, "error offset is wrong");
+  ok &= bench_large_expect(line == 4 && column == err->offset - close_c + 1, "error line or column is wrong");
+  return ok;
+}
+
+static int bench_large_file(const char* path, int megabytes) {
+  uint64_t hole = (uint64_t)megabytes * 1024 * 1024;
+  if (megabytes < 1 || hole > SIZE_MAX / 2) {
+    fprintf(stderr, "large file: %d MB doesn't fit in memory here\n", megabytes);
+    return 1;
+  }
+  if (!bench_large_write(path, hole)) {
+    fprintf(stderr, "couldn't write %s\n", path);
+    remove(path);
+    return 1;
+  }
+
+  cnxml_context* ctx = cnxml_context_new_arena(malloc, realloc, free, 0);
+  cnxml_source* source = cnxml_source_open(ctx, path);
+  if (CNXML_IS_ERROR(source)) {
+    fprintf(stderr, "couldn't open %s\n", path);
+    cnxml_context_free(ctx);
+    remove(path);
+    return 1;
+  }
+
+  double start = bench_now();
+  cnxml_parser* parser = cnxml_parser_new(NULL, cnxml_source_tokenizer(source));
+  cnxml_element_list* roots = cnxml_parser_read_document(parser);
+  double seconds = bench_now() - start;
+  bool ok = bench_large_expect(source->kind == CNXML_SOURCE_MAPPED, "file wasn't mapped");
+  ok &= bench_large_check(parser, roots, hole);
+  printf("large file: %.2f MB in %.3f s, %s\n", (double)source->data_len / 1e6, seconds, ok ? "ok" : "FAILED");
+
+  cnxml_source_free(source);
+  cnxml_context_free(ctx);
+  remove(path);
+  return ok ? 0 : 1;
+}
+
+/*** HASH AND MAP MICROBENCHMARK ***/
+
+// times cnxml_hash_bytes and the attribute map over a key file with one
+// name per line, e.g. the attribute names of a real corpus:
+//   grep -oh ' [A-Za-z_:][-A-Za-z0-9_:.]*=' *.xml | tr -d ' =' > keys.txt
+// the bytewise table crc32 is what the map hashed with before
+// cnxml_hash, kept as the baseline
+
+#define BENCH_HASH_MIN_KEYS 2000000 // KEYS HASHED PER TIMED RUN, AT LEAST
+#define BENCH_MAP_GROUP 8           // KEYS PER SMALL MAP, LIKE ONE ELEMENT
+
+typedef struct {
+  char* data;
+  cnxml_string* ptr;
+  size_t len;
+} bench_key_list;
+
+static volatile uint32_t bench_hash_sink;
+static uint32_t bench_crc32_table[256];
+
+static void bench_crc32_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    bench_crc32_table[i] = c;
+  }
+}
+
+static uint32_t bench_crc32(const char* data, size_t len) {
+  uint32_t crc = 0xffffffffu;
+  for (size_t i = 0; i < len; i++) {
+    crc = bench_crc32_table[(crc ^ (uint8_t)data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static bool bench_load_keys(const char* path, bench_key_list* keys) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "couldn't open %s\n", path);
+    return false;
+  }
+  bench_buffer buf = {NULL, 0, 0};
+  char chunk[64 * 1024];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) bench_buffer_write(&buf, chunk, n);
+  fclose(f);
+
+  size_t capacity = 1024;
+  keys->data = buf.ptr;
+  keys->ptr = malloc(sizeof(cnxml_string) * capacity);
+  if (keys->ptr == NULL) {
+    fprintf(stderr, "out of memory loading keys\n");
+    exit(1);
+  }
+  keys->len = 0;
+  size_t start = 0;
+  for (size_t i = 0; i <= buf.len; i++) {
+    if (i < buf.len && buf.ptr[i] != '\n') continue;
+    size_t end = i;
+    if (end > start && buf.ptr[end - 1] == '\r') end--;
+    if (end > start) {
+      if (keys->len == capacity) {
+        capacity *= 2;
+        cnxml_string* ptr = realloc(keys->ptr, sizeof(cnxml_string) * capacity);
+        if (ptr == NULL) {
+          fprintf(stderr, "out of memory loading keys\n");
+          exit(1);
+        }
+        keys->ptr = ptr;
+      }
+      keys->ptr[keys->len++] = cnxml_string_newlen(buf.ptr + start, end - start);
+    }
+    start = i + 1;
+  }
+  if (keys->len == 0) {
+    fprintf(stderr, "no keys in %s\n", path);
+    free(keys->ptr);
+    free(keys->data);
+    return false;
+  }
+  return true;
+}
+
+typedef enum {
+  BENCH_HASH_CRC32_TABLE,
+  BENCH_HASH_PORTABLE,
+  BENCH_HASH_CRC32C,
+  BENCH_HASH_MAP_GROUPS,
+  BENCH_HASH_MAP_GET,
+  BENCH_HASH_CASE_COUNT
+} bench_hash_case;
+
+static const char* bench_hash_case_names[BENCH_HASH_CASE_COUNT] = {
+  "hash, crc32 table (old map)",
+  "hash, portable",
+  "hash, crc32c",
+  "8-key maps, new+put+get+free",
+  "shared map, get"
+};
+
+// one timed pass over every key, rounds times. returns ns per key
+static double bench_hash_pass(bench_hash_case which, bench_key_list* keys, size_t rounds, cnxml_context* ctx, cnxml_map shared) {
+  uint32_t sum = 0;
+  double start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    switch (which) {
+    case BENCH_HASH_CRC32_TABLE:
+      for (size_t i = 0; i < keys->len; i++) sum += bench_crc32(keys->ptr[i].ptr, keys->ptr[i].len);
+      break;
+    case BENCH_HASH_PORTABLE:
+    case BENCH_HASH_CRC32C: {
+      cnxml_hash_impl impl = which == BENCH_HASH_CRC32C ? CNXML_HASH_IMPL_CRC32C : CNXML_HASH_IMPL_PORTABLE;
+      for (size_t i = 0; i < keys->len; i++) sum += cnxml_hash_bytes_with(impl, keys->ptr[i].ptr, keys->ptr[i].len, 0);
+      break;
+    }
+    case BENCH_HASH_MAP_GROUPS:
+      for (size_t i = 0; i < keys->len; i += BENCH_MAP_GROUP) {
+        size_t end = i + BENCH_MAP_GROUP < keys->len ? i + BENCH_MAP_GROUP : keys->len;
+        cnxml_map map = cnxml_hashmap_new(ctx);
+        for (size_t k = i; k < end; k++) cnxml_hashmap_put(map, keys->ptr[k], keys->ptr + k);
+        for (size_t k = i; k < end; k++) {
+          cnxml_any value;
+          sum += (uint32_t)cnxml_hashmap_get(map, keys->ptr[k], &value);
+        }
+        cnxml_hashmap_free(map);
+      }
+      break;
+    case BENCH_HASH_MAP_GET:
+      for (size_t i = 0; i < keys->len; i++) {
+        cnxml_any value;
+        sum += (uint32_t)cnxml_hashmap_get(shared, keys->ptr[i], &value);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  double seconds = bench_now() - start;
+  bench_hash_sink = sum;
+  return seconds * 1e9 / ((double)keys->len * (double)rounds);
+}
+
+static int bench_hash_keys(const char* path, int iterations) {
+  bench_key_list keys;
+  if (!bench_load_keys(path, &keys)) return 1;
+  bench_crc32_init();
+
+  cnxml_context* ctx = cnxml_context_new(malloc, realloc, free);
+  cnxml_map shared = cnxml_hashmap_new(ctx);
+  for (size_t i = 0; i < keys.len; i++) cnxml_hashmap_put(shared, keys.ptr[i], keys.ptr + i);
+  size_t rounds = keys.len >= BENCH_HASH_MIN_KEYS ? 1 : (BENCH_HASH_MIN_KEYS + keys.len - 1) / keys.len;
+  bool has_crc32c = cnxml_hash_get_impl() == CNXML_HASH_IMPL_CRC32C;
+
+  printf("%llu keys, %d distinct, best of %d\n", (unsigned long long)keys.len, cnxml_hashmap_length(shared), iterations);
+  for (int which = 0; which < BENCH_HASH_CASE_COUNT; which++) {
+    if (which == BENCH_HASH_CRC32C && !has_crc32c) {
+      printf("  %-30s  not supported on this cpu\n", bench_hash_case_names[which]);
+      continue;
+    }
+    double best = 0;
+    for (int it = 0; it < iterations; it++) {
+      double ns = bench_hash_pass((bench_hash_case)which, &keys, rounds, ctx, shared);
+      if (it == 0 || ns < best) best = ns;
+    }
+    printf("  %-30s %8.1f ns/key\n", bench_hash_case_names[which], best);
+  }
+
+  cnxml_hashmap_free(shared);
+  cnxml_context_free(ctx);
+  free(keys.ptr);
+  free(keys.data);
+  return 0;
+}
+
+/*** SELF CHECKS ***/
+
+// randomized checks of single components against a simple model, run
+// through --check NAME (and by ctest). each prints one line and returns
+// 0 when the component and the model agree
+
+static bool bench_check_expect(bool cond, const char* check, const char* what) {
+  if (!cond) fprintf(stderr, "%s check: %s\n", check, what);
+  return cond;
+}
+
+// map check: random put/get/remove over a fixed key set, with an array
+// holding what the map should contain. values carry their key index in
+// the low 16 bits so get_one results can be traced back
+
+#define BENCH_CHECK_MAP_KEYS 5000
+#define BENCH_CHECK_MAP_OPS 2000000
+#define BENCH_CHECK_MAP_SWEEP 100000 // OPS BETWEEN FULL ITERATE CHECKS
+
+typedef struct {
+  cnxml_string keys[BENCH_CHECK_MAP_KEYS];
+  uintptr_t values[BENCH_CHECK_MAP_KEYS]; // 0 IF ABSENT
+  int count;
+  int seen;
+  bool ok;
+} bench_map_model;
+
+static int bench_check_map_visit(cnxml_any item, cnxml_string key, cnxml_any value) {
+  bench_map_model* model = item;
+  uintptr_t v = (uintptr_t)value;
+  size_t index = v & 0xffff;
+  model->seen++;
+  if (index >= BENCH_CHECK_MAP_KEYS || model->values[index] != v || !cnxml_string_equal(model->keys[index], key)) {
+    model->ok = false;
+  }
+  return CNXML_MAP_OK;
+}
+
+static bool bench_check_map_sweep(cnxml_map map, bench_map_model* model) {
+  model->seen = 0;
+  model->ok = true;
+  cnxml_hashmap_iterate(map, bench_check_map_visit, model);
+  return bench_check_expect(model->ok && model->seen == model->count, "map", "iterate doesn't match the model")
+    && bench_check_expect(cnxml_hashmap_length(map) == model->count, "map", "length doesn't match the model");
+}
+
+static int bench_check_map(uint64_t seed) {
+  static char names[BENCH_CHECK_MAP_KEYS][48];
+  static bench_map_model model;
+  memset(&model, 0, sizeof(model));
+  // short, word sized and long keys, many sharing prefixes
+  for (int i = 0; i < BENCH_CHECK_MAP_KEYS; i++) {
+    switch (i % 3) {
+    case 0: snprintf(names[i], sizeof(names[i]), "a%d", i); break;
+    case 1: snprintf(names[i], sizeof(names[i]), "data-%d-x", i); break;
+    default: snprintf(names[i], sizeof(names[i]), "xmlns:long-namespace-prefix-%d", i); break;
+    }
+    model.keys[i] = cnxml_string_new(names[i]);
+  }
+
+  cnxml_context* ctx = cnxml_context_new(malloc, realloc, free);
+  cnxml_map map = cnxml_hashmap_new(ctx);
+  uint64_t rng = seed * 0x9e3779b97f4a7c15ull + 1;
+  bool ok = bench_check_expect(map != NULL, "map", "couldn't create the map");
+  for (uint64_t op = 1; ok && op <= BENCH_CHECK_MAP_OPS; op++) {
+    uint64_t r = bench_rand(&rng);
+    int index = (int)((r >> 8) % BENCH_CHECK_MAP_KEYS);
+    cnxml_string key = model.keys[index];
+    cnxml_any got = NULL;
+    switch (r % 4) {
+    case 0:
+    case 1: {
+      uintptr_t value = (uintptr_t)(op << 16) | (uintptr_t)index;
+      ok &= bench_check_expect(cnxml_hashmap_put(map, key, (cnxml_any)value) == CNXML_MAP_OK, "map", "put failed");
+      if (model.values[index] == 0) model.count++;
+      model.values[index] = value;
+      break;
+    }
+    case 2: {
+      int status = cnxml_hashmap_get(map, key, &got);
+      ok &= bench_check_expect(model.values[index] != 0
+        ? status == CNXML_MAP_OK && (uintptr_t)got == model.values[index]
+        : status == CNXML_MAP_MISSING, "map", "get doesn't match the model");
+      break;
+    }
+    default: {
+      int status = cnxml_hashmap_remove(map, key);
+      ok &= bench_check_expect(status == (model.values[index] != 0 ? CNXML_MAP_OK : CNXML_MAP_MISSING),
+        "map", "remove doesn't match the model");
+      if (model.values[index] != 0) model.count--;
+      model.values[index] = 0;
+      break;
+    }
+    }
+    if (ok && op % BENCH_CHECK_MAP_SWEEP == 0) ok = bench_check_map_sweep(map, &model);
+  }
+
+  // get_one with remove drains the map, one live entry at a time
+  while (ok && model.count > 0) {
+    cnxml_any got = NULL;
+    ok &= bench_check_expect(cnxml_hashmap_get_one(map, &got, 1) == CNXML_MAP_OK, "map", "get_one missed an entry");
+    uintptr_t v = (uintptr_t)got;
+    size_t index = v & 0xffff;
+    ok = ok && bench_check_expect(index < BENCH_CHECK_MAP_KEYS && model.values[index] == v, "map", "get_one returned a stale value");
+    if (!ok) break;
+    model.values[index] = 0;
+    model.count--;
+  }
+  if (ok) {
+    cnxml_any got;
+    ok &= bench_check_expect(cnxml_hashmap_get_one(map, &got, 1) == CNXML_MAP_MISSING && cnxml_hashmap_length(map) == 0,
+      "map", "map isn't empty after draining");
+  }
+
+  if (map != NULL) cnxml_hashmap_free(map);
+  cnxml_context_free(ctx);
+  printf("map check: %d ops over %d keys, %s\n", BENCH_CHECK_MAP_OPS, BENCH_CHECK_MAP_KEYS, ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+// push check: a document fed through cnxml_push_parser in random chunks
+// has to give the same events as one cnxml_reader pass over the whole
+// buffer. chunk sizes go down to single bytes, so every unit gets split
+// at every position somewhere
+
+#define BENCH_CHECK_PUSH_TRIALS 24 // CHUNKINGS PER DOCUMENT
+
+static const char bench_check_push_doc[] =
+  "<?xml version=\"1.0\"?>\n<!DOCTYPE r>\n"
+  "<r a=\"x>y\" b='1'>text &amp; more<!-- c -> > --><e/><f x=\"1\" y></f>"
+  "<?pi a > b?>tail<g =\"v\"/><h>\n  <i>deep</i>\n</h></r>\n<unclosed a=\"1";
+
+static void bench_log_event(bench_buffer* log, cnxml_reader_event* event) {
+  char head[96];
+  int len = snprintf(head, sizeof(head), "%d %d %llu %llu ", (int)event->type, (int)event->error,
+    (unsigned long long)event->offset, (unsigned long long)event->depth);
+  bench_buffer_write(log, head, (size_t)len);
+  bench_buffer_write(log, event->name.ptr, event->name.len);
+  bench_buffer_write(log, "|", 1);
+  bench_buffer_write(log, event->value.ptr, event->value.len);
+  bench_buffer_write(log, "\n", 1);
+}
+
+static void bench_check_push_event(cnxml_any userdata, cnxml_reader_event* event) {
+  bench_log_event(userdata, event);
+}
+
+static bool bench_check_push_doc_chunks(cnxml_context* ctx, const char* data, size_t len, uint64_t* rng) {
+  bench_buffer expected = {NULL, 0, 0};
+  cnxml_tokenizer* tokenizer = cnxml_tokenizer_new(ctx, data, len);
+  cnxml_reader* reader = cnxml_reader_new(ctx, tokenizer);
+  while (true) {
+    cnxml_reader_event_type type = cnxml_reader_next(reader);
+    bench_log_event(&expected, &reader->event);
+    if (type == CNXML_READER_EOF) break;
+  }
+  cnxml_reader_free(reader);
+  cnxml_tokenizer_free(tokenizer);
+
+  static const size_t max_chunks[] = {1, 2, 7, 64, 4096};
+  bool ok = true;
+  for (int trial = 0; ok && trial < BENCH_CHECK_PUSH_TRIALS; trial++) {
+    size_t max_chunk = max_chunks[trial % (int)(sizeof(max_chunks) / sizeof(max_chunks[0]))];
+    bench_buffer got = {NULL, 0, 0};
+    cnxml_push_parser* parser = cnxml_push_parser_new(ctx, bench_check_push_event, &got);
+    ok &= bench_check_expect(!CNXML_IS_ERROR(parser), "push", "couldn't create the parser");
+    if (!ok) break;
+    size_t pos = 0;
+    while (ok && pos < len) {
+      // empty feeds now and then, they must not change anything
+      size_t chunk = bench_rand(rng) % (max_chunk + 1);
+      if (chunk > len - pos) chunk = len - pos;
+      ok &= bench_check_expect(cnxml_push_parser_feed(parser, data + pos, chunk) == CNXML_ERROR_OK, "push", "feed failed");
+      pos += chunk;
+    }
+    ok &= bench_check_expect(cnxml_push_parser_finish(parser) == CNXML_ERROR_OK, "push", "finish failed");
+    cnxml_push_parser_free(parser);
+    if (ok && (got.len != expected.len || memcmp(got.ptr, expected.ptr, got.len) != 0)) {
+      fprintf(stderr, "push check: events differ with chunks of up to %llu bytes\n", (unsigned long long)max_chunk);
+      ok = false;
+    }
+    free(got.ptr);
+  }
+  free(expected.ptr);
+  return ok;
+}
+
+static int bench_check_push(uint64_t seed) {
+  bench_corpus_options opts = {4, 5, 3, 16, 20, seed};
+  bench_buffer corpus = {NULL, 0, 0};
+  bench_generate(&corpus, &opts);
+  uint64_t rng = seed * 0x9e3779b97f4a7c15ull + 1;
+
+  cnxml_context* ctx = cnxml_context_new(malloc, realloc, free);
+  bool ok = bench_check_push_doc_chunks(ctx, bench_check_push_doc, sizeof(bench_check_push_doc) - 1, &rng);
+  ok = ok && bench_check_push_doc_chunks(ctx, corpus.ptr, corpus.len, &rng);
+  cnxml_context_free(ctx);
+  free(corpus.ptr);
+  printf("push check: %d chunkings of 2 documents, %s\n", BENCH_CHECK_PUSH_TRIALS, ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+// intern check: threads intern the same names in different orders while
+// reading names back through the lock-free symbol lookup. afterwards
+// every thread must have the same symbol for each name and the symbols
+// must be distinct. built with -fsanitize=thread it's also a race check
+
+#define BENCH_CHECK_INTERN_NAMES 20000 // SPANS SEVERAL NAME PAGES
+#define BENCH_CHECK_INTERN_THREADS 4
+
+typedef struct {
+  cnxml_intern_table* table;
+  cnxml_string* names;
+  uint64_t seed;
+  int order[BENCH_CHECK_INTERN_NAMES];
+  cnxml_symbol symbols[BENCH_CHECK_INTERN_NAMES];
+  bool ok;
+} bench_intern_worker;
+
+static void bench_check_intern_thread(cnxml_any arg) {
+  bench_intern_worker* worker = arg;
+  int* order = worker->order;
+  uint64_t rng = worker->seed * 0x9e3779b97f4a7c15ull + 1;
+  for (int i = 0; i < BENCH_CHECK_INTERN_NAMES; i++) order[i] = i;
+  for (int i = BENCH_CHECK_INTERN_NAMES - 1; i > 0; i--) {
+    int j = (int)(bench_rand(&rng) % (uint64_t)(i + 1));
+    int tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  worker->ok = true;
+  for (int i = 0; i < BENCH_CHECK_INTERN_NAMES; i++) {
+    int index = order[i];
+    cnxml_symbol symbol = cnxml_intern(worker->table, worker->names[index]);
+    worker->symbols[index] = symbol;
+    if (symbol == CNXML_SYMBOL_NONE
+      || !cnxml_string_equal(cnxml_intern_name(worker->table, symbol), worker->names[index])
+      || cnxml_intern_find(worker->table, worker->names[index]) != symbol) {
+      worker->ok = false;
+    }
+  }
+}
+
+static int bench_check_intern(uint64_t seed) {
+  static char names[BENCH_CHECK_INTERN_NAMES][24];
+  static cnxml_string strings[BENCH_CHECK_INTERN_NAMES];
+  static bench_intern_worker workers[BENCH_CHECK_INTERN_THREADS];
+  for (int i = 0; i < BENCH_CHECK_INTERN_NAMES; i++) {
+    snprintf(names[i], sizeof(names[i]), i % 2 ? "n%d" : "name-%d-attr", i);
+    strings[i] = cnxml_string_new(names[i]);
+  }
+
+  cnxml_context* ctx = cnxml_context_new(malloc, realloc, free);
+  cnxml_intern_table* table = cnxml_intern_table_new(ctx);
+  bool ok = bench_check_expect(!CNXML_IS_ERROR(table), "intern", "couldn't create the table");
+  cnxml_thread threads[BENCH_CHECK_INTERN_THREADS];
+  int started = 0;
+  for (int t = 0; ok && t < BENCH_CHECK_INTERN_THREADS; t++) {
+    workers[t].table = table;
+    workers[t].names = strings;
+    workers[t].seed = seed * BENCH_CHECK_INTERN_THREADS + (uint64_t)t;
+    ok &= bench_check_expect(cnxml_thread_start(threads + t, bench_check_intern_thread, workers + t) == CNXML_ERROR_OK,
+      "intern", "couldn't start a thread");
+    if (ok) started++;
+  }
+  for (int t = 0; t < started; t++) cnxml_thread_join(threads + t);
+
+  for (int t = 0; ok && t < BENCH_CHECK_INTERN_THREADS; t++) {
+    ok &= bench_check_expect(workers[t].ok, "intern", "a thread read back the wrong name or symbol");
+  }
+  if (ok) {
+    // symbols are dense from 1, so distinct means a permutation of 1..N
+    static bool used[BENCH_CHECK_INTERN_NAMES + 1];
+    memset(used, 0, sizeof(used));
+    for (int i = 0; ok && i < BENCH_CHECK_INTERN_NAMES; i++) {
+      cnxml_symbol symbol = workers[0].symbols[i];
+      for (int t = 1; t < BENCH_CHECK_INTERN_THREADS; t++) {
+        ok &= bench_check_expect(workers[t].symbols[i] == symbol, "intern", "threads got different symbols for a name");
+      }
+      ok = ok && bench_check_expect(symbol <= BENCH_CHECK_INTERN_NAMES && !used[symbol], "intern", "two names share a symbol");
+      if (ok) used[symbol] = true;
+    }
+    ok = ok && bench_check_expect(cnxml_intern_count(table) == BENCH_CHECK_INTERN_NAMES, "intern", "count is wrong");
+    ok = ok && bench_check_expect(cnxml_intern_find(table, cnxml_string_new("never-interned")) == CNXML_SYMBOL_NONE,
+      "intern", "find made up a symbol");
+  }
+
+  if (!CNXML_IS_ERROR(table)) cnxml_intern_table_free(table);
+  cnxml_context_free(ctx);
+  printf("intern check: %d names from %d threads, %s\n", BENCH_CHECK_INTERN_NAMES, BENCH_CHECK_INTERN_THREADS, ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+static int bench_check(const char* name, uint64_t seed) {
+  if (strcmp(name, "map") == 0) return bench_check_map(seed);
+  if (strcmp(name, "push") == 0) return bench_check_push(seed);
+  if (strcmp(name, "intern") == 0) return bench_check_intern(seed);
+  fprintf(stderr, "unknown check %s\n", name);
+  return 1;
+}
+
+/*** PHASES ***/
+
+typedef enum {
+  BENCH_PHASE_TOKENIZE,
+  BENCH_PHASE_PARSE,
+  BENCH_PHASE_WRITE,
+  BENCH_PHASE_FREE,
+  BENCH_PHASE_COUNT
+} bench_phase;
+
+static const char* bench_phase_names[BENCH_PHASE_COUNT] = {"tokenize", "parse", "write", "free"};
+
+typedef struct {
+  double best[BENCH_PHASE_COUNT];
+  bench_alloc_stats parse_allocs; // PER RUN OVER THE WHOLE CORPUS
+  uint64_t bytes;
+  uint64_t elements;
+  uint64_t tokens;
+  uint64_t output_bytes;
+  uint64_t errors;
+} bench_results;
+
+static uint64_t bench_count_elements(cnxml_element_list* roots) {
+  uint64_t count = 0;
+  size_t capacity = 64;
+  size_t len = 0;
+  cnxml_element_list** stack = malloc(sizeof(cnxml_element_list*) * capacity);
+  stack[len++] = roots;
+  while (len > 0) {
+    cnxml_element_list* list = stack[--len];
+    for (size_t i = 0; i < list->len; i++) {
+      count++;
+      if (list->ptr[i].children == NULL) continue;
+      if (len == capacity) {
+        capacity *= 2;
+        stack = realloc(stack, sizeof(cnxml_element_list*) * capacity);
+      }
+      stack[len++] = list->ptr[i].children;
+    }
+  }
+  free(stack);
+  return count;
+}
+
+static void bench_discard(cnxml_any userdata, const char* data, size_t len) {
+  (void)data;
+  *(uint64_t*)userdata += len;
+}
+
+static void bench_run_input(bench_input input, cnxml_context* ctx, bool first, double* times, bench_results* results) {
+  bool arena = cnxml_context_is_arena(ctx);
+  double start;
+
+  // tokenizer on its own: just walk every token
+  cnxml_tokenizer* tokenizer = cnxml_tokenizer_new(ctx, input.data, input.len);
+  uint64_t tokens = 0;
+  start = bench_now();
+  while (true) {
+    cnxml_token tok = cnxml_tokenizer_next_token(tokenizer);
+    if (tok.type == CNXML_TOKEN_EOF) break;
+    tokens++;
+  }
+  times[BENCH_PHASE_TOKENIZE] += bench_now() - start;
+  cnxml_tokenizer_free(tokenizer);
+  if (arena) cnxml_context_reset(ctx);
+
+  bench_alloc_stats before = bench_allocs;
+  start = bench_now();
+  tokenizer = cnxml_tokenizer_new(ctx, input.data, input.len);
+  cnxml_parser* parser = cnxml_parser_new(NULL, tokenizer);
+  cnxml_element_list* roots = cnxml_parser_read_document(parser);
+  times[BENCH_PHASE_PARSE] += bench_now() - start;
+  if (CNXML_IS_ERROR(roots)) {
+    fprintf(stderr, "out of memory parsing\n");
+    exit(1);
+  }
+  results->parse_allocs.count += bench_allocs.count - before.count;
+  results->parse_allocs.bytes += bench_allocs.bytes - before.bytes;
+
+  uint64_t output_bytes = 0;
+  char buffer[CNXML_SINK_DEFAULT_BUFFER_SIZE];
+  cnxml_sink sink;
+  cnxml_sink_init(&sink, bench_discard, &output_bytes, buffer, sizeof(buffer));
+  start = bench_now();
+  for (size_t i = 0; i < roots->len; i++) {
+    cnxml_element_write_sink(roots->ptr[i], &sink, CNXML_STRING_EMPTY);
+  }
+  cnxml_sink_flush(&sink);
+  times[BENCH_PHASE_WRITE] += bench_now() - start;
+
+  if (first) {
+    results->bytes += input.len;
+    results->elements += bench_count_elements(roots);
+    results->tokens += tokens;
+    results->output_bytes += output_bytes;
+    results->errors += parser->error_count;
+  }
+
+  start = bench_now();
+  if (arena) {
+    cnxml_context_reset(ctx);
+  } else {
+    for (size_t i = 0; i < roots->len; i++) cnxml_element_free(roots->ptr[i]);
+    cnxml_element_list_free(roots);
+    cnxml_parser_free(parser);
+    cnxml_tokenizer_free(tokenizer);
+  }
+  times[BENCH_PHASE_FREE] += bench_now() - start;
+}
+
+static void bench_run(bench_input_list* inputs, cnxml_context* ctx, int iterations, bench_results* results) {
+  for (int p = 0; p < BENCH_PHASE_COUNT; p++) results->best[p] = -1;
+  for (int it = 0; it < iterations; it++) {
+    double times[BENCH_PHASE_COUNT] = {0};
+    for (int i = 0; i < inputs->len; i++) {
+      bench_run_input(inputs->ptr[i], ctx, it == 0, times, results);
+    }
+    for (int p = 0; p < BENCH_PHASE_COUNT; p++) {
+      if (results->best[p] < 0 || times[p] < results->best[p]) results->best[p] = times[p];
+    }
+  }
+  results->parse_allocs.count /= (uint64_t)iterations;
+  results->parse_allocs.bytes /= (uint64_t)iterations;
+}
+
+/*** REPORT ***/
+
+static double bench_rate(double amount, double seconds) {
+  return seconds > 0 ? amount / seconds : 0;
+}
+
+static const char* bench_scan_impl_name(cnxml_scan_impl impl) {
+  switch (impl) {
+  case CNXML_SCAN_IMPL_AVX2: return "avx2";
+  case CNXML_SCAN_IMPL_SSE2: return "sse2";
+  default: return "scalar";
+  }
+}
+
+static void bench_print_json(FILE* f, const bench_corpus_options* corpus, int file_count, bool arena, bool intern, int iterations, bench_results* r) {
+  fprintf(f, "{\n");
+  if (file_count > 0) {
+    fprintf(f, "  \"corpus\": {\"kind\": \"files\", \"count\": %d},\n", file_count);
+  } else {
+    fprintf(f, "  \"corpus\": {\"kind\": \"synthetic\", \"depth\": %d, \"fanout\": %d, \"attrs\": %d, \"text\": %d, \"comments\": %d, \"seed\": %llu},\n",
+      corpus->depth, corpus->fanout, corpus->attrs, corpus->text, corpus->comments, (unsigned long long)corpus->seed);
+  }
+  fprintf(f, "  \"context\": \"%s\",\n", arena ? "arena" : "heap");
+  fprintf(f, "  \"intern\": %s,\n", intern ? "true" : "false");
+  fprintf(f, "  \"scan_impl\": \"%s\",\n", bench_scan_impl_name(cnxml_scan_get_impl()));
+  fprintf(f, "  \"hash_impl\": \"%s\",\n", cnxml_hash_get_impl() == CNXML_HASH_IMPL_CRC32C ? "crc32c" : "portable");
+  fprintf(f, "  \"iterations\": %d,\n", iterations);
+  fprintf(f, "  \"bytes\": %llu,\n", (unsigned long long)r->bytes);
+  fprintf(f, "  \"elements\": %llu,\n", (unsigned long long)r->elements);
+  fprintf(f, "  \"tokens\": %llu,\n", (unsigned long long)r->tokens);
+  fprintf(f, "  \"output_bytes\": %llu,\n", (unsigned long long)r->output_bytes);
+  fprintf(f, "  \"parse_errors\": %llu,\n", (unsigned long long)r->errors);
+  fprintf(f, "  \"phases\": {\n");
+  for (int p = 0; p < BENCH_PHASE_COUNT; p++) {
+    fprintf(f, "    \"%s\": {\"seconds\": %.6f, \"mb_per_s\": %.2f, \"elements_per_s\": %.0f}%s\n",
+      bench_phase_names[p], r->best[p], bench_rate((double)r->bytes / 1e6, r->best[p]),
+      bench_rate((double)r->elements, r->best[p]), p + 1 < BENCH_PHASE_COUNT ? "," : "");
+  }
+  fprintf(f, "  },\n");
+  fprintf(f, "  \"parse_allocations\": {\"count\": %llu, \"bytes\": %llu},\n",
+    (unsigned long long)r->parse_allocs.count, (unsigned long long)r->parse_allocs.bytes);
+  fprintf(f, "  \"peak_rss_bytes\": %llu\n", (unsigned long long)bench_peak_rss());
+  fprintf(f, "}\n");
+}
+
+static void bench_print_table(FILE* f, int file_count, bool arena, bench_results* r) {
+  if (file_count > 0) {
+    fprintf(f, "corpus: %d files", file_count);
+  } else {
+    fprintf(f, "corpus: synthetic");
+  }
+  fprintf(f, ", %.2f MB, %llu elements, %llu tokens, %s context\n\n", (double)r->bytes / 1e6,
+    (unsigned long long)r->elements, (unsigned long long)r->tokens, arena ? "arena" : "heap");
+  fprintf(f, "%-10s %12s %12s %16s\n", "phase", "seconds", "MB/s", "elements/s");
+  for (int p = 0; p < BENCH_PHASE_COUNT; p++) {
+    fprintf(f, "%-10s %12.6f %12.2f %16.0f\n", bench_phase_names[p], r->best[p],
+      bench_rate((double)r->bytes / 1e6, r->best[p]), bench_rate((double)r->elements, r->best[p]));
+  }
+  fprintf(f, "\nparse allocations: %llu (%.2f MB)\n", (unsigned long long)r->parse_allocs.count, (double)r->parse_allocs.bytes / 1e6);
+  fprintf(f, "peak rss: %.2f MB\n", (double)bench_peak_rss() / 1e6);
+  if (r->errors > 0) fprintf(f, "parse errors: %llu\n", (unsigned long long)r->errors);
+}
+
+/*** MAIN ***/
+
+static bool bench_int_arg(int argc, const char** argv, int* i, int* out) {
+  if (*i + 1 >= argc) {
+    fprintf(stderr, "%s needs a value\n", argv[*i]);
+    return false;
+  }
+  *out = atoi(argv[++*i]);
+  return true;
+}
+
+int main(int argc, const char** argv) {
+  bench_corpus_options corpus = {5, 8, 3, 32, 5, 1};
+  int iterations = 5;
+  bool arena = true;
+  bool intern = false;
+  bool json = false;
+  const char* dump_path = NULL;
+  const char* large_path = NULL;
+  int large_mb = 4352;
+  const char* hash_keys_path = NULL;
+  const char* check_name = NULL;
+
+  cnxml_context* file_ctx = cnxml_context_new(malloc, realloc, free);
+  bench_input_list inputs = {NULL, 0, 0};
+  int file_count = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    int value;
+    bool ok = true;
+    if (strcmp(arg, "--depth") == 0) {
+      ok = bench_int_arg(argc, argv, &i, &corpus.depth);
+    } else if (strcmp(arg, "--fanout") == 0) {
+      ok = bench_int_arg(argc, argv, &i, &corpus.fanout);
+    } else if (strcmp(arg, "--attrs") == 0) {
+      ok = bench_int_arg(argc, argv, &i, &corpus.attrs);
+    } else if (strcmp(arg, "--text") == 0) {
+      ok = bench_int_arg(argc, argv, &i, &corpus.text);
+    } else if (strcmp(arg, "--comments") == 0) {
+      ok = bench_int_arg(argc, argv, &i, &corpus.comments);
+    } else if (strcmp(arg, "--seed") == 0) {
+      ok = bench_int_arg(argc, argv, &i, &value);
+      corpus.seed = (uint64_t)value;
+    } else if (strcmp(arg, "--iterations") == 0) {
+      ok = bench_int_arg(argc, argv, &i, &iterations);
+    } else if (strcmp(arg, "--dump") == 0 && i + 1 < argc) {
+      dump_path = argv[++i];
+    } else if (strcmp(arg, "--large-file") == 0 && i + 1 < argc) {
+      large_path = argv[++i];
+    } else if (strcmp(arg, "--large-mb") == 0) {
+      ok = bench_int_arg(argc, argv, &i, &large_mb);
+    } else if (strcmp(arg, "--hash-keys") == 0 && i + 1 < argc) {
+      hash_keys_path = argv[++i];
+    } else if (strcmp(arg, "--check") == 0 && i + 1 < argc) {
+      check_name = argv[++i];
+    } else if (strcmp(arg, "--heap") == 0) {
+      arena = false;
+    } else if (strcmp(arg, "--intern") == 0) {
+      intern = true;
+    } else if (strcmp(arg, "--json") == 0) {
+      json = true;
+    } else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+      fputs(usage, stdout);
+      return 0;
+    } else if (arg[0] == '-' && arg[1] == '-') {
+      fprintf(stderr, "unknown option %s\n\n%s", arg, usage);
+      return 1;
+    } else if (arg[0] == '@') {
+      ok = bench_load_list(file_ctx, &inputs, arg + 1);
+      file_count = inputs.len;
+    } else {
+      ok = bench_load_file(file_ctx, &inputs, arg);
+      file_count = inputs.len;
+    }
+    if (!ok) return 1;
+  }
+  if (iterations < 1) iterations = 1;
+  if (large_path != NULL || hash_keys_path != NULL || check_name != NULL) {
+    int status;
+    if (large_path != NULL) {
+      status = bench_large_file(large_path, large_mb);
+    } else if (hash_keys_path != NULL) {
+      status = bench_hash_keys(hash_keys_path, iterations);
+    } else {
+      status = bench_check(check_name, corpus.seed);
+    }
+    for (int i = 0; i < inputs.len; i++) {
+      if (inputs.ptr[i].source != NULL) cnxml_source_free(inputs.ptr[i].source);
+    }
+    free(inputs.ptr);
+    cnxml_context_free(file_ctx);
+    return status;
+  }
+
+  bench_buffer generated = {NULL, 0, 0};
+  if (file_count == 0) {
+    if (corpus.fanout < 0 || corpus.attrs < 0 || corpus.text < 0) {
+      fprintf(stderr, "corpus sizes can't be negative\n");
+      return 1;
+    }
+    bench_generate(&generated, &corpus);
+    if (dump_path != NULL) {
+      FILE* f = fopen(dump_path, "wb");
+      if (f == NULL || fwrite(generated.ptr, 1, generated.len, f) != generated.len) {
+        fprintf(stderr, "couldn't write %s\n", dump_path);
+        return 1;
+      }
+      fclose(f);
+      free(generated.ptr);
+      cnxml_context_free(file_ctx);
+      return 0;
+    }
+    bench_input_list_add(&inputs, generated.ptr, generated.len, NULL);
+  }
+
+  cnxml_context* ctx = arena
+    ? cnxml_context_new_arena(bench_alloc, bench_realloc, bench_dealloc, 0)
+    : cnxml_context_new(bench_alloc, bench_realloc, bench_dealloc);
+  cnxml_context* symbols_ctx = NULL;
+  if (intern) {
+    symbols_ctx = cnxml_context_new(malloc, realloc, free);
+    cnxml_intern_table* symbols = cnxml_intern_table_new(symbols_ctx);
+    if (CNXML_IS_ERROR(symbols)) {
+      fprintf(stderr, "couldn't create symbol table\n");
+      return 1;
+    }
+    cnxml_context_set_symbols(ctx, symbols);
+  }
+
+  bench_results results;
+  memset(&results, 0, sizeof(results));
+  bench_run(&inputs, ctx, iterations, &results);
+
+  if (json) {
+    bench_print_json(stdout, &corpus, file_count, arena, intern, iterations, &results);
+  } else {
+    bench_print_table(stdout, file_count, arena, &results);
+  }
+
+  if (intern) cnxml_intern_table_free(ctx->symbols);
+  cnxml_context_free(ctx);
+  if (symbols_ctx != NULL) cnxml_context_free(symbols_ctx);
+  free(generated.ptr);
+  for (int i = 0; i < inputs.len; i++) {
+    if (inputs.ptr[i].source != NULL) cnxml_source_free(inputs.ptr[i].source);
+  }
+  free(inputs.ptr);
+  cnxml_context_free(file_ctx);
+  return 0;
+}
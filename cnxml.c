@@ -2,6 +2,9 @@
 #include "cnxml_common.h"
 #include "cnxml_string.h"
 #include "cnxml_hashmap.h"
+#include "cnxml_scan.h"
+#include "cnxml_intern.h"
+#include "cnxml_stats.h"
 
 /*** TOKENIZER ***/
 
@@ -9,7 +12,7 @@ cnxml_tokenizer* cnxml_tokenizer_new(cnxml_context* ctx, const char* data, size_
   if (data == NULL) {
     return (cnxml_tokenizer*)CNXML_ERROR_BADARGS;
   }
-  cnxml_tokenizer* tokenizer = ctx->alloc(sizeof(cnxml_tokenizer));
+  cnxml_tokenizer* tokenizer = cnxml_context_alloc(ctx, sizeof(cnxml_tokenizer));
   if (tokenizer == NULL) {
     return (cnxml_tokenizer*)CNXML_ERROR_ALLOCFAIL;
   }
@@ -17,17 +20,23 @@ cnxml_tokenizer* cnxml_tokenizer_new(cnxml_context* ctx, const char* data, size_
   tokenizer->data = data;
   tokenizer->data_len = data_len;
   tokenizer->current_index = 0;
-  tokenizer->current_line = 1;
-  tokenizer->current_column = 1;
+  tokenizer->line_index = NULL;
+  tokenizer->line_count = 0;
   return tokenizer;
 }
 
-static bool cnxml_tokenizer_is_whitespace(char c) {
-  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+// points the tokenizer at new input, keeping the allocation
+void cnxml_tokenizer_reset(cnxml_tokenizer* tokenizer, const char* data, size_t data_len) {
+  if (tokenizer->line_index != NULL) cnxml_context_dealloc(tokenizer->ctx, tokenizer->line_index);
+  tokenizer->data = data;
+  tokenizer->data_len = data_len;
+  tokenizer->current_index = 0;
+  tokenizer->line_index = NULL;
+  tokenizer->line_count = 0;
 }
 
-static bool cnxml_tokenizer_is_punctuation_or_whitespace(char c) {
-  return cnxml_tokenizer_is_whitespace(c) || c == '<' || c == '>' || c == '=' || c == '/';
+static bool cnxml_tokenizer_is_whitespace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
 }
 
 bool cnxml_tokenizer_is_eof(cnxml_tokenizer* tokenizer) {
@@ -39,66 +48,75 @@ char cnxml_tokenizer_cur_char(cnxml_tokenizer* tokenizer) {
   return tokenizer->data[tokenizer->current_index];
 }
 
-char cnxml_tokenizer_peek(cnxml_tokenizer* tokenizer, int chars) {
-  int idx = tokenizer->current_index + chars;
-  if (idx >= tokenizer->data_len) return '\0';
-  return tokenizer->data[idx];
+// current_index never passes data_len, so the subtraction can't wrap
+char cnxml_tokenizer_peek(cnxml_tokenizer* tokenizer, size_t chars) {
+  if (chars >= tokenizer->data_len - tokenizer->current_index) return '\0';
+  return tokenizer->data[tokenizer->current_index + chars];
 }
 
-void cnxml_tokenizer_move(cnxml_tokenizer* tokenizer, int chars) {
-  int prev_index = tokenizer->current_index;
-  tokenizer->current_index += chars;
-  if (tokenizer->current_index >= tokenizer->data_len) {
-    tokenizer->current_index = (int)tokenizer->data_len; // one over so that eof is detected
+void cnxml_tokenizer_move(cnxml_tokenizer* tokenizer, size_t chars) {
+  if (chars >= tokenizer->data_len - tokenizer->current_index) {
+    tokenizer->current_index = tokenizer->data_len; // stop at the end so that eof is detected
     return;
   }
-  for (int i = prev_index; i < tokenizer->current_index && i < tokenizer->data_len; i++) {
-    if (tokenizer->data[i] == '\n') {
-      tokenizer->current_line += 1;
-      tokenizer->current_column = 1;
-    } else {
-      tokenizer->current_column += 1;
-    }
-  }
-
+  tokenizer->current_index += chars;
 }
 
 bool cnxml_tokenizer_match_string(cnxml_tokenizer* tokenizer, cnxml_string str) {
-  for (int i = 0; i < str.len; i++) {
+  for (size_t i = 0; i < str.len; i++) {
     if (cnxml_tokenizer_peek(tokenizer, i) != str.ptr[i]) return false;
   }
   return true;
 }
 
+// moves to the start of the next occurrence of str, or to eof
+static void INTERNAL_cnxml_tokenizer_skip_to(cnxml_tokenizer* tokenizer, cnxml_string str) {
+  size_t remaining = tokenizer->data_len - tokenizer->current_index;
+  size_t offs = cnxml_scan_string(tokenizer->data + tokenizer->current_index, remaining, str.ptr, str.len);
+  cnxml_tokenizer_move(tokenizer, offs);
+}
+
 void cnxml_tokenizer_skip_whitespace(cnxml_tokenizer* tokenizer) {
-  cnxml_string comment_start = cnxml_string_new("<!--");
-  cnxml_string comment_end = cnxml_string_new("-->");
-  cnxml_string special_start = cnxml_string_new("<?");
-  cnxml_string special_end = cnxml_string_new("?>");
+  cnxml_string comment_start = cnxml_string_newlen("<!--", 4);
+  cnxml_string comment_end = cnxml_string_newlen("-->", 3);
+  cnxml_string declaration_end = cnxml_string_newlen(">", 1);
+  cnxml_string special_start = cnxml_string_newlen("<?", 2);
+  cnxml_string special_end = cnxml_string_newlen("?>", 2);
 
   while (!cnxml_tokenizer_is_eof(tokenizer)) {
-    if (cnxml_tokenizer_is_whitespace(cnxml_tokenizer_cur_char(tokenizer))) {
-      cnxml_tokenizer_move(tokenizer, 1);
+    char c = cnxml_tokenizer_cur_char(tokenizer);
+    if (cnxml_tokenizer_is_whitespace(c)) {
+      size_t len = 1;
+      while (cnxml_tokenizer_is_whitespace(cnxml_tokenizer_peek(tokenizer, len))) len += 1;
+      cnxml_tokenizer_move(tokenizer, len);
+    } else if (c != '<') {
+      break;
     } else if (cnxml_tokenizer_match_string(tokenizer, comment_start)) {
-      cnxml_tokenizer_move(tokenizer, (int)comment_start.len);
-      while (!cnxml_tokenizer_is_eof(tokenizer) && !cnxml_tokenizer_match_string(tokenizer, comment_end)) {
-        cnxml_tokenizer_move(tokenizer, 1);
-      }
+#ifdef CNXML_ENABLE_STATS
+      size_t start = tokenizer->current_index;
+#endif
+      cnxml_tokenizer_move(tokenizer, comment_start.len);
+      INTERNAL_cnxml_tokenizer_skip_to(tokenizer, comment_end);
       if (cnxml_tokenizer_match_string(tokenizer, comment_end)) {
-        cnxml_tokenizer_move(tokenizer, (int)comment_end.len);
+        cnxml_tokenizer_move(tokenizer, comment_end.len);
       }
-    } else if (cnxml_tokenizer_cur_char(tokenizer) == '<' && cnxml_tokenizer_peek(tokenizer, 1) == '!') {
+      CNXML_STATS_RECORD(tokenizer->ctx, stats->comment_bytes += tokenizer->current_index - start);
+    } else if (cnxml_tokenizer_peek(tokenizer, 1) == '!') {
+#ifdef CNXML_ENABLE_STATS
+      size_t start = tokenizer->current_index;
+#endif
       cnxml_tokenizer_move(tokenizer, 2);
-      while (!cnxml_tokenizer_is_eof(tokenizer) && cnxml_tokenizer_cur_char(tokenizer) != '>') {
-        cnxml_tokenizer_move(tokenizer, 1);
-      }
+      INTERNAL_cnxml_tokenizer_skip_to(tokenizer, declaration_end);
       if (cnxml_tokenizer_cur_char(tokenizer) == '>') cnxml_tokenizer_move(tokenizer, 1);
+      CNXML_STATS_RECORD(tokenizer->ctx, stats->declaration_bytes += tokenizer->current_index - start);
     } else if (cnxml_tokenizer_match_string(tokenizer, special_start)) {
-      cnxml_tokenizer_move(tokenizer, (int)special_start.len);
-      while (!cnxml_tokenizer_is_eof(tokenizer) && !cnxml_tokenizer_match_string(tokenizer, special_end)) {
-        cnxml_tokenizer_move(tokenizer, 1);
-      }
-      if (cnxml_tokenizer_match_string(tokenizer, special_end)) cnxml_tokenizer_move(tokenizer, (int)special_end.len);
+#ifdef CNXML_ENABLE_STATS
+      size_t start = tokenizer->current_index;
+#endif
+      cnxml_tokenizer_move(tokenizer, special_start.len);
+      INTERNAL_cnxml_tokenizer_skip_to(tokenizer, special_end);
+      if (cnxml_tokenizer_match_string(tokenizer, special_end)) cnxml_tokenizer_move(tokenizer, special_end.len);
+      CNXML_STATS_RECORD(tokenizer->ctx, stats->instruction_bytes += tokenizer->current_index - start);
     } else {
       break;
     }
@@ -106,27 +124,30 @@ void cnxml_tokenizer_skip_whitespace(cnxml_tokenizer* tokenizer) {
 }
 
 cnxml_string cnxml_tokenizer_read_quoted_string(cnxml_tokenizer* tokenizer) {
-  int start_idx = tokenizer->current_index;
-  int len = 0;
-  while (!cnxml_tokenizer_is_eof(tokenizer) && cnxml_tokenizer_cur_char(tokenizer) != '"') {
-    len += 1;
-    cnxml_tokenizer_move(tokenizer, 1);
-  }
+  size_t start_idx = tokenizer->current_index;
+  size_t len = cnxml_scan_char(tokenizer->data + start_idx, tokenizer->data_len - start_idx, '"');
+  cnxml_tokenizer_move(tokenizer, len);
   cnxml_tokenizer_move(tokenizer, 1);
   return cnxml_string_newlen(tokenizer->data + start_idx, len);
 }
 
 cnxml_string cnxml_tokenizer_read_unquoted_string(cnxml_tokenizer* tokenizer) {
-  int start_idx = tokenizer->current_index;
-  int len = 0;
-  while (!cnxml_tokenizer_is_eof(tokenizer) && !cnxml_tokenizer_is_punctuation_or_whitespace(cnxml_tokenizer_cur_char(tokenizer))) {
-    len += 1;
-    cnxml_tokenizer_move(tokenizer, 1);
-  }
+  size_t start_idx = tokenizer->current_index;
+  size_t len = cnxml_scan_punctuation_or_whitespace(tokenizer->data + start_idx, tokenizer->data_len - start_idx);
+  cnxml_tokenizer_move(tokenizer, len);
   return cnxml_string_newlen(tokenizer->data + start_idx, len);
 }
 
-cnxml_token cnxml_tokenizer_next_token(cnxml_tokenizer* tokenizer) {
+// reads character data up to the next '<', without trailing whitespace
+cnxml_string cnxml_tokenizer_read_text(cnxml_tokenizer* tokenizer) {
+  size_t start_idx = tokenizer->current_index;
+  size_t len = cnxml_scan_char(tokenizer->data + start_idx, tokenizer->data_len - start_idx, '<');
+  cnxml_tokenizer_move(tokenizer, len);
+  while (len > 0 && cnxml_tokenizer_is_whitespace(tokenizer->data[start_idx + len - 1])) len -= 1;
+  return cnxml_string_newlen(tokenizer->data + start_idx, len);
+}
+
+static cnxml_token INTERNAL_cnxml_tokenizer_read_token(cnxml_tokenizer* tokenizer) {
   cnxml_tokenizer_skip_whitespace(tokenizer);
 
   if (cnxml_tokenizer_is_eof(tokenizer)) return (cnxml_token){CNXML_TOKEN_EOF, CNXML_STRING_EMPTY};
@@ -153,6 +174,65 @@ cnxml_token cnxml_tokenizer_next_token(cnxml_tokenizer* tokenizer) {
   }
 }
 
+cnxml_token cnxml_tokenizer_next_token(cnxml_tokenizer* tokenizer) {
+  cnxml_token tok = INTERNAL_cnxml_tokenizer_read_token(tokenizer);
+  CNXML_STATS_RECORD(tokenizer->ctx, stats->tokens[tok.type] += 1);
+  return tok;
+}
+
+static bool INTERNAL_cnxml_tokenizer_build_line_index(cnxml_tokenizer* tokenizer) {
+  size_t count = cnxml_scan_count_char(tokenizer->data, tokenizer->data_len, '\n');
+  // one extra slot so the index is never a zero-sized allocation
+  size_t* index = cnxml_context_alloc(tokenizer->ctx, sizeof(size_t) * (count + 1));
+  if (index == NULL) return false;
+
+  size_t offs = 0;
+  for (size_t i = 0; i < count; i++) {
+    offs += cnxml_scan_char(tokenizer->data + offs, tokenizer->data_len - offs, '\n');
+    index[i] = offs;
+    offs += 1;
+  }
+
+  tokenizer->line_index = index;
+  tokenizer->line_count = count;
+  return true;
+}
+
+void cnxml_tokenizer_position(cnxml_tokenizer* tokenizer, size_t offset, size_t* line_out, size_t* column_out) {
+  if (offset > tokenizer->data_len) offset = tokenizer->data_len;
+
+  // number of newlines before offset, found by binary search
+  // over the lazily built index
+  size_t lo = 0;
+  size_t last_newline = 0;
+  bool has_newline = false;
+  if (tokenizer->line_index != NULL || INTERNAL_cnxml_tokenizer_build_line_index(tokenizer)) {
+    size_t hi = tokenizer->line_count;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (tokenizer->line_index[mid] < offset) lo = mid + 1;
+      else hi = mid;
+    }
+    if (lo > 0) {
+      has_newline = true;
+      last_newline = tokenizer->line_index[lo - 1];
+    }
+  } else {
+    // out of memory, fall back to counting
+    lo = cnxml_scan_count_char(tokenizer->data, offset, '\n');
+    for (size_t i = offset; i > 0; i--) {
+      if (tokenizer->data[i - 1] == '\n') {
+        has_newline = true;
+        last_newline = i - 1;
+        break;
+      }
+    }
+  }
+
+  if (line_out != NULL) *line_out = lo + 1;
+  if (column_out != NULL) *column_out = has_newline ? offset - last_newline : offset + 1;
+}
+
 const char* cnxml_tokenizer_token_type_name(cnxml_token_type type) {
   switch(type) {
   case CNXML_TOKEN_UNKNOWN: return "UNKNOWN";
@@ -175,11 +255,18 @@ void cnxml_tokenizer_print_token(FILE* f, cnxml_token tok) {
 }
 
 void cnxml_tokenizer_free(cnxml_tokenizer* tokenizer) {
-  tokenizer->ctx->dealloc(tokenizer);
+  if (tokenizer->line_index != NULL) cnxml_context_dealloc(tokenizer->ctx, tokenizer->line_index);
+  cnxml_context_dealloc(tokenizer->ctx, tokenizer);
 }
 
 /*** PARSER ***/
 
+// defined below with the other attribute functions. parsed values go
+// in through it with literal off
+static cnxml_error INTERNAL_cnxml_element_put_attribute(cnxml_element* elem, cnxml_string name, cnxml_string value, bool literal);
+// the same for text runs
+static void INTERNAL_cnxml_element_add_text(cnxml_element* elem, cnxml_string str, bool literal);
+
 cnxml_parser* cnxml_parser_new(cnxml_context* ctx, cnxml_tokenizer* tokenizer) {
   if (tokenizer == NULL) {
     return (cnxml_parser*)CNXML_ERROR_BADARGS;
@@ -187,7 +274,7 @@ cnxml_parser* cnxml_parser_new(cnxml_context* ctx, cnxml_tokenizer* tokenizer) {
   if (ctx == NULL) {
      ctx = tokenizer->ctx;
   }
-  cnxml_parser* parser = ctx->alloc(sizeof(cnxml_parser));
+  cnxml_parser* parser = cnxml_context_alloc(ctx, sizeof(cnxml_parser));
   if (parser == NULL) {
     return (cnxml_parser*)CNXML_ERROR_ALLOCFAIL;
   }
@@ -196,6 +283,10 @@ cnxml_parser* cnxml_parser_new(cnxml_context* ctx, cnxml_tokenizer* tokenizer) {
   parser->tokenizer = tokenizer;
   parser->error_buffer = NULL;
   parser->error_count = 0;
+  parser->stack = NULL;
+  parser->stack_len = 0;
+  parser->stack_capacity = 0;
+  parser->max_depth = CNXML_PARSER_DEFAULT_MAX_DEPTH;
   return parser;
 }
 
@@ -231,6 +322,9 @@ const char* cnxml_parser_error_message(cnxml_context* ctx, cnxml_parser_error* e
   case CNXML_PARSER_ERROR_TOO_MANY_ERRORS:
     base_msg = "Too many errors were thrown. No more errors will be reported.";
     break;
+  case CNXML_PARSER_ERROR_MAX_DEPTH_EXCEEDED:
+    base_msg = "Elements are nested deeper than the parser allows.";
+    break;
   default:
     base_msg = "Unknown error.";
     break;
@@ -243,7 +337,7 @@ const char* cnxml_parser_error_message(cnxml_context* ctx, cnxml_parser_error* e
       static const char* text = " Name: ";
       static const size_t text_len = 7;
       size_t new_buf_len = base_msg_len + text_len + err->actual_name.len + 1;
-      char* new_buf = ctx->alloc(new_buf_len * sizeof(char));
+      char* new_buf = cnxml_context_alloc(ctx, new_buf_len * sizeof(char));
       memcpy(new_buf, base_msg, base_msg_len);
       memcpy(new_buf + base_msg_len, text, text_len);
       memcpy(new_buf + base_msg_len + text_len, err->actual_name.ptr, err->actual_name.len);
@@ -255,7 +349,7 @@ const char* cnxml_parser_error_message(cnxml_context* ctx, cnxml_parser_error* e
       static const char* actual = ", got: ";
       static const size_t actual_len = 7;
       size_t new_buf_len = base_msg_len + expected_len + err->expected_name.len + actual_len + err->actual_name.len + 1;
-      char* new_buf = ctx->alloc(new_buf_len * sizeof(char));
+      char* new_buf = cnxml_context_alloc(ctx, new_buf_len * sizeof(char));
       size_t offs = 0;
       memcpy(new_buf + offs, base_msg, base_msg_len);
       offs += base_msg_len;
@@ -281,17 +375,19 @@ void cnxml_parser_report_error(cnxml_parser* parser, cnxml_parser_error_type typ
   }
 
   cnxml_context* ctx = parser->ctx;
-  cnxml_parser_error* err = ctx->alloc(sizeof(cnxml_parser_error));  
+  cnxml_parser_error* err = cnxml_context_alloc(ctx, sizeof(cnxml_parser_error));  
 
   err->type = type;
   err->actual_name = actual_name;
   err->expected_name = expected_name;
-  err->line = parser->tokenizer->current_line;
-  err->column = parser->tokenizer->current_column;
+  err->offset = parser->tokenizer->current_index;
+  // errors are rare, so the first one pays for the tokenizer's line
+  // index and the rest are a binary search
+  cnxml_tokenizer_position(parser->tokenizer, err->offset, &err->line, &err->column);
   err->message = cnxml_parser_error_message(ctx, err);
 
   if (parser->error_buffer == NULL) {
-    parser->error_buffer = ctx->alloc(sizeof(cnxml_parser_error*) * CNXML_PARSER_ERROR_BUFFER_SIZE);
+    parser->error_buffer = cnxml_context_alloc(ctx, sizeof(cnxml_parser_error*) * CNXML_PARSER_ERROR_BUFFER_SIZE);
   }
 
   size_t idx = parser->error_count;
@@ -302,107 +398,271 @@ void cnxml_parser_report_error(cnxml_parser* parser, cnxml_parser_error_type typ
     // if buffer is 1 away from being full, a dummy error is added
     // informing the user of the fact that no more errors will be
     // reported
-    err = ctx->alloc(sizeof(cnxml_parser_error));
+    err = cnxml_context_alloc(ctx, sizeof(cnxml_parser_error));
     err->type = CNXML_PARSER_ERROR_TOO_MANY_ERRORS;
     err->actual_name = CNXML_STRING_EMPTY;
     err->expected_name = CNXML_STRING_EMPTY;
-    err->line = parser->tokenizer->current_line;
-    err->column = parser->tokenizer->current_column;
+    err->offset = parser->tokenizer->current_index;
+    cnxml_tokenizer_position(parser->tokenizer, err->offset, &err->line, &err->column);
     err->message = cnxml_parser_error_message(ctx, err);
     parser->error_count = CNXML_PARSER_ERROR_BUFFER_SIZE;
     parser->error_buffer[CNXML_PARSER_ERROR_BUFFER_SIZE - 1] = err;
   }
 }
 
+void cnxml_parser_error_position(cnxml_parser_error* error, size_t* line_out, size_t* column_out) {
+  if (line_out != NULL) *line_out = error->line;
+  if (column_out != NULL) *column_out = error->column;
+}
+
 void cnxml_parser_error_print(FILE* f, cnxml_parser_error* error) {
-  fprintf(f, "%s [%d:%d]", error->message, error->line, error->column);
+  size_t line, column;
+  cnxml_parser_error_position(error, &line, &column);
+  fprintf(f, "%s [%llu:%llu]", error->message, (unsigned long long)line, (unsigned long long)column);
 }
 
-cnxml_element INTERNAL_cnxml_parser_read_element(cnxml_parser* parser, bool skip_opening_tag) {
+// the tokenizer calls the parser makes, timed into tokenize_seconds when
+// the context records stats
+static inline cnxml_token INTERNAL_cnxml_parser_next_token(cnxml_parser* parser) {
+#ifdef CNXML_ENABLE_STATS
+  if (parser->ctx->stats != NULL && parser->ctx->stats->split_tokenize_time) {
+    double start = cnxml_stats_now();
+    cnxml_token tok = cnxml_tokenizer_next_token(parser->tokenizer);
+    parser->ctx->stats->tokenize_seconds += cnxml_stats_now() - start;
+    return tok;
+  }
+#endif
+  return cnxml_tokenizer_next_token(parser->tokenizer);
+}
+
+static inline void INTERNAL_cnxml_parser_skip_whitespace(cnxml_parser* parser) {
+#ifdef CNXML_ENABLE_STATS
+  if (parser->ctx->stats != NULL && parser->ctx->stats->split_tokenize_time) {
+    double start = cnxml_stats_now();
+    cnxml_tokenizer_skip_whitespace(parser->tokenizer);
+    parser->ctx->stats->tokenize_seconds += cnxml_stats_now() - start;
+    return;
+  }
+#endif
+  cnxml_tokenizer_skip_whitespace(parser->tokenizer);
+}
+
+static inline cnxml_string INTERNAL_cnxml_parser_read_text(cnxml_parser* parser) {
+#ifdef CNXML_ENABLE_STATS
+  if (parser->ctx->stats != NULL && parser->ctx->stats->split_tokenize_time) {
+    double start = cnxml_stats_now();
+    cnxml_string text = cnxml_tokenizer_read_text(parser->tokenizer);
+    parser->ctx->stats->tokenize_seconds += cnxml_stats_now() - start;
+    return text;
+  }
+#endif
+  return cnxml_tokenizer_read_text(parser->tokenizer);
+}
+
+#ifdef CNXML_ENABLE_STATS
+static void INTERNAL_cnxml_parser_stats_end(cnxml_parser* parser, cnxml_parse_stats* stats, double start, size_t start_index) {
+  stats->parse_seconds += cnxml_stats_now() - start;
+  stats->bytes += parser->tokenizer->current_index - start_index;
+}
+#endif
+
+// reads the start tag into elem. returns false if the element has no
+// content to read (self-closing, or the input ended inside the tag)
+static bool INTERNAL_cnxml_parser_read_start_tag(cnxml_parser* parser, cnxml_element* elem, bool skip_opening_tag) {
   cnxml_token tok;
   if (!skip_opening_tag) {
-    tok = cnxml_tokenizer_next_token(parser->tokenizer);
+    tok = INTERNAL_cnxml_parser_next_token(parser);
     if (tok.type != CNXML_TOKEN_OPENLESS) {
       cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_NO_OPENING_SYMBOL_FOUND, CNXML_STRING_EMPTY, CNXML_STRING_EMPTY);
     }
   }
-  tok = cnxml_tokenizer_next_token(parser->tokenizer);
+  tok = INTERNAL_cnxml_parser_next_token(parser);
   if (tok.type != CNXML_TOKEN_STRING) {
     cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MISSING_ELEMENT_NAME, CNXML_STRING_EMPTY, CNXML_STRING_EMPTY);
   }
 
-  cnxml_element elem = cnxml_element_new(parser->ctx, tok.content);
-  bool self_closing = false;
+  *elem = cnxml_element_new(parser->ctx, tok.content);
+  CNXML_STATS_RECORD(parser->ctx, stats->elements += 1);
 
   while (true) {
-    tok = cnxml_tokenizer_next_token(parser->tokenizer);
+    tok = INTERNAL_cnxml_parser_next_token(parser);
     switch (tok.type) {
     case CNXML_TOKEN_EOF:
-      return elem;
+      return false;
     case CNXML_TOKEN_SLASH:
       if (cnxml_tokenizer_cur_char(parser->tokenizer) == '>') {
         cnxml_tokenizer_move(parser->tokenizer, 1);
-        self_closing = true;
+        return false;
       }
-      goto break_loop;
+      return true;
     case CNXML_TOKEN_CLOSEGREATER:
-      goto break_loop;
+      return true;
     case CNXML_TOKEN_STRING:
-      cnxml_parser_read_attribute(parser, &elem, tok.content);
+      cnxml_parser_read_attribute(parser, elem, tok.content);
+      break;
+    default:
       break;
     }
   }
+}
 
-break_loop:
+static bool INTERNAL_cnxml_parser_push(cnxml_parser* parser, cnxml_element* elem) {
+  if (parser->stack_len == parser->stack_capacity) {
+    size_t new_capacity = parser->stack_capacity == 0 ? CNXML_PARSER_STACK_INITIAL_CAPACITY : parser->stack_capacity * 2;
+    cnxml_element** new_stack = cnxml_context_realloc(parser->ctx, parser->stack, sizeof(cnxml_element*) * new_capacity);
+    if (new_stack == NULL) return false;
+    parser->stack = new_stack;
+    parser->stack_capacity = new_capacity;
+  }
+  parser->stack[parser->stack_len] = elem;
+  parser->stack_len += 1;
+  CNXML_STATS_RECORD(parser->ctx, if (parser->stack_len > stats->max_depth) stats->max_depth = parser->stack_len);
+  return true;
+}
 
-  if (self_closing) return elem;
+// reads elements and text into the elements on parser->stack until they
+// are all closed or the input ends. they can be pointed at directly: only
+// the innermost one gets children appended, so the lists holding the
+// outer ones never move while they are on the stack
+static void INTERNAL_cnxml_parser_read_content(cnxml_parser* parser) {
+  while (parser->stack_len > 0) {
+    cnxml_element* elem = parser->stack[parser->stack_len - 1];
+
+    INTERNAL_cnxml_parser_skip_whitespace(parser);
+    if (!cnxml_tokenizer_is_eof(parser->tokenizer) && cnxml_tokenizer_cur_char(parser->tokenizer) != '<') {
+      INTERNAL_cnxml_element_add_text(elem, INTERNAL_cnxml_parser_read_text(parser), false);
+      continue;
+    }
 
-  while (true) {
-    tok = cnxml_tokenizer_next_token(parser->tokenizer);
+    cnxml_token tok = INTERNAL_cnxml_parser_next_token(parser);
     switch (tok.type) {
     case CNXML_TOKEN_EOF:
-      return elem;    
+      return;
     case CNXML_TOKEN_OPENLESS:
       if (cnxml_tokenizer_cur_char(parser->tokenizer) == '/') {
         cnxml_tokenizer_move(parser->tokenizer, 1);
 
-        cnxml_token end_name = cnxml_tokenizer_next_token(parser->tokenizer);
-        if (end_name.type == CNXML_TOKEN_STRING && cnxml_string_equal(end_name.content, elem.name)) {
-          cnxml_token close_greater = cnxml_tokenizer_next_token(parser->tokenizer);
-          if (close_greater.type == CNXML_TOKEN_CLOSEGREATER) {
-            return elem;
-          } else {
+        cnxml_token end_name = INTERNAL_cnxml_parser_next_token(parser);
+        if (end_name.type == CNXML_TOKEN_STRING && cnxml_string_equal(end_name.content, elem->name)) {
+          cnxml_token close_greater = INTERNAL_cnxml_parser_next_token(parser);
+          if (close_greater.type != CNXML_TOKEN_CLOSEGREATER) {
             cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_NO_CLOSING_SYMBOL_FOUND, end_name.content, CNXML_STRING_EMPTY);
           }
         } else {
-          cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MISMATCHED_CLOSING_TAG, elem.name, end_name.content);
+          cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MISMATCHED_CLOSING_TAG, elem->name, end_name.content);
         }
 
-        return elem;
+        parser->stack_len -= 1;
       } else {
-        if (elem.children == NULL) {
-          elem.children = cnxml_element_list_new(parser->ctx);
+        if (parser->max_depth > 0 && parser->stack_len >= parser->max_depth) {
+          // give up on the rest of the input rather than guess where
+          // the too-deep subtree ends
+          cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MAX_DEPTH_EXCEEDED, elem->name, CNXML_STRING_EMPTY);
+          return;
+        }
+        if (elem->children == NULL) {
+          cnxml_element_list* children = cnxml_element_list_new(parser->ctx);
+          if (CNXML_IS_ERROR(children)) return;
+          elem->children = children;
+        }
+        if (cnxml_element_list_append(elem->children, cnxml_element_new(parser->ctx, CNXML_STRING_EMPTY)) != CNXML_ERROR_OK) {
+          return;
+        }
+        cnxml_element* child = elem->children->ptr + elem->children->len - 1;
+        if (INTERNAL_cnxml_parser_read_start_tag(parser, child, true)) {
+          if (!INTERNAL_cnxml_parser_push(parser, child)) return;
         }
-        cnxml_element_list_append(elem.children, INTERNAL_cnxml_parser_read_element(parser, true));
       }
       break;
     default:
-      cnxml_element_add_text_content(&elem, tok.content);
+      break;
     }
   }
 }
 
+// parser->stack_len is left at the number of elements the input ended in
+cnxml_element INTERNAL_cnxml_parser_read_element(cnxml_parser* parser, bool skip_opening_tag) {
+  cnxml_element root;
+  parser->stack_len = 0;
+  if (!INTERNAL_cnxml_parser_read_start_tag(parser, &root, skip_opening_tag)) return root;
+  if (!INTERNAL_cnxml_parser_push(parser, &root)) return root;
+  INTERNAL_cnxml_parser_read_content(parser);
+  return root;
+}
+
 cnxml_element cnxml_parser_read_element(cnxml_parser* parser) {
-  return INTERNAL_cnxml_parser_read_element(parser, false);
+#ifdef CNXML_ENABLE_STATS
+  double start = parser->ctx->stats != NULL ? cnxml_stats_now() : 0;
+  size_t start_index = parser->tokenizer->current_index;
+#endif
+  cnxml_element root = INTERNAL_cnxml_parser_read_element(parser, false);
+  CNXML_STATS_RECORD(parser->ctx, INTERNAL_cnxml_parser_stats_end(parser, stats, start, start_index));
+  return root;
+}
+
+// reads everything up to parent's end tag into parent, as if its start
+// tag had just been read. if the input ends first, parser->stack_len is
+// left at the number of elements still open, counting parent
+void cnxml_parser_read_content(cnxml_parser* parser, cnxml_element* parent) {
+#ifdef CNXML_ENABLE_STATS
+  double start = parser->ctx->stats != NULL ? cnxml_stats_now() : 0;
+  size_t start_index = parser->tokenizer->current_index;
+#endif
+  parser->stack_len = 0;
+  if (INTERNAL_cnxml_parser_push(parser, parent)) INTERNAL_cnxml_parser_read_content(parser);
+  CNXML_STATS_RECORD(parser->ctx, INTERNAL_cnxml_parser_stats_end(parser, stats, start, start_index));
+}
+
+// reads every top-level element until the input ends, for fragments
+// with more than one root
+cnxml_element_list* cnxml_parser_read_document(cnxml_parser* parser) {
+  cnxml_element_list* roots = cnxml_element_list_new(parser->ctx);
+  if (CNXML_IS_ERROR(roots)) return roots;
+#ifdef CNXML_ENABLE_STATS
+  double start = parser->ctx->stats != NULL ? cnxml_stats_now() : 0;
+  size_t start_index = parser->tokenizer->current_index;
+#endif
+
+  cnxml_tokenizer* tokenizer = parser->tokenizer;
+  parser->stack_len = 0;
+  while (true) {
+    INTERNAL_cnxml_parser_skip_whitespace(parser);
+    if (cnxml_tokenizer_is_eof(tokenizer)) break;
+
+    if (cnxml_tokenizer_cur_char(tokenizer) != '<') {
+      cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_NO_OPENING_SYMBOL_FOUND, CNXML_STRING_EMPTY, CNXML_STRING_EMPTY);
+      INTERNAL_cnxml_parser_read_text(parser);
+      continue;
+    }
+    if (cnxml_tokenizer_peek(tokenizer, 1) == '/') {
+      // an end tag with nothing open
+      cnxml_tokenizer_move(tokenizer, 2);
+      cnxml_token end_name = INTERNAL_cnxml_parser_next_token(parser);
+      cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MISMATCHED_CLOSING_TAG, end_name.content, CNXML_STRING_EMPTY);
+      if (INTERNAL_cnxml_parser_next_token(parser).type == CNXML_TOKEN_EOF) break;
+      continue;
+    }
+
+    if (cnxml_element_list_append(roots, INTERNAL_cnxml_parser_read_element(parser, false)) != CNXML_ERROR_OK) break;
+    if (parser->stack_len > 0) break;
+  }
+  CNXML_STATS_RECORD(parser->ctx, INTERNAL_cnxml_parser_stats_end(parser, stats, start, start_index));
+  return roots;
+}
+
+// limits how deeply elements may nest, 0 for no limit. parsing stops
+// with CNXML_PARSER_ERROR_MAX_DEPTH_EXCEEDED when it's hit
+void cnxml_parser_set_max_depth(cnxml_parser* parser, size_t max_depth) {
+  parser->max_depth = max_depth;
 }
 
 void cnxml_parser_read_attribute(cnxml_parser* parser, cnxml_element* target, cnxml_string name) {
-  cnxml_token tok = cnxml_tokenizer_next_token(parser->tokenizer);
+  cnxml_token tok = INTERNAL_cnxml_parser_next_token(parser);
   if (tok.type == CNXML_TOKEN_EQUAL) {
-    tok = cnxml_tokenizer_next_token(parser->tokenizer);
+    tok = INTERNAL_cnxml_parser_next_token(parser);
     if (tok.type == CNXML_TOKEN_STRING) {
-      cnxml_string* stored_value = cnxml_string_stored(parser->ctx, tok.content);
-      cnxml_hashmap_put(target->attributes, name, stored_value);
+      INTERNAL_cnxml_element_put_attribute(target, name, tok.content, false);
+      CNXML_STATS_RECORD(parser->ctx, stats->attributes += 1);
     } else {
       cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MISSING_ATTRIBUTE_VALUE, name, CNXML_STRING_EMPTY);
     }
@@ -413,32 +673,35 @@ void cnxml_parser_read_attribute(cnxml_parser* parser, cnxml_element* target, cn
 
 void cnxml_parser_free(cnxml_parser* parser) {
   if (parser->error_buffer != NULL) {
-    for (int i = 0; i < CNXML_PARSER_ERROR_BUFFER_SIZE; i++) {
+    for (size_t i = 0; i < parser->error_count; i++) {
       cnxml_parser_error* err = parser->error_buffer[i];
-      parser->ctx->dealloc(err);
+      cnxml_context_dealloc(parser->ctx, err);
     }
-    parser->ctx->dealloc(parser->error_buffer);
+    cnxml_context_dealloc(parser->ctx, parser->error_buffer);
   }
-  parser->ctx->dealloc(parser);
+  if (parser->stack != NULL) cnxml_context_dealloc(parser->ctx, parser->stack);
+  cnxml_context_dealloc(parser->ctx, parser);
 }
 
 
 /*** MISCELLANEOUS ***/
 cnxml_element_list* cnxml_element_list_new(cnxml_context* ctx) {
-  cnxml_element_list* list = ctx->alloc(sizeof(cnxml_element_list));
+  cnxml_element_list* list = cnxml_context_alloc(ctx, sizeof(cnxml_element_list));
   if (list == NULL) return (cnxml_element_list*)(CNXML_ERROR_ALLOCFAIL);
   list->ctx = ctx;
-  list->capacity = CNXML_ELEMENT_LIST_GROW_AMOUNT;
+  list->capacity = CNXML_ELEMENT_LIST_INITIAL_CAPACITY;
   list->len = 0;
-  list->ptr = ctx->alloc(sizeof(cnxml_element) * list->capacity);
+  list->ptr = cnxml_context_alloc(ctx, sizeof(cnxml_element) * list->capacity);
   if (list->ptr == NULL) return (cnxml_element_list*)(CNXML_ERROR_ALLOCFAIL);
   return list; 
 }
 
 cnxml_error cnxml_element_list_append(cnxml_element_list* list, cnxml_element elem) {
+  if (list->ctx->read_only) return CNXML_ERROR_BADARGS;
   if (list->len == list->capacity) {
-    int new_capacity = list->capacity + CNXML_ELEMENT_LIST_GROW_AMOUNT;
-    void* new_ptr = list->ctx->realloc(list->ptr, sizeof(cnxml_element) * new_capacity);
+    // grow geometrically, arena reallocs can't free the old block
+    size_t new_capacity = list->capacity * 2;
+    void* new_ptr = cnxml_context_realloc(list->ctx, list->ptr, sizeof(cnxml_element) * new_capacity);
     if (new_ptr == NULL) {
       return CNXML_ERROR_ALLOCFAIL;
     }
@@ -450,153 +713,480 @@ cnxml_error cnxml_element_list_append(cnxml_element_list* list, cnxml_element el
   return CNXML_ERROR_OK;
 }
 
-cnxml_element* cnxml_element_list_get(cnxml_element_list* list, int index) {
+// makes room for at least capacity elements up front
+cnxml_error cnxml_element_list_reserve(cnxml_element_list* list, size_t capacity) {
+  if (capacity <= list->capacity) return CNXML_ERROR_OK;
+  if (list->ctx->read_only) return CNXML_ERROR_BADARGS;
+  void* new_ptr = cnxml_context_realloc(list->ctx, list->ptr, sizeof(cnxml_element) * capacity);
+  if (new_ptr == NULL) {
+    return CNXML_ERROR_ALLOCFAIL;
+  }
+  list->capacity = capacity;
+  list->ptr = new_ptr;
+  return CNXML_ERROR_OK;
+}
+
+cnxml_element* cnxml_element_list_get(cnxml_element_list* list, size_t index) {
   if (list == NULL) return NULL;
   if (index >= list->len) return NULL;
   return list->ptr + index;
 }
 
-int cnxml_element_list_length(cnxml_element_list* list) {
+size_t cnxml_element_list_length(cnxml_element_list* list) {
   if (list == NULL) return 0;
   return list->len;
 }
 
 void cnxml_element_list_free(cnxml_element_list* list) {
   if (list == NULL) return;
-  list->ctx->dealloc(list->ptr);
+  cnxml_context_dealloc(list->ctx, list->ptr);
+  cnxml_context_dealloc(list->ctx, list);
 }
 
 cnxml_element cnxml_element_new(cnxml_context* ctx, cnxml_string name) {
   cnxml_element elem;
   elem.ctx = ctx;
   elem.name = name;
-  elem.attributes = cnxml_hashmap_new(ctx);
+  elem.name_symbol = CNXML_SYMBOL_NONE;
+  elem.text_literal = false;
+  if (ctx != NULL && ctx->symbols != NULL && name.len > 0) {
+    elem.name_symbol = cnxml_intern(ctx->symbols, name);
+    if (elem.name_symbol != CNXML_SYMBOL_NONE) elem.name = cnxml_intern_name(ctx->symbols, elem.name_symbol);
+  }
+  elem.attributes = (cnxml_attribute_list){NULL, 0, 0, NULL};
   elem.children = NULL;
   elem.text_content = CNXML_STRING_EMPTY;
+  elem.text_spans = NULL;
   return elem;
 }
 
-void cnxml_element_add_text_content(cnxml_element* elem, cnxml_string str) {
-  if (elem->text_content.len == 0) {
-    elem->text_content = str;
-    return;
+static cnxml_attribute* INTERNAL_cnxml_element_find_attribute(cnxml_element* elem, cnxml_string name) {
+  cnxml_attribute_list* attrs = &elem->attributes;
+  if (attrs->index != NULL) {
+    cnxml_any found;
+    if (cnxml_hashmap_get(attrs->index, name, &found) != CNXML_MAP_OK) return NULL;
+    return (cnxml_attribute*)found;
   }
+  for (size_t i = 0; i < attrs->len; i++) {
+    if (cnxml_string_equal(attrs->ptr[i].name, name)) return attrs->ptr + i;
+  }
+  return NULL;
+}
 
-  elem->text_content = cnxml_string_concat3(elem->ctx, elem->text_content, cnxml_string_newlen(" ", 1), str);
+static cnxml_error INTERNAL_cnxml_element_index_attributes(cnxml_element* elem) {
+  cnxml_attribute_list* attrs = &elem->attributes;
+  if (attrs->index != NULL) cnxml_hashmap_free(attrs->index);
+  attrs->index = cnxml_hashmap_new(elem->ctx);
+  if (attrs->index == NULL) return CNXML_ERROR_ALLOCFAIL;
+  for (size_t i = 0; i < attrs->len; i++) {
+    if (cnxml_hashmap_put(attrs->index, attrs->ptr[i].name, attrs->ptr + i) != CNXML_MAP_OK) {
+      return CNXML_ERROR_ALLOCFAIL;
+    }
+  }
+  return CNXML_ERROR_OK;
 }
 
-typedef struct {
-  size_t attrs_len;
-  int* attr_index;
-  cnxml_element elem;
-  cnxml_any writer_ud;
-  cnxml_writer_func* writer;
-} INTERNAL_cnxml_element_write_attr_iter_userdata;
+static cnxml_attribute* INTERNAL_cnxml_element_find_attribute_symbol(cnxml_element* elem, cnxml_symbol symbol) {
+  cnxml_attribute_list* attrs = &elem->attributes;
+  if (attrs->index != NULL) {
+    return INTERNAL_cnxml_element_find_attribute(elem, cnxml_intern_name(elem->ctx->symbols, symbol));
+  }
+  for (size_t i = 0; i < attrs->len; i++) {
+    if (attrs->ptr[i].name_symbol == symbol) return attrs->ptr + i;
+  }
+  return NULL;
+}
 
-int INTERNAL_cnxml_element_write_attr_iter(cnxml_any a_userdata, cnxml_string key, cnxml_any a_value) {
-  INTERNAL_cnxml_element_write_attr_iter_userdata userdata = *((INTERNAL_cnxml_element_write_attr_iter_userdata*)a_userdata);
-  cnxml_string value = *((cnxml_string*)a_value);
+static cnxml_error INTERNAL_cnxml_element_put_attribute(cnxml_element* elem, cnxml_string name, cnxml_string value, bool literal) {
+  cnxml_attribute_list* attrs = &elem->attributes;
 
-  userdata.writer(userdata.writer_ud, key.ptr, key.len);
-  userdata.writer(userdata.writer_ud, "=\"", 2);
-  userdata.writer(userdata.writer_ud, value.ptr, value.len);
-  userdata.writer(userdata.writer_ud, "\"", 1);
+  cnxml_symbol symbol = CNXML_SYMBOL_NONE;
+  if (elem->ctx->symbols != NULL) {
+    symbol = cnxml_intern(elem->ctx->symbols, name);
+    if (symbol != CNXML_SYMBOL_NONE) name = cnxml_intern_name(elem->ctx->symbols, symbol);
+  }
 
-  if (*userdata.attr_index != userdata.attrs_len - 1) userdata.writer(userdata.writer_ud, " ", 1);
+  cnxml_attribute* existing;
+  if (symbol != CNXML_SYMBOL_NONE) {
+    existing = INTERNAL_cnxml_element_find_attribute_symbol(elem, symbol);
+  } else {
+    existing = INTERNAL_cnxml_element_find_attribute(elem, name);
+  }
+  if (existing != NULL) {
+    existing->value = value;
+    existing->literal = literal;
+    return CNXML_ERROR_OK;
+  }
+
+  bool moved = false;
+  if (attrs->len == attrs->capacity) {
+    size_t new_capacity = attrs->capacity == 0 ? CNXML_ATTRIBUTE_LIST_INITIAL_CAPACITY : attrs->capacity * 2;
+    void* new_ptr = cnxml_context_realloc(elem->ctx, attrs->ptr, sizeof(cnxml_attribute) * new_capacity);
+    if (new_ptr == NULL) return CNXML_ERROR_ALLOCFAIL;
+    moved = new_ptr != attrs->ptr;
+    attrs->ptr = new_ptr;
+    attrs->capacity = new_capacity;
+  }
+
+  attrs->ptr[attrs->len] = (cnxml_attribute){name, value, symbol, literal};
+  attrs->len += 1;
+
+  if (attrs->len > CNXML_ATTRIBUTE_INDEX_THRESHOLD) {
+    // the index points into ptr, so it has to be rebuilt if ptr moved
+    if (attrs->index == NULL || moved) return INTERNAL_cnxml_element_index_attributes(elem);
+    if (cnxml_hashmap_put(attrs->index, name, attrs->ptr + attrs->len - 1) != CNXML_MAP_OK) {
+      return CNXML_ERROR_ALLOCFAIL;
+    }
+  }
+  return CNXML_ERROR_OK;
+}
 
-  *userdata.attr_index += 1;
+// value is taken as literal text, see cnxml_attribute
+cnxml_error cnxml_element_set_attribute(cnxml_element* elem, cnxml_string name, cnxml_string value) {
+  if (elem->ctx->read_only) return CNXML_ERROR_BADARGS;
+  return INTERNAL_cnxml_element_put_attribute(elem, name, value, true);
+}
 
+int cnxml_element_get_attribute(cnxml_element* elem, cnxml_string name, cnxml_string* value_out) {
+  cnxml_attribute* attr = INTERNAL_cnxml_element_find_attribute(elem, name);
+  if (attr == NULL) {
+    if (value_out != NULL) *value_out = CNXML_STRING_EMPTY;
+    return CNXML_MAP_MISSING;
+  }
+  if (value_out != NULL) *value_out = attr->value;
   return CNXML_MAP_OK;
 }
 
-void INTERNAL_cnxml_writer_writeline(cnxml_writer_func writer, cnxml_any writer_userdata, int indent, cnxml_string indent_str) {
-  writer(writer_userdata, "\n", 1);
-  for (int i = 0; i < indent; i++) {
-    writer(writer_userdata, indent_str.ptr, indent_str.len);
+// an integer compare per attribute instead of a string compare. only
+// finds attributes set while the element's context had a symbol table
+int cnxml_element_get_attribute_symbol(cnxml_element* elem, cnxml_symbol name, cnxml_string* value_out) {
+  cnxml_attribute* attr = NULL;
+  if (name != CNXML_SYMBOL_NONE && elem->ctx->symbols != NULL) {
+    attr = INTERNAL_cnxml_element_find_attribute_symbol(elem, name);
+  }
+  if (attr == NULL) {
+    if (value_out != NULL) *value_out = CNXML_STRING_EMPTY;
+    return CNXML_MAP_MISSING;
   }
+  if (value_out != NULL) *value_out = attr->value;
+  return CNXML_MAP_OK;
+}
+
+size_t cnxml_element_attribute_count(cnxml_element* elem) {
+  return elem->attributes.len;
+}
+
+cnxml_attribute* cnxml_element_attribute_get(cnxml_element* elem, size_t index) {
+  if (index >= elem->attributes.len) return NULL;
+  return elem->attributes.ptr + index;
 }
 
-void INTERNAL_cnxml_element_write(cnxml_element elem, cnxml_writer_func writer, cnxml_any writer_userdata, int indent, cnxml_string indent_str) {
-  writer(writer_userdata, "<", 1);
-  writer(writer_userdata, elem.name.ptr, elem.name.len);
+int cnxml_element_iterate_attributes(cnxml_element* elem, cnxml_hashmap_iter_func f, cnxml_any item) {
+  if (elem->attributes.len == 0) return CNXML_MAP_MISSING;
+  for (size_t i = 0; i < elem->attributes.len; i++) {
+    cnxml_attribute* attr = elem->attributes.ptr + i;
+    int status = f(item, attr->name, &attr->value);
+    if (status != CNXML_MAP_OK) return status;
+  }
+  return CNXML_MAP_OK;
+}
 
-  size_t attrs_len = cnxml_hashmap_length(elem.attributes);
+static void INTERNAL_cnxml_element_add_text(cnxml_element* elem, cnxml_string str, bool literal) {
+  if (str.len == 0) return;
+  if (elem->text_content.len == 0) {
+    elem->text_content = str;
+    elem->text_literal = literal;
+    return;
+  }
 
-  if (attrs_len > 0) writer(writer_userdata, " ", 1);
+  cnxml_string_list* spans = elem->text_spans;
+  if (spans == NULL) {
+    spans = cnxml_context_alloc(elem->ctx, sizeof(cnxml_string_list));
+    if (spans == NULL) return;
+    spans->ptr = NULL;
+    spans->literal = NULL;
+    spans->len = 0;
+    spans->capacity = 0;
+    elem->text_spans = spans;
+  }
+  if (spans->len == spans->capacity) {
+    size_t new_capacity = spans->capacity == 0 ? CNXML_TEXT_SPANS_INITIAL_CAPACITY : spans->capacity * 2;
+    cnxml_string* new_ptr = cnxml_context_realloc(elem->ctx, spans->ptr, sizeof(cnxml_string) * new_capacity);
+    if (new_ptr == NULL) return;
+    spans->ptr = new_ptr;
+    if (spans->literal != NULL) {
+      bool* new_literal = cnxml_context_realloc(elem->ctx, spans->literal, sizeof(bool) * new_capacity);
+      if (new_literal == NULL) return;
+      spans->literal = new_literal;
+    }
+    spans->capacity = new_capacity;
+  }
+  // the flags are only allocated once a literal run shows up, parsed
+  // trees never need them
+  if (literal && spans->literal == NULL) {
+    spans->literal = cnxml_context_alloc(elem->ctx, sizeof(bool) * spans->capacity);
+    if (spans->literal == NULL) return;
+    memset(spans->literal, 0, sizeof(bool) * spans->capacity);
+  }
+  spans->ptr[spans->len] = str;
+  if (spans->literal != NULL) spans->literal[spans->len] = literal;
+  spans->len += 1;
+}
 
-  int attr_idx = 0;
-  INTERNAL_cnxml_element_write_attr_iter_userdata attr_iter_userdata = (INTERNAL_cnxml_element_write_attr_iter_userdata){
-    attrs_len,
-    &attr_idx,
-    elem,
-    writer_userdata,
-    writer
-  };
-  cnxml_hashmap_iterate(
-    elem.attributes,
-    INTERNAL_cnxml_element_write_attr_iter,
-    &attr_iter_userdata
-  );
+// str is literal text, written with every '&' escaped
+void cnxml_element_add_text_content(cnxml_element* elem, cnxml_string str) {
+  if (elem->ctx->read_only) return;
+  INTERNAL_cnxml_element_add_text(elem, str, true);
+}
 
-  size_t child_count = cnxml_element_list_length(elem.children);
+// str is text as it appears in a document, references and all, like
+// what the parser adds
+void cnxml_element_add_raw_text(cnxml_element* elem, cnxml_string str) {
+  if (elem->ctx->read_only) return;
+  INTERNAL_cnxml_element_add_text(elem, str, false);
+}
 
-  if (child_count == 0 && elem.text_content.len == 0) {
-    writer(writer_userdata, " />", 3);
-    return;
+// length of all text runs joined by single spaces
+size_t cnxml_element_text_length(cnxml_element* elem) {
+  size_t len = elem->text_content.len;
+  if (elem->text_spans != NULL) {
+    for (size_t i = 0; i < elem->text_spans->len; i++) {
+      len += 1 + elem->text_spans->ptr[i].len;
+    }
   }
+  return len;
+}
+
+// joins the text into buffer, truncating at buffer_len. returns the
+// full joined length like snprintf. no terminator is written
+size_t cnxml_element_text_copy(cnxml_element* elem, char* buffer, size_t buffer_len) {
+  size_t offs = 0;
+  size_t span_count = elem->text_spans == NULL ? 0 : (size_t)elem->text_spans->len;
+  for (size_t i = 0; i <= span_count; i++) {
+    cnxml_string span = i == 0 ? elem->text_content : elem->text_spans->ptr[i - 1];
+    if (i > 0) {
+      if (offs < buffer_len) buffer[offs] = ' ';
+      offs += 1;
+    }
+    if (offs < buffer_len) {
+      size_t n = span.len < buffer_len - offs ? span.len : buffer_len - offs;
+      memcpy(buffer + offs, span.ptr, n);
+    }
+    offs += span.len;
+  }
+  return offs;
+}
+
+// the whole text as one string. a single run is returned as is, several
+// runs are joined into a copy allocated from ctx (empty if that fails).
+// the element is left alone, so shared trees can be read from several
+// threads, each with a context of its own. pass the result to
+// cnxml_element_text_free when done
+cnxml_string cnxml_element_text(cnxml_context* ctx, cnxml_element* elem) {
+  if (elem->text_spans == NULL || elem->text_spans->len == 0) return elem->text_content;
+
+  size_t len = cnxml_element_text_length(elem);
+  char* buf = cnxml_context_alloc(ctx, len);
+  if (buf == NULL) return CNXML_STRING_EMPTY;
+  cnxml_element_text_copy(elem, buf, len);
+  return cnxml_string_newlen(buf, len);
+}
+
+void cnxml_element_text_free(cnxml_context* ctx, cnxml_element* elem, cnxml_string text) {
+  if (text.ptr != NULL && text.ptr != elem->text_content.ptr) cnxml_context_dealloc(ctx, text.ptr);
+}
+
+void INTERNAL_cnxml_element_write_attributes(cnxml_element* elem, cnxml_sink* sink) {
+  for (size_t i = 0; i < elem->attributes.len; i++) {
+    cnxml_attribute attr = elem->attributes.ptr[i];
+
+    cnxml_sink_write(sink, " ", 1);
+    cnxml_sink_write(sink, attr.name.ptr, attr.name.len);
+    cnxml_sink_write(sink, "=\"", 2);
+    int flags = CNXML_SINK_ESCAPE_ATTRIBUTE | (attr.literal ? CNXML_SINK_ESCAPE_ALL : 0);
+    cnxml_sink_write_escaped(sink, attr.value.ptr, attr.value.len, flags);
+    cnxml_sink_write(sink, "\"", 1);
+  }
+}
+
+void INTERNAL_cnxml_writer_writeline(cnxml_sink* sink, size_t indent, cnxml_string indent_str) {
+  cnxml_sink_write(sink, "\n", 1);
+  cnxml_sink_write_repeat(sink, indent_str.ptr, indent_str.len, indent);
+}
+
+// explicit stack for walking a tree without recursing. the first
+// CNXML_WALK_INLINE_DEPTH levels live in the struct itself, anything
+// deeper goes to the element's context
+typedef struct {
+  const cnxml_element* elem;
+  size_t next_child;
+} INTERNAL_cnxml_walk_frame;
+
+typedef struct {
+  cnxml_context* ctx;
+  INTERNAL_cnxml_walk_frame* frames;
+  size_t len;
+  size_t capacity;
+  INTERNAL_cnxml_walk_frame inline_frames[CNXML_WALK_INLINE_DEPTH];
+} INTERNAL_cnxml_walk_stack;
+
+static void INTERNAL_cnxml_walk_init(INTERNAL_cnxml_walk_stack* stack, cnxml_context* ctx) {
+  stack->ctx = ctx;
+  stack->frames = stack->inline_frames;
+  stack->len = 0;
+  stack->capacity = CNXML_WALK_INLINE_DEPTH;
+}
+
+static bool INTERNAL_cnxml_walk_push(INTERNAL_cnxml_walk_stack* stack, const cnxml_element* elem) {
+  if (stack->len == stack->capacity) {
+    size_t new_capacity = stack->capacity * 2;
+    INTERNAL_cnxml_walk_frame* new_frames;
+    if (stack->frames == stack->inline_frames) {
+      new_frames = cnxml_context_alloc(stack->ctx, sizeof(INTERNAL_cnxml_walk_frame) * new_capacity);
+      if (new_frames != NULL) memcpy(new_frames, stack->inline_frames, sizeof(stack->inline_frames));
+    } else {
+      new_frames = cnxml_context_realloc(stack->ctx, stack->frames, sizeof(INTERNAL_cnxml_walk_frame) * new_capacity);
+    }
+    if (new_frames == NULL) return false;
+    stack->frames = new_frames;
+    stack->capacity = new_capacity;
+  }
+  stack->frames[stack->len] = (INTERNAL_cnxml_walk_frame){elem, 0};
+  stack->len += 1;
+  return true;
+}
 
-  writer(writer_userdata, ">", 1);
+static void INTERNAL_cnxml_walk_release(INTERNAL_cnxml_walk_stack* stack) {
+  if (stack->frames != stack->inline_frames) cnxml_context_dealloc(stack->ctx, stack->frames);
+}
+
+// writes the start tag and text. returns false if the element was
+// written self-closing and has nothing left to do
+static bool INTERNAL_cnxml_element_write_open(const cnxml_element* elem, cnxml_sink* sink, size_t indent, cnxml_string indent_str) {
+  cnxml_sink_write(sink, "<", 1);
+  cnxml_sink_write(sink, elem->name.ptr, elem->name.len);
 
-  indent += 1;
-  INTERNAL_cnxml_writer_writeline(writer, writer_userdata, indent, indent_str);
+  INTERNAL_cnxml_element_write_attributes((cnxml_element*)elem, sink);
 
-  if (elem.text_content.len > 0) {
-    writer(writer_userdata, elem.text_content.ptr, elem.text_content.len);
+  if (cnxml_element_list_length(elem->children) == 0 && elem->text_content.len == 0) {
+    cnxml_sink_write(sink, " />", 3);
+    return false;
   }
 
+  cnxml_sink_write(sink, ">", 1);
+  INTERNAL_cnxml_writer_writeline(sink, indent + 1, indent_str);
+
+  if (elem->text_content.len > 0) {
+    int flags = elem->text_literal ? CNXML_SINK_ESCAPE_ALL : 0;
+    cnxml_sink_write_escaped(sink, elem->text_content.ptr, elem->text_content.len, flags);
+  }
+  if (elem->text_spans != NULL) {
+    for (size_t i = 0; i < elem->text_spans->len; i++) {
+      int flags = elem->text_spans->literal != NULL && elem->text_spans->literal[i] ? CNXML_SINK_ESCAPE_ALL : 0;
+      cnxml_sink_write(sink, " ", 1);
+      cnxml_sink_write_escaped(sink, elem->text_spans->ptr[i].ptr, elem->text_spans->ptr[i].len, flags);
+    }
+  }
+  return true;
+}
 
-  for (int i = 0; i < child_count; i++) {
-    cnxml_element child = *cnxml_element_list_get(elem.children, i);
-    INTERNAL_cnxml_element_write(child, writer, writer_userdata, indent, indent_str);
-    if (i != child_count - 1) {
-      INTERNAL_cnxml_writer_writeline(writer, writer_userdata, indent, indent_str);
+// the element at stack index i is indented by i
+void INTERNAL_cnxml_element_write(const cnxml_element* root, cnxml_sink* sink, cnxml_string indent_str) {
+  if (!INTERNAL_cnxml_element_write_open(root, sink, 0, indent_str)) return;
+
+  INTERNAL_cnxml_walk_stack stack;
+  INTERNAL_cnxml_walk_init(&stack, root->ctx);
+  INTERNAL_cnxml_walk_push(&stack, root);
+
+  while (stack.len > 0) {
+    INTERNAL_cnxml_walk_frame* frame = stack.frames + stack.len - 1;
+    const cnxml_element* elem = frame->elem;
+
+    if (frame->next_child < cnxml_element_list_length(elem->children)) {
+      if (frame->next_child > 0) INTERNAL_cnxml_writer_writeline(sink, stack.len, indent_str);
+      const cnxml_element* child = elem->children->ptr + frame->next_child;
+      frame->next_child += 1;
+      if (INTERNAL_cnxml_element_write_open(child, sink, stack.len, indent_str)) {
+        if (!INTERNAL_cnxml_walk_push(&stack, child)) {
+          sink->error = CNXML_ERROR_ALLOCFAIL;
+          break;
+        }
+      }
+      continue;
     }
+
+    stack.len -= 1;
+    INTERNAL_cnxml_writer_writeline(sink, stack.len, indent_str);
+    cnxml_sink_write(sink, "</", 2);
+    cnxml_sink_write(sink, elem->name.ptr, elem->name.len);
+    cnxml_sink_write(sink, ">", 1);
   }
 
-  indent -= 1;
-  INTERNAL_cnxml_writer_writeline(writer, writer_userdata, indent, indent_str);
+  INTERNAL_cnxml_walk_release(&stack);
+}
 
-  writer(writer_userdata, "</", 2);
-  writer(writer_userdata, elem.name.ptr, elem.name.len);
-  writer(writer_userdata, ">", 1);
+void cnxml_element_write_sink(cnxml_element elem, cnxml_sink* sink, cnxml_string indent_str) {
+  INTERNAL_cnxml_element_write(&elem, sink, indent_str);
 }
 
+// the writer callbacks are batched through a stack buffer, so they fire
+// once per CNXML_ELEMENT_WRITE_BUFFER_SIZE bytes rather than per fragment
 void cnxml_element_write_indent(cnxml_element elem, cnxml_writer_func writer, cnxml_any userdata, cnxml_string indent_str) {
-  INTERNAL_cnxml_element_write(elem, writer, userdata, 0, indent_str);
+  char buffer[CNXML_ELEMENT_WRITE_BUFFER_SIZE];
+  cnxml_sink sink;
+  cnxml_sink_init(&sink, writer, userdata, buffer, sizeof(buffer));
+  INTERNAL_cnxml_element_write(&elem, &sink, indent_str);
+  cnxml_sink_flush(&sink);
 }
 
 void cnxml_element_write(cnxml_element elem, cnxml_writer_func writer, cnxml_any userdata) {
-  INTERNAL_cnxml_element_write(elem, writer, userdata, 0, cnxml_string_newlen("\t", 1));
+  cnxml_element_write_indent(elem, writer, userdata, cnxml_string_newlen("\t", 1));
 }
 
+// children are freed before their parent, whose list they live in
 void cnxml_element_free(cnxml_element elem) {
-  for (size_t i = 0; i < cnxml_element_list_length(elem.children); i++) {
-    cnxml_element child = *cnxml_element_list_get(elem.children, i);
-    cnxml_element_free(child);
-  }
-  cnxml_element_free_alone(elem);
-}
+  // the whole tree goes away with the arena
+  if (cnxml_context_is_arena(elem.ctx)) return;
+#ifdef CNXML_ENABLE_STATS
+  double start = elem.ctx->stats != NULL ? cnxml_stats_now() : 0;
+#endif
+
+  INTERNAL_cnxml_walk_stack stack;
+  INTERNAL_cnxml_walk_init(&stack, elem.ctx);
+  INTERNAL_cnxml_walk_push(&stack, &elem);
+
+  while (stack.len > 0) {
+    INTERNAL_cnxml_walk_frame* frame = stack.frames + stack.len - 1;
+    const cnxml_element* current = frame->elem;
+
+    if (frame->next_child < cnxml_element_list_length(current->children)) {
+      const cnxml_element* child = current->children->ptr + frame->next_child;
+      frame->next_child += 1;
+      if (child->children == NULL) {
+        cnxml_element_free_alone(*child);
+      } else {
+        // if the stack can't grow the subtree is leaked
+        INTERNAL_cnxml_walk_push(&stack, child);
+      }
+      continue;
+    }
 
-int INTERNAL_cnxml_element_free_attr_iter(cnxml_any a_userdata, cnxml_string key, cnxml_any a_value) {
-  cnxml_context* ctx = (cnxml_context*)a_userdata;
-  cnxml_string* stored_value = (cnxml_string*)a_value;
+    stack.len -= 1;
+    cnxml_element_free_alone(*current);
+  }
 
-  ctx->dealloc(stored_value);
-  return CNXML_MAP_OK;
+  INTERNAL_cnxml_walk_release(&stack);
+  CNXML_STATS_RECORD(elem.ctx, stats->free_seconds += cnxml_stats_now() - start);
 }
 
 void cnxml_element_free_alone(cnxml_element elem) {
-  cnxml_hashmap_iterate(elem.attributes, INTERNAL_cnxml_element_free_attr_iter, elem.ctx);
-  cnxml_hashmap_free(elem.attributes);
+  if (cnxml_context_is_arena(elem.ctx)) return;
+  if (elem.attributes.index != NULL) cnxml_hashmap_free(elem.attributes.index);
+  if (elem.attributes.ptr != NULL) cnxml_context_dealloc(elem.ctx, elem.attributes.ptr);
+  if (elem.text_spans != NULL) {
+    cnxml_context_dealloc(elem.ctx, elem.text_spans->ptr);
+    if (elem.text_spans->literal != NULL) cnxml_context_dealloc(elem.ctx, elem.text_spans->literal);
+    cnxml_context_dealloc(elem.ctx, elem.text_spans);
+  }
   cnxml_element_list_free(elem.children);
-}
\ No newline at end of file
+}
@@ -4,6 +4,7 @@
 #include "cnxml_common.h"
 #include "cnxml_hashmap.h"
 #include "cnxml_string.h"
+#include "cnxml_sink.h"
 #ifndef CNXML_H
 #define CNXML_H
 
@@ -23,9 +24,9 @@ typedef struct {
   cnxml_context* ctx;
   const char* data;
   size_t data_len;
-  int current_index;
-  int current_line;
-  int current_column;
+  size_t current_index;
+  size_t* line_index;  // NULL UNTIL A POSITION IS ASKED FOR
+  size_t line_count;   // newline offsets in line_index
 } cnxml_tokenizer;
 
 typedef struct {
@@ -40,59 +41,111 @@ typedef enum {
   CNXML_PARSER_ERROR_MISSING_EQUALS_SIGN,
   CNXML_PARSER_ERROR_MISSING_ATTRIBUTE_VALUE,
   CNXML_PARSER_ERROR_MISSING_ELEMENT_NAME,
-  CNXML_PARSER_ERROR_TOO_MANY_ERRORS
+  CNXML_PARSER_ERROR_TOO_MANY_ERRORS,
+  CNXML_PARSER_ERROR_MAX_DEPTH_EXCEEDED
 } cnxml_parser_error_type;
 
+// the position is worked out when the error is reported, so errors stay
+// valid after their tokenizer is reset or freed
 typedef struct {
   cnxml_parser_error_type type;
   cnxml_string expected_name; // OPTIONAL
   cnxml_string actual_name;   // OPTIONAL
-  int line;
-  int column;
+  size_t offset;              // BYTE OFFSET INTO THE INPUT
+  size_t line;
+  size_t column;
   const char* message;
 } cnxml_parser_error;
 
-typedef struct {
-  cnxml_context* ctx;
-  cnxml_tokenizer* tokenizer;
-  cnxml_parser_error** error_buffer; // NULL IF NO ERRORS!
-  size_t error_count;               // 0 IF NO ERRORS
-} cnxml_parser;
-
 typedef struct _cnxml_element_list cnxml_element_list;
 
+// parsed values are kept as they appear in the input, references and
+// all. values set with cnxml_element_set_attribute are literal text, and
+// every '&' in them is escaped when written
+typedef struct {
+  cnxml_string name;
+  cnxml_string value;
+  cnxml_symbol name_symbol; // CNXML_SYMBOL_NONE IF NOT INTERNED
+  bool literal;             // SET THROUGH THE API, NOT PARSED
+} cnxml_attribute;
+
+// attributes are kept contiguously in source order; a hash index
+// is only built once an element has more than
+// CNXML_ATTRIBUTE_INDEX_THRESHOLD of them
+typedef struct {
+  cnxml_attribute* ptr;
+  size_t len;
+  size_t capacity;
+  cnxml_map index; // NULL IF NOT INDEXED
+} cnxml_attribute_list;
+
+typedef struct {
+  cnxml_string* ptr;
+  bool* literal; // PER ENTRY, NULL WHILE NONE IS LITERAL
+  size_t len;
+  size_t capacity;
+} cnxml_string_list;
+
+// text is kept as zero-copy runs from the source. text_content holds the
+// first run, text_spans any further runs. like attribute values, parsed
+// runs keep their references, and runs added with
+// cnxml_element_add_text_content are literal text whose every '&' is
+// escaped when written
 typedef struct {
   cnxml_context* ctx;
   cnxml_string name;
-  cnxml_map attributes;
+  cnxml_symbol name_symbol; // CNXML_SYMBOL_NONE IF NOT INTERNED
+  bool text_literal;        // text_content ADDED THROUGH THE API, NOT PARSED
+  cnxml_attribute_list attributes;
   cnxml_element_list* children;
   cnxml_string text_content;
+  cnxml_string_list* text_spans; // NULL IF AT MOST ONE RUN
 } cnxml_element;
 
+// open elements are tracked on an explicit stack instead of the C stack,
+// so nesting depth is only bounded by max_depth and memory
+typedef struct {
+  cnxml_context* ctx;
+  cnxml_tokenizer* tokenizer;
+  cnxml_parser_error** error_buffer; // NULL IF NO ERRORS!
+  size_t error_count;               // 0 IF NO ERRORS
+  cnxml_element** stack;            // KEPT BETWEEN PARSES
+  size_t stack_len;
+  size_t stack_capacity;
+  size_t max_depth;                 // 0 FOR NO LIMIT
+} cnxml_parser;
+
 struct _cnxml_element_list {
   cnxml_context* ctx;
   cnxml_element* ptr;
-  int len;
-  int capacity;
+  size_t len;
+  size_t capacity;
 };
 
-typedef void cnxml_writer_func(cnxml_any userdata, const char* buffer, size_t length);
-
-#define CNXML_ELEMENT_LIST_GROW_AMOUNT 16
+#define CNXML_ELEMENT_LIST_INITIAL_CAPACITY 16
+#define CNXML_ATTRIBUTE_LIST_INITIAL_CAPACITY 4
+#define CNXML_TEXT_SPANS_INITIAL_CAPACITY 4
+#define CNXML_ATTRIBUTE_INDEX_THRESHOLD 16
 #define CNXML_PARSER_ERROR_BUFFER_SIZE 16
+#define CNXML_ELEMENT_WRITE_BUFFER_SIZE 8192
+#define CNXML_PARSER_STACK_INITIAL_CAPACITY 32
+#define CNXML_PARSER_DEFAULT_MAX_DEPTH 0
+#define CNXML_WALK_INLINE_DEPTH 64
 
 /*** TOKENIZER API ***/
 CNXML_EXPORT cnxml_tokenizer* CNXML_API cnxml_tokenizer_new(cnxml_context* ctx, const char* data, size_t data_len);
+CNXML_EXPORT void CNXML_API cnxml_tokenizer_reset(cnxml_tokenizer* tokenizer, const char* data, size_t data_len);
 static CNXML_EXPORT bool CNXML_API cnxml_tokenizer_is_whitespace(char c);
-static CNXML_EXPORT bool CNXML_API cnxml_tokenizer_is_punctuation_or_whitespace(char c);
 CNXML_EXPORT bool CNXML_API cnxml_tokenizer_is_eof(cnxml_tokenizer* tokenizer);
 CNXML_EXPORT char CNXML_API cnxml_tokenizer_cur_char(cnxml_tokenizer* tokenizer);
-CNXML_EXPORT char CNXML_API cnxml_tokenizer_peek(cnxml_tokenizer* tokenizer, int chars);
-CNXML_EXPORT void CNXML_API cnxml_tokenizer_move(cnxml_tokenizer* tokenizer, int chars);
+CNXML_EXPORT char CNXML_API cnxml_tokenizer_peek(cnxml_tokenizer* tokenizer, size_t chars);
+CNXML_EXPORT void CNXML_API cnxml_tokenizer_move(cnxml_tokenizer* tokenizer, size_t chars);
 CNXML_EXPORT bool CNXML_API cnxml_tokenizer_match_string(cnxml_tokenizer* tokenizer, cnxml_string str);
 CNXML_EXPORT void CNXML_API cnxml_tokenizer_skip_whitespace(cnxml_tokenizer* tokenizer);
 CNXML_EXPORT cnxml_string CNXML_API cnxml_tokenizer_read_quoted_string(cnxml_tokenizer* tokenizer);
 CNXML_EXPORT cnxml_string CNXML_API cnxml_tokenizer_read_unquoted_string(cnxml_tokenizer* tokenizer);
+CNXML_EXPORT cnxml_string CNXML_API cnxml_tokenizer_read_text(cnxml_tokenizer* tokenizer);
+CNXML_EXPORT void CNXML_API cnxml_tokenizer_position(cnxml_tokenizer* tokenizer, size_t offset, size_t* line_out, size_t* column_out);
 CNXML_EXPORT cnxml_token CNXML_API cnxml_tokenizer_next_token(cnxml_tokenizer* tokenizer);
 CNXML_EXPORT const char* CNXML_API cnxml_tokenizer_token_type_name(cnxml_token_type type);
 CNXML_EXPORT void CNXML_API cnxml_tokenizer_print_token(FILE* f, cnxml_token tok);
@@ -103,20 +156,37 @@ CNXML_EXPORT cnxml_parser* CNXML_API cnxml_parser_new(cnxml_context* ctx, cnxml_
 CNXML_EXPORT bool CNXML_API cnxml_parser_has_errors(cnxml_parser* parser);
 CNXML_EXPORT const char* CNXML_API cnxml_parser_error_message(cnxml_context* ctx, cnxml_parser_error* err);
 CNXML_EXPORT void CNXML_API cnxml_parser_report_error(cnxml_parser* parser, cnxml_parser_error_type type, cnxml_string actual_name, cnxml_string expected_name);
+CNXML_EXPORT void CNXML_API cnxml_parser_error_position(cnxml_parser_error* error, size_t* line_out, size_t* column_out);
 CNXML_EXPORT void CNXML_API cnxml_parser_error_print(FILE* f, cnxml_parser_error* error);
 CNXML_EXPORT cnxml_element CNXML_API cnxml_parser_read_element(cnxml_parser* parser);
+CNXML_EXPORT void CNXML_API cnxml_parser_read_content(cnxml_parser* parser, cnxml_element* parent);
+CNXML_EXPORT cnxml_element_list* CNXML_API cnxml_parser_read_document(cnxml_parser* parser);
+CNXML_EXPORT void CNXML_API cnxml_parser_set_max_depth(cnxml_parser* parser, size_t max_depth);
 CNXML_EXPORT void CNXML_API cnxml_parser_read_attribute(cnxml_parser* parser, cnxml_element* target, cnxml_string name);
 CNXML_EXPORT void CNXML_API cnxml_parser_free(cnxml_parser* parser);
 
 /*** MISCELLANEOUS ***/
 CNXML_EXPORT cnxml_element_list* CNXML_API cnxml_element_list_new(cnxml_context* ctx);
 CNXML_EXPORT cnxml_error CNXML_API cnxml_element_list_append(cnxml_element_list* list, cnxml_element elem);
-CNXML_EXPORT cnxml_element* CNXML_API cnxml_element_list_get(cnxml_element_list* list, int index);
-CNXML_EXPORT int CNXML_API cnxml_element_list_length(cnxml_element_list* list);
+CNXML_EXPORT cnxml_error CNXML_API cnxml_element_list_reserve(cnxml_element_list* list, size_t capacity);
+CNXML_EXPORT cnxml_element* CNXML_API cnxml_element_list_get(cnxml_element_list* list, size_t index);
+CNXML_EXPORT size_t CNXML_API cnxml_element_list_length(cnxml_element_list* list);
 CNXML_EXPORT void CNXML_API cnxml_element_list_free(cnxml_element_list* list);
 CNXML_EXPORT cnxml_element CNXML_API cnxml_element_new(cnxml_context* ctx, cnxml_string name);
+CNXML_EXPORT cnxml_error CNXML_API cnxml_element_set_attribute(cnxml_element* elem, cnxml_string name, cnxml_string value);
+CNXML_EXPORT int CNXML_API cnxml_element_get_attribute(cnxml_element* elem, cnxml_string name, cnxml_string* value_out);
+CNXML_EXPORT int CNXML_API cnxml_element_get_attribute_symbol(cnxml_element* elem, cnxml_symbol name, cnxml_string* value_out);
+CNXML_EXPORT size_t CNXML_API cnxml_element_attribute_count(cnxml_element* elem);
+CNXML_EXPORT cnxml_attribute* CNXML_API cnxml_element_attribute_get(cnxml_element* elem, size_t index);
+CNXML_EXPORT int CNXML_API cnxml_element_iterate_attributes(cnxml_element* elem, cnxml_hashmap_iter_func f, cnxml_any item);
 CNXML_EXPORT void CNXML_API cnxml_element_add_text_content(cnxml_element* elem, cnxml_string str);
+CNXML_EXPORT void CNXML_API cnxml_element_add_raw_text(cnxml_element* elem, cnxml_string str);
+CNXML_EXPORT size_t CNXML_API cnxml_element_text_length(cnxml_element* elem);
+CNXML_EXPORT size_t CNXML_API cnxml_element_text_copy(cnxml_element* elem, char* buffer, size_t buffer_len);
+CNXML_EXPORT cnxml_string CNXML_API cnxml_element_text(cnxml_context* ctx, cnxml_element* elem);
+CNXML_EXPORT void CNXML_API cnxml_element_text_free(cnxml_context* ctx, cnxml_element* elem, cnxml_string text);
 CNXML_EXPORT void CNXML_API cnxml_element_write(cnxml_element elem, cnxml_writer_func writer, cnxml_any userdata);
+CNXML_EXPORT void CNXML_API cnxml_element_write_sink(cnxml_element elem, cnxml_sink* sink, cnxml_string indent_str);
 CNXML_EXPORT void CNXML_API cnxml_element_write_indent(cnxml_element elem, cnxml_writer_func writer, cnxml_any userdata, cnxml_string indent_str);
 CNXML_EXPORT void CNXML_API cnxml_element_free(cnxml_element elem);
 CNXML_EXPORT void CNXML_API cnxml_element_free_alone(cnxml_element elem);
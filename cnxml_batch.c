@@ -0,0 +1,205 @@
+#include "cnxml_batch.h"
+#include "cnxml_thread.h"
+#include "cnxml_scan.h"
+
+/*** BATCH ***/
+
+// each worker owns a range of input indices, packed as next | end << 32
+// so that taking from the front and stealing from the back are both a
+// single compare-and-swap
+typedef struct _INTERNAL_cnxml_batch_worker {
+  volatile uint64_t range;
+  char padding[64 - sizeof(uint64_t)]; // keep ranges on separate cache lines
+  const cnxml_batch_input* inputs;
+  cnxml_batch_result* results;
+  struct _INTERNAL_cnxml_batch_worker* workers;
+  int worker_count;
+  int index;
+  cnxml_context* ctx;
+  cnxml_thread thread;
+} INTERNAL_cnxml_batch_worker;
+
+#define INTERNAL_CNXML_BATCH_RANGE(next, end) ((uint64_t)(next) | ((uint64_t)(end) << 32))
+#define INTERNAL_CNXML_BATCH_NEXT(range) ((uint32_t)(range))
+#define INTERNAL_CNXML_BATCH_END(range) ((uint32_t)((range) >> 32))
+
+static bool INTERNAL_cnxml_batch_take(INTERNAL_cnxml_batch_worker* worker, size_t* index_out) {
+  while (true) {
+    uint64_t range = cnxml_atomic_load_u64(&worker->range);
+    uint32_t next = INTERNAL_CNXML_BATCH_NEXT(range);
+    uint32_t end = INTERNAL_CNXML_BATCH_END(range);
+    if (next >= end) return false;
+    if (cnxml_atomic_cas_u64(&worker->range, range, INTERNAL_CNXML_BATCH_RANGE(next + 1, end))) {
+      *index_out = next;
+      return true;
+    }
+  }
+}
+
+// moves the back half of a victim's range over to the thief. the thief's
+// own range is empty at this point, so nobody else is writing to it
+static bool INTERNAL_cnxml_batch_steal(INTERNAL_cnxml_batch_worker* thief, INTERNAL_cnxml_batch_worker* victim) {
+  while (true) {
+    uint64_t range = cnxml_atomic_load_u64(&victim->range);
+    uint32_t next = INTERNAL_CNXML_BATCH_NEXT(range);
+    uint32_t end = INTERNAL_CNXML_BATCH_END(range);
+    if (next >= end) return false;
+    uint32_t split = end - (end - next + 1) / 2;
+    if (cnxml_atomic_cas_u64(&victim->range, range, INTERNAL_CNXML_BATCH_RANGE(next, split))) {
+      cnxml_atomic_store_u64(&thief->range, INTERNAL_CNXML_BATCH_RANGE(split, end));
+      return true;
+    }
+  }
+}
+
+static void INTERNAL_cnxml_batch_parse_one(INTERNAL_cnxml_batch_worker* worker, cnxml_tokenizer* tokenizer, cnxml_parser* parser, size_t index) {
+  const cnxml_batch_input* input = worker->inputs + index;
+  cnxml_batch_result* result = worker->results + index;
+  const char* data = input->data;
+  size_t data_len = input->data_len;
+
+  if (input->path != NULL) {
+    cnxml_source* source = cnxml_source_open(worker->ctx, input->path);
+    if (CNXML_IS_ERROR(source)) {
+      result->status = (cnxml_error)(size_t)source;
+      return;
+    }
+    result->source = source;
+    data = source->data;
+    data_len = source->data_len;
+  }
+
+  cnxml_tokenizer_reset(tokenizer, data, data_len);
+  result->root = cnxml_parser_read_element(parser);
+  if (parser->error_count == 0) return;
+
+  // the errors stay with the result, the parser moves on to other inputs
+  result->errors = parser->error_buffer;
+  result->error_count = parser->error_count;
+  parser->error_buffer = NULL;
+  parser->error_count = 0;
+}
+
+static void INTERNAL_cnxml_batch_worker_main(cnxml_any arg) {
+  INTERNAL_cnxml_batch_worker* worker = arg;
+  INTERNAL_cnxml_batch_worker* workers = worker->workers;
+
+  cnxml_tokenizer* tokenizer = cnxml_tokenizer_new(worker->ctx, "", 0);
+  if (CNXML_IS_ERROR(tokenizer)) return;
+  cnxml_parser* parser = cnxml_parser_new(worker->ctx, tokenizer);
+  if (CNXML_IS_ERROR(parser)) return;
+
+  while (true) {
+    size_t index;
+    if (INTERNAL_cnxml_batch_take(worker, &index)) {
+      INTERNAL_cnxml_batch_parse_one(worker, tokenizer, parser, index);
+      continue;
+    }
+
+    bool stolen = false;
+    for (int i = 1; i < worker->worker_count && !stolen; i++) {
+      INTERNAL_cnxml_batch_worker* victim = workers + (worker->index + i) % worker->worker_count;
+      stolen = INTERNAL_cnxml_batch_steal(worker, victim);
+    }
+    if (!stolen) break;
+  }
+
+  cnxml_parser_free(parser);
+  cnxml_tokenizer_free(tokenizer);
+}
+
+// thread_count 0 uses one thread per cpu. the calling thread works too
+cnxml_batch* cnxml_batch_parse(cnxml_context* ctx, const cnxml_batch_input* inputs, size_t count, int thread_count) {
+  if (ctx == NULL || (inputs == NULL && count > 0) || count > UINT32_MAX) {
+    return (cnxml_batch*)CNXML_ERROR_BADARGS;
+  }
+  if (thread_count <= 0) thread_count = cnxml_thread_cpu_count();
+  if ((size_t)thread_count > count) thread_count = count == 0 ? 1 : (int)count;
+
+  cnxml_batch* batch = cnxml_context_alloc(ctx, sizeof(cnxml_batch));
+  if (batch == NULL) {
+    return (cnxml_batch*)CNXML_ERROR_ALLOCFAIL;
+  }
+  batch->ctx = ctx;
+  batch->count = 0;
+  batch->worker_count = 0;
+  batch->results = cnxml_context_alloc(ctx, sizeof(cnxml_batch_result) * (count == 0 ? 1 : count));
+  batch->worker_contexts = cnxml_context_alloc(ctx, sizeof(cnxml_context*) * thread_count);
+  INTERNAL_cnxml_batch_worker* workers = cnxml_context_alloc(ctx, sizeof(INTERNAL_cnxml_batch_worker) * thread_count);
+  if (batch->results == NULL || batch->worker_contexts == NULL || workers == NULL) {
+    cnxml_batch_free(batch);
+    if (workers != NULL) cnxml_context_dealloc(ctx, workers);
+    return (cnxml_batch*)CNXML_ERROR_ALLOCFAIL;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    cnxml_batch_result* result = batch->results + i;
+    result->status = CNXML_ERROR_OK;
+    result->root = cnxml_element_new(ctx, CNXML_STRING_EMPTY);
+    result->errors = NULL;
+    result->error_count = 0;
+    result->source = NULL;
+  }
+  batch->count = count;
+
+  for (int i = 0; i < thread_count; i++) {
+    cnxml_context* worker_ctx = cnxml_context_new_arena(ctx->alloc, ctx->realloc, ctx->dealloc, 0);
+    if (CNXML_IS_ERROR(worker_ctx)) {
+      cnxml_context_dealloc(ctx, workers);
+      cnxml_batch_free(batch);
+      return (cnxml_batch*)worker_ctx;
+    }
+    cnxml_context_set_symbols(worker_ctx, ctx->symbols);
+    batch->worker_contexts[i] = worker_ctx;
+    batch->worker_count += 1;
+
+    INTERNAL_cnxml_batch_worker* worker = workers + i;
+    worker->range = INTERNAL_CNXML_BATCH_RANGE(count * i / thread_count, count * (i + 1) / thread_count);
+    worker->inputs = inputs;
+    worker->results = batch->results;
+    worker->workers = workers;
+    worker->worker_count = thread_count;
+    worker->index = i;
+    worker->ctx = worker_ctx;
+  }
+
+  // pick the scanner before the workers race to do it
+  cnxml_scan_get_impl();
+
+  // if a thread can't be started its inputs get stolen by the others
+  bool* started = cnxml_context_alloc(ctx, sizeof(bool) * thread_count);
+  for (int i = 1; i < thread_count && started != NULL; i++) {
+    started[i] = cnxml_thread_start(&workers[i].thread, INTERNAL_cnxml_batch_worker_main, workers + i) == CNXML_ERROR_OK;
+  }
+  INTERNAL_cnxml_batch_worker_main(workers);
+  for (int i = 1; i < thread_count && started != NULL; i++) {
+    if (started[i]) cnxml_thread_join(&workers[i].thread);
+  }
+
+  if (started != NULL) cnxml_context_dealloc(ctx, started);
+  cnxml_context_dealloc(ctx, workers);
+  return batch;
+}
+
+cnxml_batch_result* cnxml_batch_get(cnxml_batch* batch, size_t index) {
+  if (index >= batch->count) return NULL;
+  return batch->results + index;
+}
+
+// everything parsed lives in the worker arenas, so only the sources and
+// the arenas themselves need freeing
+void cnxml_batch_free(cnxml_batch* batch) {
+  if (batch->results != NULL) {
+    for (size_t i = 0; i < batch->count; i++) {
+      if (batch->results[i].source != NULL) cnxml_source_free(batch->results[i].source);
+    }
+    cnxml_context_dealloc(batch->ctx, batch->results);
+  }
+  if (batch->worker_contexts != NULL) {
+    for (int i = 0; i < batch->worker_count; i++) {
+      cnxml_context_free(batch->worker_contexts[i]);
+    }
+    cnxml_context_dealloc(batch->ctx, batch->worker_contexts);
+  }
+  cnxml_context_dealloc(batch->ctx, batch);
+}
@@ -0,0 +1,42 @@
+#ifndef CNXML_BATCH
+#define CNXML_BATCH
+
+#include "cnxml.h"
+#include "cnxml_source.h"
+
+// parses many small documents at once
+//
+// inputs are spread over a pool of worker threads, each with its own
+// arena context, tokenizer and parser. a worker that runs out of inputs
+// steals half of what another one has left. results come back in input
+// order and live in the worker arenas until cnxml_batch_free, so the
+// context's allocation functions have to be thread-safe.
+
+typedef struct {
+  const char* path; // NULL FOR IN-MEMORY INPUTS
+  const char* data; // ONLY USED IF path IS NULL
+  size_t data_len;
+} cnxml_batch_input;
+
+typedef struct {
+  cnxml_error status;           // CNXML_ERROR_IO IF THE FILE COULDN'T BE READ
+  cnxml_element root;
+  cnxml_parser_error** errors;  // NULL IF NO ERRORS
+  size_t error_count;
+  cnxml_source* source;         // NULL FOR IN-MEMORY INPUTS
+} cnxml_batch_result;
+
+typedef struct {
+  cnxml_context* ctx;
+  cnxml_batch_result* results;  // IN INPUT ORDER
+  size_t count;
+  cnxml_context** worker_contexts;
+  int worker_count;
+} cnxml_batch;
+
+/*** BATCH API ***/
+CNXML_EXPORT cnxml_batch* CNXML_API cnxml_batch_parse(cnxml_context* ctx, const cnxml_batch_input* inputs, size_t count, int thread_count);
+CNXML_EXPORT cnxml_batch_result* CNXML_API cnxml_batch_get(cnxml_batch* batch, size_t index);
+CNXML_EXPORT void CNXML_API cnxml_batch_free(cnxml_batch* batch);
+
+#endif//CNXML_BATCH
@@ -0,0 +1,347 @@
+#include "cnxml_cache.h"
+#include "cnxml_hash.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <direct.h>
+  #include <process.h>
+  #include <sys/stat.h>
+#else
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+// file names and keys are written to disk, so they're hashed with the
+// same function on every machine
+#define INTERNAL_CNXML_CACHE_HASH(data, len, seed) cnxml_hash_bytes_with(CNXML_HASH_IMPL_PORTABLE, data, len, seed)
+
+// what's kept in a saved tree's header tag
+enum {
+  INTERNAL_CNXML_CACHE_TAG_PATH,
+  INTERNAL_CNXML_CACHE_TAG_SIZE,
+  INTERNAL_CNXML_CACHE_TAG_MTIME,
+  INTERNAL_CNXML_CACHE_TAG_CONTENT
+};
+
+/*** KEYS ***/
+
+static uint64_t INTERNAL_cnxml_cache_hash64(const char* data, size_t len) {
+  return ((uint64_t)INTERNAL_CNXML_CACHE_HASH(data, len, 0x9e3779b9u) << 32) | INTERNAL_CNXML_CACHE_HASH(data, len, 0x85ebca6bu);
+}
+
+static bool INTERNAL_cnxml_cache_stat(const char* path, uint64_t* size_out, uint64_t* mtime_out) {
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_stat64(path, &st) != 0) return false;
+  *mtime_out = (uint64_t)st.st_mtime * 1000000000u;
+#else
+  struct stat st;
+  if (stat(path, &st) != 0) return false;
+  #ifdef __APPLE__
+    *mtime_out = (uint64_t)st.st_mtimespec.tv_sec * 1000000000u + (uint64_t)st.st_mtimespec.tv_nsec;
+  #else
+    *mtime_out = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+  #endif
+#endif
+  *size_out = (uint64_t)st.st_size;
+  return true;
+}
+
+// <directory>/<hash of path><suffix>, allocated through the cache
+static char* INTERNAL_cnxml_cache_file_name(cnxml_cache* cache, const char* path) {
+  size_t dir_len = strlen(cache->directory);
+  size_t len = dir_len + 1 + 16 + sizeof(CNXML_CACHE_FILE_SUFFIX);
+  char* name = cnxml_context_alloc(cache->ctx, len);
+  if (name == NULL) return NULL;
+  unsigned long long hash = (unsigned long long)INTERNAL_cnxml_cache_hash64(path, strlen(path));
+  snprintf(name, len, "%s/%016llx%s", cache->directory, hash, CNXML_CACHE_FILE_SUFFIX);
+  return name;
+}
+
+/*** DISK ***/
+
+static uint64_t INTERNAL_cnxml_cache_content_hash(cnxml_source* source) {
+  return INTERNAL_cnxml_cache_hash64(source->data, source->data_len);
+}
+
+// only the mtime in the header changes, the rest of the blob stays
+static void INTERNAL_cnxml_cache_update_mtime(const char* file_name, uint64_t mtime) {
+  FILE* f = fopen(file_name, "r+b");
+  if (f == NULL) return;
+  long offset = (long)(offsetof(cnxml_binary_header, tag) + sizeof(uint64_t) * INTERNAL_CNXML_CACHE_TAG_MTIME);
+  if (fseek(f, offset, SEEK_SET) == 0) fwrite(&mtime, sizeof(mtime), 1, f);
+  fclose(f);
+}
+
+// the tree saved for path, if there is one and it still matches the
+// file. NULL otherwise
+static cnxml_document* INTERNAL_cnxml_cache_load_saved(cnxml_cache* cache, const char* path, const char* file_name,
+  uint64_t size, uint64_t mtime, uint64_t* content_hash_out) {
+  cnxml_document* doc = cnxml_document_load_binary(cache->ctx, file_name);
+  if (CNXML_IS_ERROR(doc)) return NULL;
+
+  const cnxml_binary_header* header = (const cnxml_binary_header*)doc->source->data;
+  if (header->tag[INTERNAL_CNXML_CACHE_TAG_PATH] == INTERNAL_cnxml_cache_hash64(path, strlen(path))
+    && header->tag[INTERNAL_CNXML_CACHE_TAG_SIZE] == size) {
+    if (header->tag[INTERNAL_CNXML_CACHE_TAG_MTIME] == mtime) {
+      *content_hash_out = header->tag[INTERNAL_CNXML_CACHE_TAG_CONTENT];
+      return doc;
+    }
+
+    // touched, maybe not changed
+    cnxml_source* source = cnxml_source_open(cache->ctx, path);
+    if (!CNXML_IS_ERROR(source)) {
+      uint64_t content_hash = INTERNAL_cnxml_cache_content_hash(source);
+      cnxml_source_free(source);
+      if (content_hash == header->tag[INTERNAL_CNXML_CACHE_TAG_CONTENT]) {
+        INTERNAL_cnxml_cache_update_mtime(file_name, mtime);
+        *content_hash_out = content_hash;
+        return doc;
+      }
+    }
+  }
+  cnxml_document_free(doc);
+  return NULL;
+}
+
+// written next to the final name and renamed over it, so a reader
+// never sees half a file
+static bool INTERNAL_cnxml_cache_save(cnxml_cache* cache, cnxml_document* doc, const char* file_name, const uint64_t* tag) {
+  size_t len = strlen(file_name) + 32;
+  char* tmp_name = cnxml_context_alloc(cache->ctx, len);
+  if (tmp_name == NULL) return false;
+#ifdef _WIN32
+  snprintf(tmp_name, len, "%s.%d.tmp", file_name, (int)_getpid());
+#else
+  snprintf(tmp_name, len, "%s.%d.tmp", file_name, (int)getpid());
+#endif
+
+  bool ok = cnxml_document_save_binary_tagged(doc, tmp_name, tag) == CNXML_ERROR_OK;
+  if (ok) {
+#ifdef _WIN32
+    remove(file_name);
+#endif
+    ok = rename(tmp_name, file_name) == 0;
+  }
+  if (!ok) remove(tmp_name);
+  cnxml_context_dealloc(cache->ctx, tmp_name);
+  return ok;
+}
+
+/*** ENTRIES ***/
+
+static size_t INTERNAL_cnxml_cache_document_bytes(cnxml_document* doc) {
+  size_t bytes = sizeof(cnxml_document);
+  if (doc->source != NULL) bytes += doc->source->data_len;
+  for (int i = 0; i < doc->context_count; i++) {
+    bytes += cnxml_context_arena_size(doc->contexts[i]);
+  }
+  return bytes;
+}
+
+static void INTERNAL_cnxml_cache_unlink(cnxml_cache* cache, cnxml_cache_entry* entry) {
+  if (entry->prev != NULL) entry->prev->next = entry->next;
+  else cache->lru_head = entry->next;
+  if (entry->next != NULL) entry->next->prev = entry->prev;
+  else cache->lru_tail = entry->prev;
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+static void INTERNAL_cnxml_cache_push_front(cnxml_cache* cache, cnxml_cache_entry* entry) {
+  entry->prev = NULL;
+  entry->next = cache->lru_head;
+  if (cache->lru_head != NULL) cache->lru_head->prev = entry;
+  cache->lru_head = entry;
+  if (cache->lru_tail == NULL) cache->lru_tail = entry;
+}
+
+static void INTERNAL_cnxml_cache_entry_free(cnxml_cache* cache, cnxml_cache_entry* entry) {
+  cnxml_document_free(entry->doc);
+  cnxml_context_dealloc(cache->ctx, entry->path);
+  cnxml_context_dealloc(cache->ctx, entry);
+}
+
+// takes entry out of the cache. an acquired entry lives on until its
+// last release
+static void INTERNAL_cnxml_cache_drop(cnxml_cache* cache, cnxml_cache_entry* entry) {
+  cnxml_hashmap_remove(cache->entries, cnxml_string_new(entry->path));
+  INTERNAL_cnxml_cache_unlink(cache, entry);
+  cache->memory_used -= entry->bytes;
+  if (entry->refs > 0) {
+    entry->stale = true;
+    return;
+  }
+  INTERNAL_cnxml_cache_entry_free(cache, entry);
+}
+
+static void INTERNAL_cnxml_cache_evict(cnxml_cache* cache) {
+  cnxml_cache_entry* entry = cache->lru_tail;
+  while (cache->memory_limit != 0 && cache->memory_used > cache->memory_limit && entry != NULL) {
+    cnxml_cache_entry* prev = entry->prev;
+    if (entry->refs == 0) {
+      INTERNAL_cnxml_cache_drop(cache, entry);
+      cache->counters.evictions += 1;
+    }
+    entry = prev;
+  }
+}
+
+/*** CACHE ***/
+
+cnxml_cache* cnxml_cache_new(cnxml_context* ctx, const char* directory, size_t memory_limit) {
+  if (ctx == NULL) {
+    return (cnxml_cache*)CNXML_ERROR_BADARGS;
+  }
+  cnxml_cache* cache = cnxml_context_alloc(ctx, sizeof(cnxml_cache));
+  if (cache == NULL) {
+    return (cnxml_cache*)CNXML_ERROR_ALLOCFAIL;
+  }
+  memset(cache, 0, sizeof(cnxml_cache));
+  cache->ctx = ctx;
+  cache->memory_limit = memory_limit;
+  cache->entries = cnxml_hashmap_new(ctx);
+  if (cache->entries == NULL) {
+    cnxml_cache_free(cache);
+    return (cnxml_cache*)CNXML_ERROR_ALLOCFAIL;
+  }
+
+  if (directory != NULL) {
+    size_t len = strlen(directory);
+    cache->directory = cnxml_context_alloc(ctx, len + 1);
+    if (cache->directory == NULL) {
+      cnxml_cache_free(cache);
+      return (cnxml_cache*)CNXML_ERROR_ALLOCFAIL;
+    }
+    memcpy(cache->directory, directory, len + 1);
+    // an existing directory is fine, anything else shows up as failed saves
+#ifdef _WIN32
+    _mkdir(directory);
+#else
+    mkdir(directory, 0777);
+#endif
+  }
+  return cache;
+}
+
+cnxml_cache_entry* cnxml_cache_acquire(cnxml_cache* cache, const char* path) {
+  if (cache == NULL || path == NULL) {
+    return (cnxml_cache_entry*)CNXML_ERROR_BADARGS;
+  }
+  uint64_t size, mtime;
+  if (!INTERNAL_cnxml_cache_stat(path, &size, &mtime)) {
+    return (cnxml_cache_entry*)CNXML_ERROR_IO;
+  }
+
+  cnxml_any found;
+  if (cnxml_hashmap_get(cache->entries, cnxml_string_new(path), &found) == CNXML_MAP_OK) {
+    cnxml_cache_entry* entry = found;
+    if (entry->size == size && entry->mtime == mtime) {
+      cache->counters.hits += 1;
+      INTERNAL_cnxml_cache_unlink(cache, entry);
+      INTERNAL_cnxml_cache_push_front(cache, entry);
+      entry->refs += 1;
+      return entry;
+    }
+    cache->counters.stale += 1;
+    INTERNAL_cnxml_cache_drop(cache, entry);
+  }
+
+  size_t path_len = strlen(path);
+  cnxml_cache_entry* entry = cnxml_context_alloc(cache->ctx, sizeof(cnxml_cache_entry));
+  char* path_copy = cnxml_context_alloc(cache->ctx, path_len + 1);
+  char* file_name = cache->directory != NULL ? INTERNAL_cnxml_cache_file_name(cache, path) : NULL;
+  if (entry == NULL || path_copy == NULL || (cache->directory != NULL && file_name == NULL)) {
+    if (entry != NULL) cnxml_context_dealloc(cache->ctx, entry);
+    if (path_copy != NULL) cnxml_context_dealloc(cache->ctx, path_copy);
+    if (file_name != NULL) cnxml_context_dealloc(cache->ctx, file_name);
+    return (cnxml_cache_entry*)CNXML_ERROR_ALLOCFAIL;
+  }
+  memcpy(path_copy, path, path_len + 1);
+  memset(entry, 0, sizeof(cnxml_cache_entry));
+  entry->path = path_copy;
+  entry->size = size;
+  entry->mtime = mtime;
+
+  cnxml_document* doc = NULL;
+  if (file_name != NULL) {
+    doc = INTERNAL_cnxml_cache_load_saved(cache, path, file_name, size, mtime, &entry->content_hash);
+    if (doc != NULL) cache->counters.disk_hits += 1;
+  }
+
+  if (doc == NULL) {
+    cnxml_source* source = cnxml_source_open(cache->ctx, path);
+    if (CNXML_IS_ERROR(source)) {
+      doc = (cnxml_document*)source;
+    } else {
+      entry->content_hash = INTERNAL_cnxml_cache_content_hash(source);
+      doc = cnxml_document_parse(cache->ctx, source->data, source->data_len, 1);
+      if (CNXML_IS_ERROR(doc)) cnxml_source_free(source);
+      else doc->source = source;
+    }
+    if (!CNXML_IS_ERROR(doc)) {
+      cache->counters.misses += 1;
+      uint64_t tag[CNXML_BINARY_TAG_SIZE];
+      tag[INTERNAL_CNXML_CACHE_TAG_PATH] = INTERNAL_cnxml_cache_hash64(path, path_len);
+      tag[INTERNAL_CNXML_CACHE_TAG_SIZE] = size;
+      tag[INTERNAL_CNXML_CACHE_TAG_MTIME] = mtime;
+      tag[INTERNAL_CNXML_CACHE_TAG_CONTENT] = entry->content_hash;
+      // blobs don't keep parser errors, so a saved copy of a broken
+      // document would load as a clean one
+      if (file_name != NULL && doc->error_count == 0 && INTERNAL_cnxml_cache_save(cache, doc, file_name, tag)) {
+        cache->counters.disk_writes += 1;
+      }
+    }
+  }
+  if (file_name != NULL) cnxml_context_dealloc(cache->ctx, file_name);
+
+  if (CNXML_IS_ERROR(doc)) {
+    cnxml_context_dealloc(cache->ctx, path_copy);
+    cnxml_context_dealloc(cache->ctx, entry);
+    return (cnxml_cache_entry*)doc;
+  }
+  entry->doc = doc;
+  entry->bytes = INTERNAL_cnxml_cache_document_bytes(doc);
+  entry->refs = 1;
+  if (cnxml_hashmap_put(cache->entries, cnxml_string_newlen(entry->path, path_len), entry) != CNXML_MAP_OK) {
+    INTERNAL_cnxml_cache_entry_free(cache, entry);
+    return (cnxml_cache_entry*)CNXML_ERROR_ALLOCFAIL;
+  }
+  INTERNAL_cnxml_cache_push_front(cache, entry);
+  cache->memory_used += entry->bytes;
+  INTERNAL_cnxml_cache_evict(cache);
+  return entry;
+}
+
+void cnxml_cache_release(cnxml_cache* cache, cnxml_cache_entry* entry) {
+  entry->refs -= 1;
+  if (entry->refs > 0) return;
+  if (entry->stale) {
+    INTERNAL_cnxml_cache_entry_free(cache, entry);
+    return;
+  }
+  // it may have been holding the cache over its limit
+  INTERNAL_cnxml_cache_evict(cache);
+}
+
+void cnxml_cache_clear(cnxml_cache* cache) {
+  cnxml_cache_entry* entry = cache->lru_head;
+  while (entry != NULL) {
+    cnxml_cache_entry* next = entry->next;
+    if (entry->refs == 0) INTERNAL_cnxml_cache_drop(cache, entry);
+    entry = next;
+  }
+}
+
+void cnxml_cache_free(cnxml_cache* cache) {
+  cnxml_cache_entry* entry = cache->lru_head;
+  while (entry != NULL) {
+    cnxml_cache_entry* next = entry->next;
+    INTERNAL_cnxml_cache_entry_free(cache, entry);
+    entry = next;
+  }
+  if (cache->entries != NULL) cnxml_hashmap_free(cache->entries);
+  if (cache->directory != NULL) cnxml_context_dealloc(cache->ctx, cache->directory);
+  cnxml_context_dealloc(cache->ctx, cache);
+}
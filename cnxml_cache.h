@@ -0,0 +1,73 @@
+#ifndef CNXML_CACHE
+#define CNXML_CACHE
+
+#include <stdint.h>
+#include "cnxml.h"
+#include "cnxml_document.h"
+
+// parsed documents kept across lookups, and across runs
+//
+// files are looked up by path and checked against their size and
+// modification time. a document already in memory is returned as is; if
+// the cache has a directory, a tree saved there by an earlier run is
+// loaded as a binary blob (see cnxml_document_save_binary), and only
+// otherwise is the file parsed, and then saved for next time unless it
+// had parser errors, which blobs don't keep. a saved tree whose file
+// was touched but not changed (same size, new mtime) is still used
+// after comparing a hash of the contents, and its key is brought up to
+// date.
+//
+// documents in memory are dropped least recently used first once they
+// take more than memory_limit bytes. an acquired entry is never dropped
+// until it's released. a cache must only be used by one thread at a
+// time.
+
+#define CNXML_CACHE_FILE_SUFFIX ".cnxb"
+
+typedef struct _cnxml_cache_entry cnxml_cache_entry;
+
+struct _cnxml_cache_entry {
+  char* path;
+  uint64_t size;            // OF THE FILE WHEN IT WAS PARSED
+  uint64_t mtime;           // NANOSECONDS, WHERE THE PLATFORM HAS THEM
+  uint64_t content_hash;
+  cnxml_document* doc;
+  size_t bytes;             // WHAT doc COUNTS AGAINST memory_limit
+  int refs;                 // ACQUIRES NOT YET RELEASED
+  bool stale;               // FILE CHANGED, FREED ON THE LAST RELEASE
+  cnxml_cache_entry* prev;  // LRU ORDER, MOST RECENT FIRST
+  cnxml_cache_entry* next;
+};
+
+typedef struct {
+  uint64_t hits;            // FOUND IN MEMORY
+  uint64_t disk_hits;       // LOADED FROM THE CACHE DIRECTORY
+  uint64_t misses;          // PARSED
+  uint64_t stale;           // ENTRIES DROPPED BECAUSE THEIR FILE CHANGED
+  uint64_t evictions;       // ENTRIES DROPPED FOR memory_limit
+  uint64_t disk_writes;
+} cnxml_cache_counters;
+
+typedef struct {
+  cnxml_context* ctx;
+  char* directory;          // NULL IF NOTHING IS KEPT ON DISK
+  size_t memory_limit;      // 0 FOR NO LIMIT
+  size_t memory_used;
+  cnxml_map entries;        // PATH -> cnxml_cache_entry*
+  cnxml_cache_entry* lru_head;
+  cnxml_cache_entry* lru_tail;
+  cnxml_cache_counters counters;
+} cnxml_cache;
+
+/*** CACHE API ***/
+// directory (optional) is created if it doesn't exist
+CNXML_EXPORT cnxml_cache* CNXML_API cnxml_cache_new(cnxml_context* ctx, const char* directory, size_t memory_limit);
+// the document is entry->doc. CNXML_ERROR_IO if the file can't be read
+CNXML_EXPORT cnxml_cache_entry* CNXML_API cnxml_cache_acquire(cnxml_cache* cache, const char* path);
+CNXML_EXPORT void CNXML_API cnxml_cache_release(cnxml_cache* cache, cnxml_cache_entry* entry);
+// drops every document that isn't acquired
+CNXML_EXPORT void CNXML_API cnxml_cache_clear(cnxml_cache* cache);
+// every entry has to be released first
+CNXML_EXPORT void CNXML_API cnxml_cache_free(cnxml_cache* cache);
+
+#endif//CNXML_CACHE
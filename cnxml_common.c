@@ -1,4 +1,21 @@
 #include "cnxml_common.h"
+#include "cnxml_stats.h"
+#include <string.h>
+
+// every arena block is prefixed with its size so that realloc
+// knows how much to copy. blocks are aligned like malloc's are
+#define CNXML_ARENA_ALIGN (_Alignof(max_align_t))
+#define CNXML_ARENA_ALIGN_UP(n) (((n) + CNXML_ARENA_ALIGN - 1) & ~(CNXML_ARENA_ALIGN - 1))
+#define CNXML_ARENA_HEADER_SIZE CNXML_ARENA_ALIGN_UP(sizeof(size_t))
+
+struct _cnxml_arena_chunk {
+  cnxml_arena_chunk* next;
+  size_t capacity;
+  size_t used;
+  void* last_block; // most recent allocation, can be grown in place
+};
+
+#define CNXML_ARENA_CHUNK_DATA(chunk) ((char*)(chunk) + CNXML_ARENA_ALIGN_UP(sizeof(cnxml_arena_chunk)))
 
 cnxml_context* cnxml_context_new(cnxml_alloc_func* alloc, cnxml_realloc_func* realloc, cnxml_dealloc_func* dealloc) {\
   if (alloc == NULL || realloc == NULL || dealloc == NULL) return (cnxml_context*)CNXML_ERROR_BADARGS;
@@ -8,9 +25,151 @@ cnxml_context* cnxml_context_new(cnxml_alloc_func* alloc, cnxml_realloc_func* re
   ctx->alloc = alloc;
   ctx->realloc = realloc;
   ctx->dealloc = dealloc;
+  ctx->arena = NULL;
+  ctx->arena_chunk_size = 0;
+  ctx->symbols = NULL;
+  ctx->stats = NULL;
+  ctx->read_only = false;
   return ctx;
 }
 
+cnxml_context* cnxml_context_new_arena(cnxml_alloc_func* alloc, cnxml_realloc_func* realloc, cnxml_dealloc_func* dealloc, size_t chunk_size) {
+  cnxml_context* ctx = cnxml_context_new(alloc, realloc, dealloc);
+  if ((size_t)ctx >= CNXML_ERRORPTR_FIRST && (size_t)ctx <= CNXML_ERRORPTR_LAST) return ctx;
+  if (chunk_size == 0) chunk_size = CNXML_ARENA_DEFAULT_CHUNK_SIZE;
+  ctx->arena_chunk_size = chunk_size;
+  return ctx;
+}
+
+bool cnxml_context_is_arena(cnxml_context* ctx) {
+  return ctx->arena_chunk_size != 0;
+}
+
+// names parsed through ctx are interned in symbols from now on. the
+// table isn't owned by the context and has to outlive it
+void cnxml_context_set_symbols(cnxml_context* ctx, cnxml_intern_table* symbols) {
+  ctx->symbols = symbols;
+}
+
+// parses, allocations and frees through ctx are counted in stats from
+// now on, NULL to stop. returns false if stats weren't compiled in
+bool cnxml_context_set_stats(cnxml_context* ctx, cnxml_parse_stats* stats) {
+#ifdef CNXML_ENABLE_STATS
+  ctx->stats = stats;
+  return true;
+#else
+  (void)ctx;
+  (void)stats;
+  return false;
+#endif
+}
+
+static cnxml_arena_chunk* INTERNAL_cnxml_arena_chunk_new(cnxml_context* ctx, size_t capacity) {
+  cnxml_arena_chunk* chunk = ctx->alloc(CNXML_ARENA_ALIGN_UP(sizeof(cnxml_arena_chunk)) + capacity);
+  if (chunk == NULL) return NULL;
+  chunk->next = NULL;
+  chunk->capacity = capacity;
+  chunk->used = 0;
+  chunk->last_block = NULL;
+  return chunk;
+}
+
+static void* INTERNAL_cnxml_arena_alloc(cnxml_context* ctx, size_t size) {
+  size_t block_size = CNXML_ARENA_HEADER_SIZE + CNXML_ARENA_ALIGN_UP(size);
+  cnxml_arena_chunk* chunk = ctx->arena;
+
+  if (chunk == NULL || chunk->capacity - chunk->used < block_size) {
+    if (block_size > ctx->arena_chunk_size / 2) {
+      // big blocks get a chunk of their own behind the current one,
+      // so the free space left in the current chunk isn't wasted
+      cnxml_arena_chunk* own = INTERNAL_cnxml_arena_chunk_new(ctx, block_size);
+      if (own == NULL) return NULL;
+      if (chunk == NULL) {
+        ctx->arena = own;
+      } else {
+        own->next = chunk->next;
+        chunk->next = own;
+      }
+      chunk = own;
+    } else {
+      chunk = INTERNAL_cnxml_arena_chunk_new(ctx, ctx->arena_chunk_size);
+      if (chunk == NULL) return NULL;
+      chunk->next = ctx->arena;
+      ctx->arena = chunk;
+    }
+  }
+
+  char* block = CNXML_ARENA_CHUNK_DATA(chunk) + chunk->used;
+  chunk->used += block_size;
+  *(size_t*)block = size;
+  chunk->last_block = block + CNXML_ARENA_HEADER_SIZE;
+  return chunk->last_block;
+}
+
+void* cnxml_context_alloc(cnxml_context* ctx, size_t size) {
+  CNXML_STATS_RECORD(ctx, stats->alloc_count += 1; stats->alloc_bytes += size);
+  if (ctx->arena_chunk_size == 0) return ctx->alloc(size);
+  return INTERNAL_cnxml_arena_alloc(ctx, size);
+}
+
+void* cnxml_context_realloc(cnxml_context* ctx, void* ptr, size_t new_size) {
+  CNXML_STATS_RECORD(ctx, stats->alloc_count += 1; stats->alloc_bytes += new_size);
+  if (ctx->arena_chunk_size == 0) return ctx->realloc(ptr, new_size);
+  if (ptr == NULL) return INTERNAL_cnxml_arena_alloc(ctx, new_size);
+
+  size_t* header = (size_t*)((char*)ptr - CNXML_ARENA_HEADER_SIZE);
+  size_t old_size = *header;
+
+  // growing the last block of the current chunk doesn't need a copy
+  cnxml_arena_chunk* chunk = ctx->arena;
+  if (chunk != NULL && chunk->last_block == ptr) {
+    size_t old_aligned = CNXML_ARENA_ALIGN_UP(old_size);
+    size_t new_aligned = CNXML_ARENA_ALIGN_UP(new_size);
+    if (new_aligned <= old_aligned || chunk->capacity - chunk->used >= new_aligned - old_aligned) {
+      chunk->used = chunk->used - old_aligned + new_aligned;
+      *header = new_size;
+      return ptr;
+    }
+  }
+
+  if (new_size <= old_size) return ptr;
+
+  void* new_ptr = INTERNAL_cnxml_arena_alloc(ctx, new_size);
+  if (new_ptr == NULL) return NULL;
+  memcpy(new_ptr, ptr, old_size);
+  return new_ptr;
+}
+
+void cnxml_context_dealloc(cnxml_context* ctx, void* ptr) {
+  // arena memory is only released all at once
+  if (ctx->arena_chunk_size != 0) return;
+  ctx->dealloc(ptr);
+}
+
+// bytes of arena chunks held, used or not. 0 for other contexts
+size_t cnxml_context_arena_size(cnxml_context* ctx) {
+  size_t size = 0;
+  for (cnxml_arena_chunk* chunk = ctx->arena; chunk != NULL; chunk = chunk->next) {
+    size += chunk->capacity;
+  }
+  return size;
+}
+
+void cnxml_context_reset(cnxml_context* ctx) {
+#ifdef CNXML_ENABLE_STATS
+  double start = ctx->stats != NULL ? cnxml_stats_now() : 0;
+#endif
+  cnxml_arena_chunk* chunk = ctx->arena;
+  while (chunk != NULL) {
+    cnxml_arena_chunk* next = chunk->next;
+    ctx->dealloc(chunk);
+    chunk = next;
+  }
+  ctx->arena = NULL;
+  CNXML_STATS_RECORD(ctx, stats->free_seconds += cnxml_stats_now() - start);
+}
+
 void cnxml_context_free(cnxml_context* ctx) {
+  cnxml_context_reset(ctx);
 	ctx->dealloc(ctx);
-}
\ No newline at end of file
+}
@@ -1,7 +1,10 @@
+
 #ifndef CNXML_COMMON_MACRO
 #define CNXML_COMMON_MACRO
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 // apart from the cnxml_error enum,
 // cnxml also encodes errors in pointer return values
@@ -10,7 +13,9 @@
 typedef enum {
 	CNXML_ERROR_OK = 0,
 	CNXML_ERROR_ALLOCFAIL = 1,
-	CNXML_ERROR_BADARGS = 2
+	CNXML_ERROR_BADARGS = 2,
+	CNXML_ERROR_IO = 3,
+	CNXML_ERROR_FORMAT = 4
 } cnxml_error;
 
 #define CNXML_ERRORPTR_FIRST ((size_t)1)
@@ -31,13 +36,40 @@ typedef void* cnxml_alloc_func(size_t size);
 typedef void* cnxml_realloc_func(void* ptr, size_t new_size);
 typedef void cnxml_dealloc_func(void* ptr);
 
+typedef struct _cnxml_arena_chunk cnxml_arena_chunk;
+typedef struct _cnxml_intern_table cnxml_intern_table;
+typedef struct _cnxml_parse_stats cnxml_parse_stats; // see cnxml_stats.h
+
+// see cnxml_intern.h
+typedef uint32_t cnxml_symbol;
+#define CNXML_SYMBOL_NONE ((cnxml_symbol)0)
+
+// in arena mode, alloc/realloc/dealloc are only used to get chunks
+// of arena_chunk_size bytes; everything allocated through the context
+// lives until cnxml_context_reset or cnxml_context_free
 typedef struct {
   cnxml_alloc_func* alloc;
   cnxml_realloc_func* realloc;
   cnxml_dealloc_func* dealloc;
+  cnxml_arena_chunk* arena;  // NULL until the first arena allocation
+  size_t arena_chunk_size;   // 0 IF NOT AN ARENA
+  cnxml_intern_table* symbols; // NULL UNLESS NAMES ARE INTERNED
+  cnxml_parse_stats* stats;    // NULL UNLESS STATS ARE RECORDED
+  bool read_only;              // TREES IN IT CAN'T BE CHANGED (LOADED BINARY TREES)
 } cnxml_context;
 
+#define CNXML_ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
 CNXML_EXPORT cnxml_context* CNXML_API cnxml_context_new(cnxml_alloc_func* alloc, cnxml_realloc_func* realloc, cnxml_dealloc_func* dealloc);
+CNXML_EXPORT cnxml_context* CNXML_API cnxml_context_new_arena(cnxml_alloc_func* alloc, cnxml_realloc_func* realloc, cnxml_dealloc_func* dealloc, size_t chunk_size);
+CNXML_EXPORT bool CNXML_API cnxml_context_is_arena(cnxml_context* ctx);
+CNXML_EXPORT void CNXML_API cnxml_context_set_symbols(cnxml_context* ctx, cnxml_intern_table* symbols);
+CNXML_EXPORT bool CNXML_API cnxml_context_set_stats(cnxml_context* ctx, cnxml_parse_stats* stats);
+CNXML_EXPORT void* CNXML_API cnxml_context_alloc(cnxml_context* ctx, size_t size);
+CNXML_EXPORT void* CNXML_API cnxml_context_realloc(cnxml_context* ctx, void* ptr, size_t new_size);
+CNXML_EXPORT void CNXML_API cnxml_context_dealloc(cnxml_context* ctx, void* ptr);
+CNXML_EXPORT size_t CNXML_API cnxml_context_arena_size(cnxml_context* ctx);
+CNXML_EXPORT void CNXML_API cnxml_context_reset(cnxml_context* ctx);
 CNXML_EXPORT void CNXML_API cnxml_context_free(cnxml_context* ctx);
 
-#endif//CNXML_COMMON_MACRO
\ No newline at end of file
+#endif//CNXML_COMMON_MACRO
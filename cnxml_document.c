@@ -0,0 +1,802 @@
+#include "cnxml_document.h"
+#include "cnxml_scan.h"
+#include "cnxml_thread.h"
+#include <stdio.h>
+#include <string.h>
+
+/*** DOCUMENT ***/
+
+typedef enum {
+  INTERNAL_CNXML_DOCUMENT_ROOTS,     // complete top-level elements
+  INTERNAL_CNXML_DOCUMENT_ROOT_HEAD, // a root's start tag and first children
+  INTERNAL_CNXML_DOCUMENT_CONTENT,   // more children of the last root
+  INTERNAL_CNXML_DOCUMENT_ROOT_END   // that root's end tag
+} INTERNAL_cnxml_document_piece_kind;
+
+typedef struct {
+  INTERNAL_cnxml_document_piece_kind kind;
+  size_t start;
+  size_t end;
+  cnxml_element_list* roots; // ROOTS
+  cnxml_element elem;        // ROOT_HEAD: the root, CONTENT: holds the children
+  bool ok;
+} INTERNAL_cnxml_document_piece;
+
+typedef struct {
+  cnxml_context* ctx;
+  INTERNAL_cnxml_document_piece* ptr;
+  size_t len;
+  size_t capacity;
+} INTERNAL_cnxml_document_plan;
+
+typedef struct {
+  const char* data;
+  INTERNAL_cnxml_document_plan* plan;
+  volatile uint64_t next_piece;
+  volatile uint64_t failed;
+} INTERNAL_cnxml_document_job;
+
+typedef struct {
+  INTERNAL_cnxml_document_job* job;
+  cnxml_context* ctx;
+  cnxml_thread thread;
+} INTERNAL_cnxml_document_worker;
+
+static bool INTERNAL_cnxml_document_plan_add(INTERNAL_cnxml_document_plan* plan, INTERNAL_cnxml_document_piece_kind kind, size_t start, size_t end) {
+  if (plan->len == plan->capacity) {
+    size_t new_capacity = plan->capacity == 0 ? 16 : plan->capacity * 2;
+    INTERNAL_cnxml_document_piece* new_ptr = cnxml_context_realloc(plan->ctx, plan->ptr, sizeof(INTERNAL_cnxml_document_piece) * new_capacity);
+    if (new_ptr == NULL) return false;
+    plan->ptr = new_ptr;
+    plan->capacity = new_capacity;
+  }
+  INTERNAL_cnxml_document_piece* piece = plan->ptr + plan->len;
+  piece->kind = kind;
+  piece->start = start;
+  piece->end = end;
+  piece->roots = NULL;
+  piece->ok = false;
+  plan->len += 1;
+  return true;
+}
+
+static size_t INTERNAL_cnxml_document_skip_past(const char* data, size_t from, size_t len, const char* needle, size_t needle_len) {
+  size_t found = cnxml_scan_string(data + from, len - from, needle, needle_len);
+  if (found == len - from) return 0;
+  return from + found + needle_len;
+}
+
+// splits the input into pieces of at least chunk_size bytes, cutting
+// only in front of a root's children. returns false if the markup
+// doesn't balance out, in which case it's parsed on one thread
+static bool INTERNAL_cnxml_document_make_plan(INTERNAL_cnxml_document_plan* plan, const char* data, size_t len, size_t chunk_size) {
+  size_t pos = 0;
+  size_t cut = 0;
+  size_t root_start = 0;
+  size_t depth = 0;
+  bool splitting = false;
+
+  while (true) {
+    size_t lt = cnxml_scan_char(data + pos, len - pos, '<');
+    if (lt == len - pos) break;
+    pos += lt;
+    if (pos + 1 >= len) return false;
+
+    char c = data[pos + 1];
+    size_t end;
+    if (c == '!') {
+      if (pos + 4 <= len && data[pos + 2] == '-' && data[pos + 3] == '-') {
+        end = INTERNAL_cnxml_document_skip_past(data, pos + 4, len, "-->", 3);
+      } else {
+        end = INTERNAL_cnxml_document_skip_past(data, pos + 2, len, ">", 1);
+      }
+      if (end == 0) return false;
+      pos = end;
+      continue;
+    }
+    if (c == '?') {
+      end = INTERNAL_cnxml_document_skip_past(data, pos + 2, len, "?>", 2);
+      if (end == 0) return false;
+      pos = end;
+      continue;
+    }
+
+    size_t gt = cnxml_scan_tag_end(data + pos, len - pos);
+    if (gt == len - pos) return false;
+    end = pos + gt + 1;
+
+    if (c == '/') {
+      if (depth == 0) return false;
+      depth -= 1;
+      if (depth == 0 && splitting) {
+        if (!INTERNAL_cnxml_document_plan_add(plan, INTERNAL_CNXML_DOCUMENT_CONTENT, cut, pos)) return false;
+        if (!INTERNAL_cnxml_document_plan_add(plan, INTERNAL_CNXML_DOCUMENT_ROOT_END, pos, end)) return false;
+        cut = end;
+        splitting = false;
+      }
+      pos = end;
+      continue;
+    }
+
+    if (depth == 0) root_start = pos;
+    if (depth == 1 && pos - cut >= chunk_size) {
+      if (!splitting) {
+        if (root_start > cut && !INTERNAL_cnxml_document_plan_add(plan, INTERNAL_CNXML_DOCUMENT_ROOTS, cut, root_start)) return false;
+        if (!INTERNAL_cnxml_document_plan_add(plan, INTERNAL_CNXML_DOCUMENT_ROOT_HEAD, root_start, pos)) return false;
+        splitting = true;
+      } else {
+        if (!INTERNAL_cnxml_document_plan_add(plan, INTERNAL_CNXML_DOCUMENT_CONTENT, cut, pos)) return false;
+      }
+      cut = pos;
+    }
+    if (data[end - 2] != '/') depth += 1;
+    pos = end;
+  }
+
+  if (depth != 0) return false;
+  if (cut < len && !INTERNAL_cnxml_document_plan_add(plan, INTERNAL_CNXML_DOCUMENT_ROOTS, cut, len)) return false;
+  return true;
+}
+
+static void INTERNAL_cnxml_document_parse_piece(cnxml_parser* parser, const char* data, INTERNAL_cnxml_document_piece* piece) {
+  cnxml_tokenizer_reset(parser->tokenizer, data, piece->end);
+  parser->tokenizer->current_index = piece->start;
+
+  switch (piece->kind) {
+  case INTERNAL_CNXML_DOCUMENT_ROOTS:
+    piece->roots = cnxml_parser_read_document(parser);
+    piece->ok = !CNXML_IS_ERROR(piece->roots) && parser->stack_len == 0;
+    break;
+  case INTERNAL_CNXML_DOCUMENT_ROOT_HEAD:
+    piece->elem = cnxml_parser_read_element(parser);
+    piece->ok = parser->stack_len == 1;
+    break;
+  case INTERNAL_CNXML_DOCUMENT_CONTENT:
+    piece->elem = cnxml_element_new(parser->ctx, CNXML_STRING_EMPTY);
+    cnxml_parser_read_content(parser, &piece->elem);
+    piece->ok = parser->stack_len == 1;
+    break;
+  case INTERNAL_CNXML_DOCUMENT_ROOT_END:
+    // checked while joining
+    piece->ok = true;
+    break;
+  }
+  if (parser->error_count > 0) piece->ok = false;
+}
+
+static void INTERNAL_cnxml_document_worker_main(cnxml_any arg) {
+  INTERNAL_cnxml_document_worker* worker = arg;
+  INTERNAL_cnxml_document_job* job = worker->job;
+
+  cnxml_tokenizer* tokenizer = cnxml_tokenizer_new(worker->ctx, job->data, 0);
+  if (CNXML_IS_ERROR(tokenizer)) {
+    cnxml_atomic_store_u64(&job->failed, 1);
+    return;
+  }
+  cnxml_parser* parser = cnxml_parser_new(worker->ctx, tokenizer);
+  if (CNXML_IS_ERROR(parser)) {
+    cnxml_atomic_store_u64(&job->failed, 1);
+    return;
+  }
+
+  while (cnxml_atomic_load_u64(&job->failed) == 0) {
+    uint64_t index = cnxml_atomic_fetch_add_u64(&job->next_piece, 1);
+    if (index >= job->plan->len) break;
+    INTERNAL_cnxml_document_piece* piece = job->plan->ptr + index;
+    INTERNAL_cnxml_document_parse_piece(parser, job->data, piece);
+    // no point going on once the whole thing is parsed again anyway
+    if (!piece->ok) cnxml_atomic_store_u64(&job->failed, 1);
+  }
+}
+
+static bool INTERNAL_cnxml_document_check_end_tag(cnxml_tokenizer* tokenizer, const char* data, INTERNAL_cnxml_document_piece* piece, cnxml_string name) {
+  cnxml_tokenizer_reset(tokenizer, data, piece->end);
+  tokenizer->current_index = piece->start;
+  if (cnxml_tokenizer_next_token(tokenizer).type != CNXML_TOKEN_OPENLESS) return false;
+  if (cnxml_tokenizer_cur_char(tokenizer) != '/') return false;
+  cnxml_tokenizer_move(tokenizer, 1);
+  cnxml_token end_name = cnxml_tokenizer_next_token(tokenizer);
+  if (end_name.type != CNXML_TOKEN_STRING || !cnxml_string_equal(end_name.content, name)) return false;
+  return cnxml_tokenizer_next_token(tokenizer).type == CNXML_TOKEN_CLOSEGREATER;
+}
+
+// puts the pieces back together into doc->roots. the children of split
+// roots are copied over in order, the elements below them stay put
+static bool INTERNAL_cnxml_document_join(cnxml_document* doc, const char* data, INTERNAL_cnxml_document_plan* plan) {
+  cnxml_context* ctx = doc->contexts[0];
+  doc->roots = cnxml_element_list_new(ctx);
+  if (CNXML_IS_ERROR(doc->roots)) return false;
+  cnxml_tokenizer* tokenizer = cnxml_tokenizer_new(ctx, data, 0);
+  if (CNXML_IS_ERROR(tokenizer)) return false;
+
+  for (size_t i = 0; i < plan->len; i++) {
+    INTERNAL_cnxml_document_piece* piece = plan->ptr + i;
+    if (!piece->ok) return false;
+
+    cnxml_element* root = doc->roots->len > 0 ? doc->roots->ptr + doc->roots->len - 1 : NULL;
+    switch (piece->kind) {
+    case INTERNAL_CNXML_DOCUMENT_ROOTS:
+      for (size_t j = 0; j < piece->roots->len; j++) {
+        if (cnxml_element_list_append(doc->roots, piece->roots->ptr[j]) != CNXML_ERROR_OK) return false;
+      }
+      break;
+    case INTERNAL_CNXML_DOCUMENT_ROOT_HEAD: {
+      if (cnxml_element_list_append(doc->roots, piece->elem) != CNXML_ERROR_OK) return false;
+      root = doc->roots->ptr + doc->roots->len - 1;
+      // size the root's child list once for all of its pieces
+      size_t child_count = cnxml_element_list_length(root->children);
+      for (size_t j = i + 1; j < plan->len && plan->ptr[j].kind == INTERNAL_CNXML_DOCUMENT_CONTENT; j++) {
+        child_count += cnxml_element_list_length(plan->ptr[j].elem.children);
+      }
+      if (child_count > 0 && root->children == NULL) {
+        root->children = cnxml_element_list_new(root->ctx);
+        if (CNXML_IS_ERROR(root->children)) return false;
+      }
+      if (child_count > 0 && cnxml_element_list_reserve(root->children, child_count) != CNXML_ERROR_OK) return false;
+      break;
+    }
+    case INTERNAL_CNXML_DOCUMENT_CONTENT: {
+      cnxml_element* content = &piece->elem;
+      // the pieces come straight from the parser, so their text is raw
+      cnxml_element_add_raw_text(root, content->text_content);
+      for (size_t j = 0; content->text_spans != NULL && j < content->text_spans->len; j++) {
+        cnxml_element_add_raw_text(root, content->text_spans->ptr[j]);
+      }
+      size_t child_count = cnxml_element_list_length(content->children);
+      for (size_t j = 0; j < child_count; j++) {
+        if (cnxml_element_list_append(root->children, content->children->ptr[j]) != CNXML_ERROR_OK) return false;
+      }
+      break;
+    }
+    case INTERNAL_CNXML_DOCUMENT_ROOT_END:
+      if (!INTERNAL_cnxml_document_check_end_tag(tokenizer, data, piece, root->name)) return false;
+      break;
+    }
+  }
+  return true;
+}
+
+static bool INTERNAL_cnxml_document_parse_parallel(cnxml_document* doc, const char* data, size_t data_len, int thread_count) {
+  size_t chunk_size = data_len / ((size_t)thread_count * CNXML_DOCUMENT_CHUNKS_PER_THREAD);
+  if (chunk_size < CNXML_DOCUMENT_MIN_CHUNK_SIZE) chunk_size = CNXML_DOCUMENT_MIN_CHUNK_SIZE;
+
+  INTERNAL_cnxml_document_plan plan = {doc->ctx, NULL, 0, 0};
+  bool ok = INTERNAL_cnxml_document_make_plan(&plan, data, data_len, chunk_size) && plan.len > 1;
+  if (ok) {
+    if ((size_t)thread_count > plan.len) thread_count = (int)plan.len;
+    ok = false;
+    INTERNAL_cnxml_document_worker* workers = cnxml_context_alloc(doc->ctx, sizeof(INTERNAL_cnxml_document_worker) * thread_count);
+    if (workers != NULL) {
+      INTERNAL_cnxml_document_job job = {data, &plan, 0, 0};
+      for (int i = 0; i < thread_count; i++) {
+        workers[i].job = &job;
+        workers[i].ctx = doc->contexts[i];
+      }
+      // pick the scanner before the workers race to do it
+      cnxml_scan_get_impl();
+
+      int started = 1;
+      while (started < thread_count && cnxml_thread_start(&workers[started].thread, INTERNAL_cnxml_document_worker_main, workers + started) == CNXML_ERROR_OK) {
+        started += 1;
+      }
+      INTERNAL_cnxml_document_worker_main(workers);
+      for (int i = 1; i < started; i++) {
+        cnxml_thread_join(&workers[i].thread);
+      }
+      cnxml_context_dealloc(doc->ctx, workers);
+
+      ok = cnxml_atomic_load_u64(&job.failed) == 0 && INTERNAL_cnxml_document_join(doc, data, &plan);
+    }
+  }
+
+  if (plan.ptr != NULL) cnxml_context_dealloc(doc->ctx, plan.ptr);
+  return ok;
+}
+
+static void INTERNAL_cnxml_document_parse_serial(cnxml_document* doc, const char* data, size_t data_len) {
+  cnxml_context* ctx = doc->contexts[0];
+  cnxml_tokenizer* tokenizer = cnxml_tokenizer_new(ctx, data, data_len);
+  if (CNXML_IS_ERROR(tokenizer)) return;
+  cnxml_parser* parser = cnxml_parser_new(ctx, tokenizer);
+  if (CNXML_IS_ERROR(parser)) return;
+
+  cnxml_element_list* roots = cnxml_parser_read_document(parser);
+  if (!CNXML_IS_ERROR(roots)) doc->roots = roots;
+  doc->errors = parser->error_buffer;
+  doc->error_count = parser->error_count;
+}
+
+// small inputs don't need full size arena chunks, their trees only take
+// a few times the input
+static size_t INTERNAL_cnxml_document_chunk_size(size_t data_len, int thread_count) {
+  size_t want = data_len / (size_t)thread_count * CNXML_DOCUMENT_ARENA_INPUT_FACTOR;
+  size_t chunk_size = CNXML_DOCUMENT_MIN_ARENA_CHUNK_SIZE;
+  while (chunk_size < want && chunk_size < CNXML_ARENA_DEFAULT_CHUNK_SIZE) chunk_size *= 2;
+  return chunk_size;
+}
+
+// data has to outlive the document. thread_count 0 uses one thread per
+// cpu, 1 parses on the calling thread only
+cnxml_document* cnxml_document_parse(cnxml_context* ctx, const char* data, size_t data_len, int thread_count) {
+  if (ctx == NULL || data == NULL) {
+    return (cnxml_document*)CNXML_ERROR_BADARGS;
+  }
+  if (thread_count <= 0) thread_count = cnxml_thread_cpu_count();
+  if (data_len / CNXML_DOCUMENT_MIN_CHUNK_SIZE < (size_t)thread_count) {
+    thread_count = (int)(data_len / CNXML_DOCUMENT_MIN_CHUNK_SIZE);
+    if (thread_count < 1) thread_count = 1;
+  }
+
+  cnxml_document* doc = cnxml_context_alloc(ctx, sizeof(cnxml_document));
+  if (doc == NULL) {
+    return (cnxml_document*)CNXML_ERROR_ALLOCFAIL;
+  }
+  doc->ctx = ctx;
+  doc->roots = NULL;
+  doc->errors = NULL;
+  doc->error_count = 0;
+  doc->context_count = 0;
+  doc->source = NULL;
+  doc->contexts = cnxml_context_alloc(ctx, sizeof(cnxml_context*) * thread_count);
+  if (doc->contexts == NULL) {
+    cnxml_document_free(doc);
+    return (cnxml_document*)CNXML_ERROR_ALLOCFAIL;
+  }
+  size_t chunk_size = INTERNAL_cnxml_document_chunk_size(data_len, thread_count);
+  for (int i = 0; i < thread_count; i++) {
+    cnxml_context* arena = cnxml_context_new_arena(ctx->alloc, ctx->realloc, ctx->dealloc, chunk_size);
+    if (CNXML_IS_ERROR(arena)) {
+      cnxml_document_free(doc);
+      return (cnxml_document*)arena;
+    }
+    cnxml_context_set_symbols(arena, ctx->symbols);
+    doc->contexts[i] = arena;
+    doc->context_count += 1;
+  }
+
+  if (thread_count == 1 || !INTERNAL_cnxml_document_parse_parallel(doc, data, data_len, thread_count)) {
+    // start over on one thread, which also gets the errors right
+    for (int i = 0; i < doc->context_count; i++) {
+      cnxml_context_reset(doc->contexts[i]);
+    }
+    doc->roots = NULL;
+    INTERNAL_cnxml_document_parse_serial(doc, data, data_len);
+  }
+
+  if (doc->roots == NULL) {
+    cnxml_document_free(doc);
+    return (cnxml_document*)CNXML_ERROR_ALLOCFAIL;
+  }
+  return doc;
+}
+
+cnxml_document* cnxml_document_parse_file(cnxml_context* ctx, const char* path, int thread_count) {
+  cnxml_source* source = cnxml_source_open(ctx, path);
+  if (CNXML_IS_ERROR(source)) {
+    return (cnxml_document*)source;
+  }
+  cnxml_document* doc = cnxml_document_parse(ctx, source->data, source->data_len, thread_count);
+  if (CNXML_IS_ERROR(doc)) {
+    cnxml_source_free(source);
+    return doc;
+  }
+  doc->source = source;
+  return doc;
+}
+
+size_t cnxml_document_root_count(cnxml_document* doc) {
+  return cnxml_element_list_length(doc->roots);
+}
+
+cnxml_element* cnxml_document_root(cnxml_document* doc, size_t index) {
+  if (index >= cnxml_document_root_count(doc)) return NULL;
+  return doc->roots->ptr + index;
+}
+
+void cnxml_document_free(cnxml_document* doc) {
+  if (doc->contexts != NULL) {
+    for (int i = 0; i < doc->context_count; i++) {
+      cnxml_context_free(doc->contexts[i]);
+    }
+    cnxml_context_dealloc(doc->ctx, doc->contexts);
+  }
+  if (doc->source != NULL) cnxml_source_free(doc->source);
+  cnxml_context_dealloc(doc->ctx, doc);
+}
+
+/*** BINARY ***/
+
+#define INTERNAL_CNXML_BINARY_ALIGN(n) (((n) + CNXML_BINARY_ALIGNMENT - 1) & ~(uint64_t)(CNXML_BINARY_ALIGNMENT - 1))
+#define INTERNAL_CNXML_BINARY_PTR(offset) ((void*)(uintptr_t)(offset))
+
+typedef struct {
+  cnxml_context* ctx;
+  cnxml_element** queue;  // EVERY ELEMENT, IN THE ORDER THEY'RE WRITTEN
+  size_t len;
+  size_t capacity;
+} INTERNAL_cnxml_binary_queue;
+
+typedef struct {
+  char* image;
+  cnxml_binary_header* header;
+  cnxml_map names;        // NAME -> STRING OFFSET, NAMES ARE STORED ONCE
+  uint64_t strings_len;
+} INTERNAL_cnxml_binary_writer;
+
+static bool INTERNAL_cnxml_binary_enqueue(INTERNAL_cnxml_binary_queue* queue, cnxml_element_list* list) {
+  if (list == NULL) return true;
+  if (queue->len + list->len > queue->capacity) {
+    size_t new_capacity = queue->capacity == 0 ? 64 : queue->capacity * 2;
+    while (new_capacity < queue->len + list->len) new_capacity *= 2;
+    cnxml_element** new_queue = cnxml_context_realloc(queue->ctx, queue->queue, sizeof(cnxml_element*) * new_capacity);
+    if (new_queue == NULL) return false;
+    queue->queue = new_queue;
+    queue->capacity = new_capacity;
+  }
+  for (size_t i = 0; i < list->len; i++) {
+    queue->queue[queue->len + i] = list->ptr + i;
+  }
+  queue->len += list->len;
+  return true;
+}
+
+static cnxml_string INTERNAL_cnxml_binary_put_string(INTERNAL_cnxml_binary_writer* writer, cnxml_string str) {
+  if (str.len == 0) return CNXML_STRING_EMPTY;
+  uint64_t offset = writer->header->strings + writer->strings_len;
+  memcpy(writer->image + offset, str.ptr, str.len);
+  writer->strings_len += str.len;
+  return cnxml_string_newlen(INTERNAL_CNXML_BINARY_PTR(offset), str.len);
+}
+
+static bool INTERNAL_cnxml_binary_put_name(INTERNAL_cnxml_binary_writer* writer, cnxml_string name, cnxml_string* out) {
+  cnxml_any found;
+  if (name.len == 0) {
+    *out = CNXML_STRING_EMPTY;
+  } else if (cnxml_hashmap_get(writer->names, name, &found) == CNXML_MAP_OK) {
+    *out = cnxml_string_newlen(found, name.len);
+  } else {
+    *out = INTERNAL_cnxml_binary_put_string(writer, name);
+    if (cnxml_hashmap_put(writer->names, name, (cnxml_any)out->ptr) != CNXML_MAP_OK) return false;
+  }
+  return true;
+}
+
+static bool INTERNAL_cnxml_binary_run_literal(const cnxml_element* elem, size_t run) {
+  if (run == 0) return elem->text_literal;
+  return elem->text_spans->literal != NULL && elem->text_spans->literal[run - 1];
+}
+
+// several text runs are saved joined, the way cnxml_element_text returns
+// them, with one literal flag. if literal and raw runs are mixed, the
+// literal ones are saved raw, with every '&' written as "&amp;". writes
+// to out unless it's NULL and returns the saved length
+static size_t INTERNAL_cnxml_binary_text(const cnxml_element* elem, char* out, bool* literal_out) {
+  size_t run_count = 1 + (elem->text_spans == NULL ? 0 : elem->text_spans->len);
+  bool literal = true;
+  for (size_t i = 0; i < run_count; i++) {
+    if (!INTERNAL_cnxml_binary_run_literal(elem, i)) literal = false;
+  }
+  if (literal_out != NULL) *literal_out = literal && elem->text_content.len > 0;
+
+  size_t len = 0;
+  for (size_t i = 0; i < run_count; i++) {
+    cnxml_string run = i == 0 ? elem->text_content : elem->text_spans->ptr[i - 1];
+    if (i > 0) {
+      if (out != NULL) out[len] = ' ';
+      len += 1;
+    }
+    bool escape = !literal && INTERNAL_cnxml_binary_run_literal(elem, i);
+    for (size_t j = 0; j < run.len; j++) {
+      if (escape && run.ptr[j] == '&') {
+        if (out != NULL) memcpy(out + len, "&amp;", 5);
+        len += 5;
+      } else {
+        if (out != NULL) out[len] = run.ptr[j];
+        len += 1;
+      }
+    }
+  }
+  return len;
+}
+
+// element i's children come right after everything queued before them,
+// so the queue order is also the order of the element records, and
+// every child list is a contiguous run of them
+static bool INTERNAL_cnxml_binary_fill(INTERNAL_cnxml_binary_writer* writer, INTERNAL_cnxml_binary_queue* queue, cnxml_element_list* roots) {
+  cnxml_binary_header* header = writer->header;
+  cnxml_element_list* lists = (cnxml_element_list*)(writer->image + header->lists);
+  cnxml_element* elements = (cnxml_element*)(writer->image + header->elements);
+  cnxml_attribute* attributes = (cnxml_attribute*)(writer->image + header->attributes);
+  uint64_t next_list = 1;
+  uint64_t next_child = (uint64_t)roots->len;
+  uint64_t next_attribute = 0;
+
+  lists[0].ptr = roots->len > 0 ? INTERNAL_CNXML_BINARY_PTR(header->elements) : NULL;
+  lists[0].len = roots->len;
+  lists[0].capacity = roots->len;
+
+  for (size_t i = 0; i < queue->len; i++) {
+    cnxml_element* src = queue->queue[i];
+    cnxml_element* rec = elements + i;
+    if (!INTERNAL_cnxml_binary_put_name(writer, src->name, &rec->name)) return false;
+
+    if (src->attributes.len > 0) {
+      rec->attributes.ptr = INTERNAL_CNXML_BINARY_PTR(header->attributes + next_attribute * sizeof(cnxml_attribute));
+      rec->attributes.len = src->attributes.len;
+      rec->attributes.capacity = src->attributes.len;
+      for (size_t j = 0; j < src->attributes.len; j++) {
+        cnxml_attribute* attr = attributes + next_attribute;
+        if (!INTERNAL_cnxml_binary_put_name(writer, src->attributes.ptr[j].name, &attr->name)) return false;
+        attr->value = INTERNAL_cnxml_binary_put_string(writer, src->attributes.ptr[j].value);
+        attr->literal = src->attributes.ptr[j].literal;
+        next_attribute += 1;
+      }
+    }
+
+    if (src->children != NULL && src->children->len > 0) {
+      cnxml_element_list* list = lists + next_list;
+      list->ptr = INTERNAL_CNXML_BINARY_PTR(header->elements + next_child * sizeof(cnxml_element));
+      list->len = src->children->len;
+      list->capacity = src->children->len;
+      rec->children = INTERNAL_CNXML_BINARY_PTR(header->lists + next_list * sizeof(cnxml_element_list));
+      next_list += 1;
+      next_child += (uint64_t)src->children->len;
+    }
+
+    uint64_t offset = header->strings + writer->strings_len;
+    size_t text_len = INTERNAL_cnxml_binary_text(src, writer->image + offset, &rec->text_literal);
+    if (text_len > 0) {
+      writer->strings_len += text_len;
+      rec->text_content = cnxml_string_newlen(INTERNAL_CNXML_BINARY_PTR(offset), text_len);
+    }
+  }
+  return true;
+}
+
+// doc can be parsed or loaded. the whole blob is built in memory and
+// written in one go. tag is CNXML_BINARY_TAG_SIZE words, or NULL
+cnxml_error cnxml_document_save_binary_tagged(cnxml_document* doc, const char* path, const uint64_t* tag) {
+  if (doc == NULL || path == NULL) return CNXML_ERROR_BADARGS;
+  cnxml_context* ctx = doc->ctx;
+
+  INTERNAL_cnxml_binary_queue queue = {ctx, NULL, 0, 0};
+  if (!INTERNAL_cnxml_binary_enqueue(&queue, doc->roots)) return CNXML_ERROR_ALLOCFAIL;
+  uint64_t list_count = 1;
+  uint64_t attribute_count = 0;
+  uint64_t max_strings_len = 0;
+  for (size_t i = 0; i < queue.len; i++) {
+    cnxml_element* elem = queue.queue[i];
+    if (!INTERNAL_cnxml_binary_enqueue(&queue, elem->children)) {
+      cnxml_context_dealloc(ctx, queue.queue);
+      return CNXML_ERROR_ALLOCFAIL;
+    }
+    if (elem->children != NULL && elem->children->len > 0) list_count += 1;
+    attribute_count += (uint64_t)elem->attributes.len;
+    max_strings_len += elem->name.len + INTERNAL_cnxml_binary_text(elem, NULL, NULL);
+    for (size_t j = 0; j < elem->attributes.len; j++) {
+      max_strings_len += elem->attributes.ptr[j].name.len + elem->attributes.ptr[j].value.len;
+    }
+  }
+
+  cnxml_binary_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CNXML_BINARY_MAGIC, sizeof(header.magic));
+  header.version = CNXML_BINARY_VERSION;
+  header.byte_order = CNXML_BINARY_BYTE_ORDER;
+  header.pointer_size = sizeof(void*);
+  header.element_size = sizeof(cnxml_element);
+  header.list_size = sizeof(cnxml_element_list);
+  header.attribute_size = sizeof(cnxml_attribute);
+  header.lists = INTERNAL_CNXML_BINARY_ALIGN(sizeof(cnxml_binary_header));
+  header.list_count = list_count;
+  header.elements = INTERNAL_CNXML_BINARY_ALIGN(header.lists + list_count * sizeof(cnxml_element_list));
+  header.element_count = queue.len;
+  header.attributes = INTERNAL_CNXML_BINARY_ALIGN(header.elements + queue.len * sizeof(cnxml_element));
+  header.attribute_count = attribute_count;
+  header.strings = header.attributes + attribute_count * sizeof(cnxml_attribute);
+  if (tag != NULL) memcpy(header.tag, tag, sizeof(header.tag));
+
+  // zeroed, so padding and unused fields are written as 0
+  INTERNAL_cnxml_binary_writer writer;
+  size_t capacity = (size_t)(header.strings + max_strings_len);
+  writer.image = cnxml_context_alloc(ctx, capacity);
+  writer.names = cnxml_hashmap_new(ctx);
+  writer.header = (cnxml_binary_header*)writer.image;
+  writer.strings_len = 0;
+  cnxml_error err = CNXML_ERROR_OK;
+  if (writer.image == NULL || writer.names == NULL) {
+    err = CNXML_ERROR_ALLOCFAIL;
+  } else {
+    memset(writer.image, 0, capacity);
+    memcpy(writer.image, &header, sizeof(header));
+    cnxml_element_list no_roots = {NULL, NULL, 0, 0};
+    if (!INTERNAL_cnxml_binary_fill(&writer, &queue, doc->roots != NULL ? doc->roots : &no_roots)) {
+      err = CNXML_ERROR_ALLOCFAIL;
+    }
+  }
+  cnxml_context_dealloc(ctx, queue.queue);
+  if (writer.names != NULL) cnxml_hashmap_free(writer.names);
+
+  if (err == CNXML_ERROR_OK) {
+    writer.header->strings_len = writer.strings_len;
+    writer.header->size = writer.header->strings + writer.strings_len;
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+      err = CNXML_ERROR_IO;
+    } else {
+      if (fwrite(writer.image, 1, (size_t)writer.header->size, f) != writer.header->size) err = CNXML_ERROR_IO;
+      if (fclose(f) != 0) err = CNXML_ERROR_IO;
+    }
+  }
+  if (writer.image != NULL) cnxml_context_dealloc(ctx, writer.image);
+  return err;
+}
+
+cnxml_error cnxml_document_save_binary(cnxml_document* doc, const char* path) {
+  return cnxml_document_save_binary_tagged(doc, path, NULL);
+}
+
+static bool INTERNAL_cnxml_binary_check_header(const cnxml_binary_header* header, size_t size) {
+  if (size < sizeof(cnxml_binary_header)) return false;
+  if (memcmp(header->magic, CNXML_BINARY_MAGIC, sizeof(header->magic)) != 0) return false;
+  if (header->version != CNXML_BINARY_VERSION || header->byte_order != CNXML_BINARY_BYTE_ORDER) return false;
+  if (header->pointer_size != sizeof(void*) || header->element_size != sizeof(cnxml_element)
+    || header->list_size != sizeof(cnxml_element_list) || header->attribute_size != sizeof(cnxml_attribute)) {
+    return false;
+  }
+  if (header->size != size || header->list_count == 0) return false;
+
+  // the regions have to follow each other in order, without overlapping
+  uint64_t end = sizeof(cnxml_binary_header);
+  const uint64_t regions[4][3] = {
+    {header->lists, header->list_count, sizeof(cnxml_element_list)},
+    {header->elements, header->element_count, sizeof(cnxml_element)},
+    {header->attributes, header->attribute_count, sizeof(cnxml_attribute)},
+    {header->strings, header->strings_len, 1}
+  };
+  for (int i = 0; i < 4; i++) {
+    if (regions[i][0] < end || regions[i][0] > size || regions[i][0] % sizeof(void*) != 0) return false;
+    if (regions[i][1] > (size - regions[i][0]) / regions[i][2]) return false;
+    end = regions[i][0] + regions[i][1] * regions[i][2];
+  }
+  return true;
+}
+
+// offset is a record in the region, returns its index or -1
+static int64_t INTERNAL_cnxml_binary_record(const void* offset, uint64_t region, uint64_t count, size_t record_size, uint64_t len) {
+  uint64_t off = (uint64_t)(uintptr_t)offset;
+  if (off < region || (off - region) % record_size != 0) return -1;
+  uint64_t index = (off - region) / record_size;
+  if (index >= count || len > count - index) return -1;
+  return (int64_t)index;
+}
+
+static bool INTERNAL_cnxml_binary_fix_string(char* base, const cnxml_binary_header* header, cnxml_string* str) {
+  uint64_t off = (uint64_t)(uintptr_t)str->ptr;
+  if (off == 0) return str->len == 0;
+  if (off < header->strings || off - header->strings > header->strings_len
+    || str->len > header->strings_len - (off - header->strings)) {
+    return false;
+  }
+  str->ptr = base + off;
+  return true;
+}
+
+static cnxml_element_list* INTERNAL_cnxml_binary_fix_list(char* base, const cnxml_binary_header* header, cnxml_context* ctx, cnxml_element_list* list) {
+  if (list->len == 0) {
+    list->ptr = NULL;
+  } else {
+    int64_t first = INTERNAL_cnxml_binary_record(list->ptr, header->elements, header->element_count, sizeof(cnxml_element), list->len);
+    if (first < 0) return NULL;
+    list->ptr = (cnxml_element*)(base + header->elements) + first;
+  }
+  list->ctx = ctx;
+  list->capacity = list->len;
+  return list;
+}
+
+// turns every offset in the records back into a pointer. children have
+// to come after their parent, so a loaded tree can't have cycles
+static bool INTERNAL_cnxml_binary_relocate(char* base, cnxml_context* ctx) {
+  const cnxml_binary_header* header = (const cnxml_binary_header*)base;
+  cnxml_element_list* lists = (cnxml_element_list*)(base + header->lists);
+  cnxml_element* elements = (cnxml_element*)(base + header->elements);
+  cnxml_attribute* attributes = (cnxml_attribute*)(base + header->attributes);
+
+  for (uint64_t i = 0; i < header->list_count; i++) {
+    if (INTERNAL_cnxml_binary_fix_list(base, header, ctx, lists + i) == NULL) return false;
+  }
+  for (uint64_t i = 0; i < header->attribute_count; i++) {
+    if (!INTERNAL_cnxml_binary_fix_string(base, header, &attributes[i].name)) return false;
+    if (!INTERNAL_cnxml_binary_fix_string(base, header, &attributes[i].value)) return false;
+    attributes[i].name_symbol = CNXML_SYMBOL_NONE;
+    // read as a byte, a blob isn't trusted to hold a valid bool
+    unsigned char literal;
+    memcpy(&literal, &attributes[i].literal, 1);
+    attributes[i].literal = literal != 0;
+  }
+
+  for (uint64_t i = 0; i < header->element_count; i++) {
+    cnxml_element* elem = elements + i;
+    elem->ctx = ctx;
+    elem->name_symbol = CNXML_SYMBOL_NONE;
+    unsigned char text_literal;
+    memcpy(&text_literal, &elem->text_literal, 1);
+    elem->text_literal = text_literal != 0;
+    if (!INTERNAL_cnxml_binary_fix_string(base, header, &elem->name)) return false;
+    if (!INTERNAL_cnxml_binary_fix_string(base, header, &elem->text_content)) return false;
+    elem->text_spans = NULL;
+
+    cnxml_attribute_list* attrs = &elem->attributes;
+    if (attrs->len == 0) {
+      attrs->ptr = NULL;
+    } else {
+      int64_t first = INTERNAL_cnxml_binary_record(attrs->ptr, header->attributes, header->attribute_count, sizeof(cnxml_attribute), attrs->len);
+      if (first < 0) return false;
+      attrs->ptr = attributes + first;
+    }
+    attrs->capacity = attrs->len;
+    attrs->index = NULL;
+
+    if (elem->children != NULL) {
+      // list 0 is the roots, nobody's children
+      int64_t list = INTERNAL_cnxml_binary_record(elem->children, header->lists, header->list_count, sizeof(cnxml_element_list), 1);
+      if (list <= 0) return false;
+      elem->children = lists + list;
+      if (elem->children->len > 0 && elem->children->ptr <= elem) return false;
+    }
+  }
+  return true;
+}
+
+// the tree is only valid as long as the document
+cnxml_document* cnxml_document_load_binary(cnxml_context* ctx, const char* path) {
+  if (ctx == NULL || path == NULL) {
+    return (cnxml_document*)CNXML_ERROR_BADARGS;
+  }
+  cnxml_document* doc = cnxml_context_alloc(ctx, sizeof(cnxml_document));
+  if (doc == NULL) {
+    return (cnxml_document*)CNXML_ERROR_ALLOCFAIL;
+  }
+  doc->ctx = ctx;
+  doc->roots = NULL;
+  doc->errors = NULL;
+  doc->error_count = 0;
+  doc->context_count = 0;
+  doc->source = NULL;
+
+  // the elements get a context of their own without a symbol table,
+  // since their names don't have symbols. it's an arena, so freeing
+  // anything in the tree is a no-op, and read-only, so the element
+  // functions refuse to change it instead of writing to the mapping
+  doc->contexts = cnxml_context_alloc(ctx, sizeof(cnxml_context*));
+  if (doc->contexts == NULL) {
+    cnxml_document_free(doc);
+    return (cnxml_document*)CNXML_ERROR_ALLOCFAIL;
+  }
+  cnxml_context* tree_ctx = cnxml_context_new_arena(ctx->alloc, ctx->realloc, ctx->dealloc, CNXML_DOCUMENT_MIN_ARENA_CHUNK_SIZE);
+  if (CNXML_IS_ERROR(tree_ctx)) {
+    cnxml_document_free(doc);
+    return (cnxml_document*)tree_ctx;
+  }
+  tree_ctx->read_only = true;
+  doc->contexts[0] = tree_ctx;
+  doc->context_count = 1;
+
+  cnxml_source* source = cnxml_source_open_private(ctx, path);
+  if (CNXML_IS_ERROR(source)) {
+    cnxml_document_free(doc);
+    return (cnxml_document*)source;
+  }
+  doc->source = source;
+
+  char* base = (char*)source->data;
+  if (((uintptr_t)base % sizeof(void*)) != 0 || !INTERNAL_cnxml_binary_check_header((const cnxml_binary_header*)base, source->data_len)
+    || !INTERNAL_cnxml_binary_relocate(base, tree_ctx)) {
+    cnxml_document_free(doc);
+    return (cnxml_document*)CNXML_ERROR_FORMAT;
+  }
+  cnxml_source_protect(source);
+  doc->roots = (cnxml_element_list*)(base + ((const cnxml_binary_header*)base)->lists);
+  return doc;
+}
@@ -0,0 +1,93 @@
+#ifndef CNXML_DOCUMENT
+#define CNXML_DOCUMENT
+
+#include "cnxml.h"
+#include "cnxml_source.h"
+
+// a whole parsed input: every top-level element plus the parser errors
+//
+// the tree lives in arenas owned by the document and goes away with
+// cnxml_document_free. big inputs are parsed on several threads: a quick
+// scan of tag depth finds places where a root's children can be split,
+// the pieces are parsed concurrently and the results are joined back in
+// order. if anything about a piece looks off, the input is parsed again
+// on one thread, so the tree and errors are always the same as a plain
+// cnxml_parser_read_document would give.
+
+typedef struct {
+  cnxml_context* ctx;
+  cnxml_element_list* roots;
+  cnxml_parser_error** errors;  // NULL IF NO ERRORS
+  size_t error_count;
+  cnxml_context** contexts;     // ARENAS THE TREE LIVES IN
+  int context_count;
+  cnxml_source* source;         // NULL IF PARSED FROM MEMORY
+} cnxml_document;
+
+// pieces smaller than this aren't worth a thread
+#define CNXML_DOCUMENT_MIN_CHUNK_SIZE (256 * 1024)
+#define CNXML_DOCUMENT_CHUNKS_PER_THREAD 4
+// arena chunks are sized from the input, between these and
+// CNXML_ARENA_DEFAULT_CHUNK_SIZE
+#define CNXML_DOCUMENT_MIN_ARENA_CHUNK_SIZE (4 * 1024)
+#define CNXML_DOCUMENT_ARENA_INPUT_FACTOR 2
+
+// binary trees
+//
+// cnxml_document_save_binary writes a tree as one relocatable blob: the
+// element, child list and attribute records in breadth-first order, with
+// offsets from the start of the blob wherever the tree has pointers,
+// then a string table. cnxml_document_load_binary maps the blob
+// copy-on-write and turns the offsets back into pointers in a single
+// bounds-checked pass over the records, so nothing is parsed or
+// allocated per node and the usual element and attribute functions work
+// on the result. the string table is never written to and stays shared
+// with the page cache.
+//
+// a loaded tree is read-only: freeing parts of it does nothing, and
+// functions that would change it return CNXML_ERROR_BADARGS (or do
+// nothing, for cnxml_element_add_text_content). its names aren't
+// interned, and parser errors aren't saved. a blob only loads into a build with the same
+// struct layout; anything else fails with CNXML_ERROR_FORMAT.
+//
+// the header has room for a caller-defined tag (cnxml_cache keeps the
+// key of the file the tree came from there), which can be checked by
+// reading just the header before loading the whole blob.
+
+#define CNXML_BINARY_MAGIC "CNXMLBIN"
+#define CNXML_BINARY_VERSION 4
+#define CNXML_BINARY_BYTE_ORDER 0x01020304u
+#define CNXML_BINARY_ALIGNMENT 16
+#define CNXML_BINARY_TAG_SIZE 4
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;        // CNXML_BINARY_BYTE_ORDER AS WRITTEN
+  uint16_t pointer_size;
+  uint16_t element_size;
+  uint16_t list_size;
+  uint16_t attribute_size;
+  uint64_t size;              // WHOLE BLOB, HEADER INCLUDED
+  uint64_t lists;             // OFFSETS ARE FROM THE START OF THE BLOB
+  uint64_t list_count;        // THE FIRST LIST HOLDS THE ROOTS
+  uint64_t elements;
+  uint64_t element_count;
+  uint64_t attributes;
+  uint64_t attribute_count;
+  uint64_t strings;
+  uint64_t strings_len;
+  uint64_t tag[CNXML_BINARY_TAG_SIZE]; // FREE FOR THE CALLER, ZEROES IF NOT GIVEN
+} cnxml_binary_header;
+
+/*** DOCUMENT API ***/
+CNXML_EXPORT cnxml_document* CNXML_API cnxml_document_parse(cnxml_context* ctx, const char* data, size_t data_len, int thread_count);
+CNXML_EXPORT cnxml_document* CNXML_API cnxml_document_parse_file(cnxml_context* ctx, const char* path, int thread_count);
+CNXML_EXPORT size_t CNXML_API cnxml_document_root_count(cnxml_document* doc);
+CNXML_EXPORT cnxml_element* CNXML_API cnxml_document_root(cnxml_document* doc, size_t index);
+CNXML_EXPORT cnxml_error CNXML_API cnxml_document_save_binary(cnxml_document* doc, const char* path);
+CNXML_EXPORT cnxml_error CNXML_API cnxml_document_save_binary_tagged(cnxml_document* doc, const char* path, const uint64_t* tag);
+CNXML_EXPORT cnxml_document* CNXML_API cnxml_document_load_binary(cnxml_context* ctx, const char* path);
+CNXML_EXPORT void CNXML_API cnxml_document_free(cnxml_document* doc);
+
+#endif//CNXML_DOCUMENT
@@ -0,0 +1,150 @@
+#include "cnxml_entity.h"
+#include "cnxml_scan.h"
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+  const char* name;
+  size_t len;
+  char value;
+} INTERNAL_cnxml_entity_predefined;
+
+static const INTERNAL_cnxml_entity_predefined INTERNAL_cnxml_entity_names[] = {
+  {"amp", 3, '&'},
+  {"lt", 2, '<'},
+  {"gt", 2, '>'},
+  {"quot", 4, '"'},
+  {"apos", 4, '\''},
+};
+
+static size_t INTERNAL_cnxml_entity_encode_utf8(uint32_t cp, char* out) {
+  if (cp < 0x80) {
+    out[0] = (char)cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    return 2;
+  }
+  if (cp < 0x10000) {
+    out[0] = (char)(0xE0 | (cp >> 12));
+    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (cp & 0x3F));
+    return 3;
+  }
+  out[0] = (char)(0xF0 | (cp >> 18));
+  out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+  out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+  out[3] = (char)(0x80 | (cp & 0x3F));
+  return 4;
+}
+
+// the code point of `#NN` or `#xHH` (the part between '&' and ';'),
+// or 0 if it isn't one a document may contain
+static uint32_t INTERNAL_cnxml_entity_char_ref(const char* ref, size_t len) {
+  size_t i = 1;
+  bool hex = len > 1 && ref[1] == 'x';
+  if (hex) i++;
+  if (i == len) return 0;
+
+  uint32_t cp = 0;
+  for (; i < len; i++) {
+    char c = ref[i];
+    uint32_t digit;
+    if (c >= '0' && c <= '9') digit = c - '0';
+    else if (hex && c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+    else if (hex && c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+    else return 0;
+    cp = cp * (hex ? 16 : 10) + digit;
+    if (cp > 0x10FFFF) return 0;
+  }
+  if (cp >= 0xD800 && cp <= 0xDFFF) return 0;
+  return cp;
+}
+
+// decodes the reference starting with the '&' at data[0] into out,
+// returning how many input bytes it took, or 0 to keep the '&' as is.
+// the output is never longer than the input it replaces
+static size_t INTERNAL_cnxml_entity_decode_reference(const char* data, size_t len, char* out, size_t* out_len) {
+  size_t max = len < CNXML_ENTITY_MAX_REFERENCE_LENGTH ? len : CNXML_ENTITY_MAX_REFERENCE_LENGTH;
+  const char* semi = memchr(data, ';', max);
+  if (semi == NULL) return 0;
+  const char* ref = data + 1;
+  size_t ref_len = semi - ref;
+  if (ref_len == 0) return 0;
+
+  if (ref[0] == '#') {
+    uint32_t cp = INTERNAL_cnxml_entity_char_ref(ref, ref_len);
+    if (cp == 0) return 0;
+    *out_len = INTERNAL_cnxml_entity_encode_utf8(cp, out);
+    return ref_len + 2;
+  }
+
+  for (size_t i = 0; i < sizeof(INTERNAL_cnxml_entity_names) / sizeof(INTERNAL_cnxml_entity_names[0]); i++) {
+    const INTERNAL_cnxml_entity_predefined* entity = &INTERNAL_cnxml_entity_names[i];
+    if (entity->len == ref_len && memcmp(entity->name, ref, ref_len) == 0) {
+      out[0] = entity->value;
+      *out_len = 1;
+      return ref_len + 2;
+    }
+  }
+  return 0;
+}
+
+size_t cnxml_entity_reference_length(const char* data, size_t len) {
+  if (len == 0 || data[0] != '&') return 0;
+  char decoded[4];
+  size_t decoded_len;
+  return INTERNAL_cnxml_entity_decode_reference(data, len, decoded, &decoded_len);
+}
+
+bool cnxml_entity_has_references(cnxml_string str) {
+  return cnxml_scan_char(str.ptr, str.len, '&') < str.len;
+}
+
+size_t cnxml_entity_decode_into(cnxml_string str, char* buffer) {
+  const char* data = str.ptr;
+  size_t len = str.len;
+  size_t pos = 0;
+  size_t out = 0;
+
+  while (pos < len) {
+    // plain text up to the next '&' is moved over in one go. when
+    // decoding in place, out never passes pos so memmove is enough
+    size_t run = cnxml_scan_char(data + pos, len - pos, '&');
+    if (buffer + out != data + pos) memmove(buffer + out, data + pos, run);
+    out += run;
+    pos += run;
+    if (pos == len) break;
+
+    char decoded[4];
+    size_t decoded_len = 0;
+    size_t taken = INTERNAL_cnxml_entity_decode_reference(data + pos, len - pos, decoded, &decoded_len);
+    if (taken == 0) {
+      buffer[out++] = '&';
+      pos++;
+      continue;
+    }
+    memcpy(buffer + out, decoded, decoded_len);
+    out += decoded_len;
+    pos += taken;
+  }
+  return out;
+}
+
+cnxml_string cnxml_entity_decode(cnxml_context* ctx, cnxml_string str) {
+  size_t first = cnxml_scan_char(str.ptr, str.len, '&');
+  if (first == str.len) return str;
+
+  char* buffer = cnxml_context_alloc(ctx, str.len);
+  if (buffer == NULL) return CNXML_STRING_EMPTY;
+  // everything before the first '&' is known to be plain
+  memcpy(buffer, str.ptr, first);
+  size_t len = first + cnxml_entity_decode_into(cnxml_string_newlen(str.ptr + first, str.len - first), buffer + first);
+  return cnxml_string_newlen(buffer, len);
+}
+
+void cnxml_entity_decoded_free(cnxml_context* ctx, cnxml_string str, cnxml_string decoded) {
+  if (decoded.ptr != NULL && decoded.ptr != str.ptr) cnxml_context_dealloc(ctx, decoded.ptr);
+}
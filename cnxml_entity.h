@@ -0,0 +1,37 @@
+#ifndef CNXML_ENTITY
+#define CNXML_ENTITY
+
+#include "cnxml.h"
+
+// entity and character reference decoding, done on demand
+//
+// the parser keeps attribute values and text exactly as they appear in
+// the input, references included. these turn `&amp;`, `&lt;`, `&gt;`,
+// `&quot;`, `&apos;`, `&#NN;` and `&#xHH;` into the text they stand for,
+// one value at a time. a value without any '&' (found with a vectorized
+// scan) is returned as is, so only values that really have references
+// cost a copy. references that are unknown or malformed are kept as
+// they are.
+//
+// decoding never makes a value longer, so str.len bytes is always
+// enough room for the result.
+
+// longest reference that is decoded, `&#x0010FFFF;` and the like
+#define CNXML_ENTITY_MAX_REFERENCE_LENGTH 16
+
+/*** ENTITY API ***/
+// any '&' at all, even one that decoding would keep
+CNXML_EXPORT bool CNXML_API cnxml_entity_has_references(cnxml_string str);
+// length of the reference at data[0] if decoding would replace it,
+// otherwise 0
+CNXML_EXPORT size_t CNXML_API cnxml_entity_reference_length(const char* data, size_t len);
+// buffer needs str.len bytes, and may be str.ptr to decode in place.
+// returns the decoded length
+CNXML_EXPORT size_t CNXML_API cnxml_entity_decode_into(cnxml_string str, char* buffer);
+// str itself if there's nothing to decode, otherwise a copy allocated
+// from ctx, e.g. for an attribute value or cnxml_element_text (empty if
+// that fails). pass both to cnxml_entity_decoded_free when done
+CNXML_EXPORT cnxml_string CNXML_API cnxml_entity_decode(cnxml_context* ctx, cnxml_string str);
+CNXML_EXPORT void CNXML_API cnxml_entity_decoded_free(cnxml_context* ctx, cnxml_string str, cnxml_string decoded);
+
+#endif//CNXML_ENTITY
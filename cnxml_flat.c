@@ -0,0 +1,389 @@
+#include "cnxml_flat.h"
+#include "cnxml_intern.h"
+#include "cnxml_stats.h"
+#include <string.h>
+
+#define CNXML_FLAT_MIN_CAPACITY 16
+
+// an open element, and the last child and text run added to it so far
+typedef struct {
+  uint32_t node;
+  uint32_t last_child;
+  uint32_t last_text_run;
+} INTERNAL_cnxml_flat_frame;
+
+typedef struct {
+  cnxml_parser* parser;
+  cnxml_flat_document* doc;
+  INTERNAL_cnxml_flat_frame* stack;
+  size_t stack_len;
+  size_t stack_capacity;
+  uint32_t last_root;
+  bool failed;                // OUT OF MEMORY
+} INTERNAL_cnxml_flat_builder;
+
+/*** BUILD ***/
+
+// grows one of the document's arrays to hold at least one more item
+static bool INTERNAL_cnxml_flat_reserve(cnxml_context* ctx, void** ptr, uint32_t count, uint32_t* capacity, size_t item_size) {
+  if (count < *capacity) return true;
+  if (*capacity >= CNXML_FLAT_NONE / 2) return false;
+  uint32_t new_capacity = *capacity < CNXML_FLAT_MIN_CAPACITY ? CNXML_FLAT_MIN_CAPACITY : *capacity * 2;
+  void* new_ptr = cnxml_context_realloc(ctx, *ptr, item_size * new_capacity);
+  if (new_ptr == NULL) return false;
+  *ptr = new_ptr;
+  *capacity = new_capacity;
+  return true;
+}
+
+// a guess from the input size, so small and medium inputs never grow.
+// text-heavy inputs would be overestimated badly, hence the cap
+static uint32_t INTERNAL_cnxml_flat_initial_capacity(size_t input_len, size_t bytes_per_item, size_t item_size) {
+  size_t guess = input_len / bytes_per_item;
+  size_t max = CNXML_FLAT_MAX_RESERVE_BYTES / item_size;
+  if (guess > max) guess = max;
+  return guess < CNXML_FLAT_MIN_CAPACITY ? CNXML_FLAT_MIN_CAPACITY : (uint32_t)guess;
+}
+
+static cnxml_string INTERNAL_cnxml_flat_intern(cnxml_context* ctx, cnxml_string name, cnxml_symbol* symbol_out) {
+  *symbol_out = CNXML_SYMBOL_NONE;
+  if (ctx->symbols != NULL && name.len > 0) {
+    *symbol_out = cnxml_intern(ctx->symbols, name);
+    if (*symbol_out != CNXML_SYMBOL_NONE) return cnxml_intern_name(ctx->symbols, *symbol_out);
+  }
+  return name;
+}
+
+// appends a node and links it in as the last child of the innermost
+// open element, or as the last root
+static uint32_t INTERNAL_cnxml_flat_add_node(INTERNAL_cnxml_flat_builder* builder, cnxml_string name) {
+  cnxml_flat_document* doc = builder->doc;
+  if (!INTERNAL_cnxml_flat_reserve(doc->ctx, (void**)&doc->nodes, doc->node_count, &doc->node_capacity, sizeof(cnxml_flat_node))) {
+    builder->failed = true;
+    return CNXML_FLAT_NONE;
+  }
+  uint32_t index = doc->node_count;
+  cnxml_flat_node* node = doc->nodes + index;
+  node->name = INTERNAL_cnxml_flat_intern(doc->ctx, name, &node->name_symbol);
+  node->text = CNXML_STRING_EMPTY;
+  node->first_child = CNXML_FLAT_NONE;
+  node->next_sibling = CNXML_FLAT_NONE;
+  node->subtree_end = index + 1;
+  node->first_attribute = doc->attribute_count;
+  node->attribute_count = 0;
+  node->more_text = CNXML_FLAT_NONE;
+  doc->node_count += 1;
+
+  uint32_t* last;
+  if (builder->stack_len > 0) {
+    INTERNAL_cnxml_flat_frame* frame = builder->stack + builder->stack_len - 1;
+    node->parent = frame->node;
+    if (frame->last_child == CNXML_FLAT_NONE) doc->nodes[frame->node].first_child = index;
+    last = &frame->last_child;
+  } else {
+    node->parent = CNXML_FLAT_NONE;
+    last = &builder->last_root;
+  }
+  if (*last != CNXML_FLAT_NONE) doc->nodes[*last].next_sibling = index;
+  *last = index;
+  CNXML_STATS_RECORD(builder->parser->ctx, stats->elements += 1);
+  return index;
+}
+
+// like cnxml_element_set_attribute, a repeated name replaces the value
+static void INTERNAL_cnxml_flat_add_attribute(INTERNAL_cnxml_flat_builder* builder, uint32_t index, cnxml_string name, cnxml_string value) {
+  cnxml_flat_document* doc = builder->doc;
+  cnxml_flat_node* node = doc->nodes + index;
+  cnxml_symbol symbol;
+  name = INTERNAL_cnxml_flat_intern(doc->ctx, name, &symbol);
+
+  for (uint32_t i = node->first_attribute; i < node->first_attribute + node->attribute_count; i++) {
+    if (cnxml_string_equal(doc->attributes[i].name, name)) {
+      doc->attributes[i].value = value;
+      return;
+    }
+  }
+  if (!INTERNAL_cnxml_flat_reserve(doc->ctx, (void**)&doc->attributes, doc->attribute_count, &doc->attribute_capacity, sizeof(cnxml_attribute))) {
+    builder->failed = true;
+    return;
+  }
+  // a node's attributes are all read before any later node is added
+  doc->attributes[doc->attribute_count] = (cnxml_attribute){name, value, symbol, false};
+  doc->attribute_count += 1;
+  node->attribute_count += 1;
+}
+
+// text only ever goes to the innermost open element
+static void INTERNAL_cnxml_flat_add_text(INTERNAL_cnxml_flat_builder* builder, cnxml_string text) {
+  cnxml_flat_document* doc = builder->doc;
+  INTERNAL_cnxml_flat_frame* frame = builder->stack + builder->stack_len - 1;
+  cnxml_flat_node* node = doc->nodes + frame->node;
+  if (text.len == 0) return;
+  if (node->text.len == 0) {
+    node->text = text;
+    return;
+  }
+
+  if (!INTERNAL_cnxml_flat_reserve(doc->ctx, (void**)&doc->text_runs, doc->text_run_count, &doc->text_run_capacity, sizeof(cnxml_flat_text_run))) {
+    builder->failed = true;
+    return;
+  }
+  uint32_t run = doc->text_run_count;
+  doc->text_runs[run] = (cnxml_flat_text_run){text, CNXML_FLAT_NONE};
+  doc->text_run_count += 1;
+
+  if (frame->last_text_run == CNXML_FLAT_NONE) node->more_text = run;
+  else doc->text_runs[frame->last_text_run].next = run;
+  frame->last_text_run = run;
+}
+
+static bool INTERNAL_cnxml_flat_push(INTERNAL_cnxml_flat_builder* builder, uint32_t index) {
+  if (builder->stack_len == builder->stack_capacity) {
+    size_t new_capacity = builder->stack_capacity == 0 ? CNXML_PARSER_STACK_INITIAL_CAPACITY : builder->stack_capacity * 2;
+    INTERNAL_cnxml_flat_frame* new_stack = cnxml_context_realloc(builder->doc->ctx, builder->stack, sizeof(INTERNAL_cnxml_flat_frame) * new_capacity);
+    if (new_stack == NULL) {
+      builder->failed = true;
+      return false;
+    }
+    builder->stack = new_stack;
+    builder->stack_capacity = new_capacity;
+  }
+  builder->stack[builder->stack_len] = (INTERNAL_cnxml_flat_frame){index, CNXML_FLAT_NONE, CNXML_FLAT_NONE};
+  builder->stack_len += 1;
+  CNXML_STATS_RECORD(builder->parser->ctx, if (builder->stack_len > stats->max_depth) stats->max_depth = builder->stack_len);
+  return true;
+}
+
+// everything added since index was opened is its subtree
+static void INTERNAL_cnxml_flat_pop(INTERNAL_cnxml_flat_builder* builder) {
+  builder->stack_len -= 1;
+  builder->doc->nodes[builder->stack[builder->stack_len].node].subtree_end = builder->doc->node_count;
+}
+
+static void INTERNAL_cnxml_flat_read_attribute(INTERNAL_cnxml_flat_builder* builder, uint32_t index, cnxml_string name) {
+  cnxml_parser* parser = builder->parser;
+  cnxml_token tok = cnxml_tokenizer_next_token(parser->tokenizer);
+  if (tok.type == CNXML_TOKEN_EQUAL) {
+    tok = cnxml_tokenizer_next_token(parser->tokenizer);
+    if (tok.type == CNXML_TOKEN_STRING) {
+      INTERNAL_cnxml_flat_add_attribute(builder, index, name, tok.content);
+      CNXML_STATS_RECORD(parser->ctx, stats->attributes += 1);
+    } else {
+      cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MISSING_ATTRIBUTE_VALUE, name, CNXML_STRING_EMPTY);
+    }
+  } else {
+    cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MISSING_EQUALS_SIGN, name, CNXML_STRING_EMPTY);
+  }
+}
+
+// the flat version of the parser's read_start_tag. returns the new node
+// and whether it has content to read
+static bool INTERNAL_cnxml_flat_read_start_tag(INTERNAL_cnxml_flat_builder* builder, bool skip_opening_tag, uint32_t* index_out) {
+  cnxml_parser* parser = builder->parser;
+  cnxml_token tok;
+  if (!skip_opening_tag) {
+    tok = cnxml_tokenizer_next_token(parser->tokenizer);
+    if (tok.type != CNXML_TOKEN_OPENLESS) {
+      cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_NO_OPENING_SYMBOL_FOUND, CNXML_STRING_EMPTY, CNXML_STRING_EMPTY);
+    }
+  }
+  tok = cnxml_tokenizer_next_token(parser->tokenizer);
+  if (tok.type != CNXML_TOKEN_STRING) {
+    cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MISSING_ELEMENT_NAME, CNXML_STRING_EMPTY, CNXML_STRING_EMPTY);
+  }
+
+  uint32_t index = INTERNAL_cnxml_flat_add_node(builder, tok.content);
+  *index_out = index;
+  if (index == CNXML_FLAT_NONE) return false;
+
+  while (!builder->failed) {
+    tok = cnxml_tokenizer_next_token(parser->tokenizer);
+    switch (tok.type) {
+    case CNXML_TOKEN_EOF:
+      return false;
+    case CNXML_TOKEN_SLASH:
+      if (cnxml_tokenizer_cur_char(parser->tokenizer) == '>') {
+        cnxml_tokenizer_move(parser->tokenizer, 1);
+        return false;
+      }
+      return true;
+    case CNXML_TOKEN_CLOSEGREATER:
+      return true;
+    case CNXML_TOKEN_STRING:
+      INTERNAL_cnxml_flat_read_attribute(builder, index, tok.content);
+      break;
+    default:
+      break;
+    }
+  }
+  return false;
+}
+
+// the flat version of the parser's read_content
+static void INTERNAL_cnxml_flat_read_content(INTERNAL_cnxml_flat_builder* builder) {
+  cnxml_parser* parser = builder->parser;
+  cnxml_tokenizer* tokenizer = parser->tokenizer;
+  while (builder->stack_len > 0 && !builder->failed) {
+    uint32_t index = builder->stack[builder->stack_len - 1].node;
+
+    cnxml_tokenizer_skip_whitespace(tokenizer);
+    if (!cnxml_tokenizer_is_eof(tokenizer) && cnxml_tokenizer_cur_char(tokenizer) != '<') {
+      INTERNAL_cnxml_flat_add_text(builder, cnxml_tokenizer_read_text(tokenizer));
+      continue;
+    }
+
+    cnxml_token tok = cnxml_tokenizer_next_token(tokenizer);
+    switch (tok.type) {
+    case CNXML_TOKEN_EOF:
+      return;
+    case CNXML_TOKEN_OPENLESS:
+      if (cnxml_tokenizer_cur_char(tokenizer) == '/') {
+        cnxml_tokenizer_move(tokenizer, 1);
+
+        cnxml_string name = builder->doc->nodes[index].name;
+        cnxml_token end_name = cnxml_tokenizer_next_token(tokenizer);
+        if (end_name.type == CNXML_TOKEN_STRING && cnxml_string_equal(end_name.content, name)) {
+          cnxml_token close_greater = cnxml_tokenizer_next_token(tokenizer);
+          if (close_greater.type != CNXML_TOKEN_CLOSEGREATER) {
+            cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_NO_CLOSING_SYMBOL_FOUND, end_name.content, CNXML_STRING_EMPTY);
+          }
+        } else {
+          cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MISMATCHED_CLOSING_TAG, name, end_name.content);
+        }
+        INTERNAL_cnxml_flat_pop(builder);
+      } else {
+        if (parser->max_depth > 0 && builder->stack_len >= parser->max_depth) {
+          cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MAX_DEPTH_EXCEEDED, builder->doc->nodes[index].name, CNXML_STRING_EMPTY);
+          return;
+        }
+        uint32_t child;
+        if (INTERNAL_cnxml_flat_read_start_tag(builder, true, &child)) {
+          if (!INTERNAL_cnxml_flat_push(builder, child)) return;
+        }
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+cnxml_flat_document* cnxml_flat_parse(cnxml_parser* parser) {
+  if (parser == NULL) {
+    return (cnxml_flat_document*)CNXML_ERROR_BADARGS;
+  }
+  cnxml_context* ctx = parser->ctx;
+  cnxml_tokenizer* tokenizer = parser->tokenizer;
+#ifdef CNXML_ENABLE_STATS
+  double start = ctx->stats != NULL ? cnxml_stats_now() : 0;
+  size_t start_index = tokenizer->current_index;
+#endif
+
+  cnxml_flat_document* doc = cnxml_context_alloc(ctx, sizeof(cnxml_flat_document));
+  if (doc == NULL) {
+    return (cnxml_flat_document*)CNXML_ERROR_ALLOCFAIL;
+  }
+  memset(doc, 0, sizeof(cnxml_flat_document));
+  doc->ctx = ctx;
+
+  size_t remaining = tokenizer->data_len - tokenizer->current_index;
+  doc->node_capacity = INTERNAL_cnxml_flat_initial_capacity(remaining, CNXML_FLAT_BYTES_PER_NODE, sizeof(cnxml_flat_node));
+  doc->attribute_capacity = INTERNAL_cnxml_flat_initial_capacity(remaining, CNXML_FLAT_BYTES_PER_ATTRIBUTE, sizeof(cnxml_attribute));
+  doc->nodes = cnxml_context_alloc(ctx, sizeof(cnxml_flat_node) * doc->node_capacity);
+  doc->attributes = cnxml_context_alloc(ctx, sizeof(cnxml_attribute) * doc->attribute_capacity);
+  if (doc->nodes == NULL || doc->attributes == NULL) {
+    cnxml_flat_free(doc);
+    return (cnxml_flat_document*)CNXML_ERROR_ALLOCFAIL;
+  }
+
+  INTERNAL_cnxml_flat_builder builder = {parser, doc, NULL, 0, 0, CNXML_FLAT_NONE, false};
+  while (!builder.failed) {
+    cnxml_tokenizer_skip_whitespace(tokenizer);
+    if (cnxml_tokenizer_is_eof(tokenizer)) break;
+
+    if (cnxml_tokenizer_cur_char(tokenizer) != '<') {
+      cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_NO_OPENING_SYMBOL_FOUND, CNXML_STRING_EMPTY, CNXML_STRING_EMPTY);
+      cnxml_tokenizer_read_text(tokenizer);
+      continue;
+    }
+    if (cnxml_tokenizer_peek(tokenizer, 1) == '/') {
+      // an end tag with nothing open
+      cnxml_tokenizer_move(tokenizer, 2);
+      cnxml_token end_name = cnxml_tokenizer_next_token(tokenizer);
+      cnxml_parser_report_error(parser, CNXML_PARSER_ERROR_MISMATCHED_CLOSING_TAG, end_name.content, CNXML_STRING_EMPTY);
+      if (cnxml_tokenizer_next_token(tokenizer).type == CNXML_TOKEN_EOF) break;
+      continue;
+    }
+
+    uint32_t root;
+    if (INTERNAL_cnxml_flat_read_start_tag(&builder, false, &root) && INTERNAL_cnxml_flat_push(&builder, root)) {
+      INTERNAL_cnxml_flat_read_content(&builder);
+    }
+    // elements still open when the input ended hold everything after them
+    if (builder.stack_len > 0) {
+      while (builder.stack_len > 0) INTERNAL_cnxml_flat_pop(&builder);
+      break;
+    }
+  }
+
+  if (builder.stack != NULL) cnxml_context_dealloc(ctx, builder.stack);
+  CNXML_STATS_RECORD(ctx, stats->parse_seconds += cnxml_stats_now() - start; stats->bytes += tokenizer->current_index - start_index);
+  if (builder.failed) {
+    cnxml_flat_free(doc);
+    return (cnxml_flat_document*)CNXML_ERROR_ALLOCFAIL;
+  }
+  return doc;
+}
+
+/*** ACCESS ***/
+
+int cnxml_flat_get_attribute(cnxml_flat_document* doc, uint32_t node, cnxml_string name, cnxml_string* value_out) {
+  if (node < doc->node_count) {
+    cnxml_flat_node* n = doc->nodes + node;
+    for (uint32_t i = n->first_attribute; i < n->first_attribute + n->attribute_count; i++) {
+      if (cnxml_string_equal(doc->attributes[i].name, name)) {
+        if (value_out != NULL) *value_out = doc->attributes[i].value;
+        return CNXML_MAP_OK;
+      }
+    }
+  }
+  if (value_out != NULL) *value_out = CNXML_STRING_EMPTY;
+  return CNXML_MAP_MISSING;
+}
+
+size_t cnxml_flat_text_length(cnxml_flat_document* doc, uint32_t node) {
+  size_t len = doc->nodes[node].text.len;
+  for (uint32_t run = doc->nodes[node].more_text; run != CNXML_FLAT_NONE; run = doc->text_runs[run].next) {
+    len += 1 + doc->text_runs[run].text.len;
+  }
+  return len;
+}
+
+// joins the text into buffer, truncating at buffer_len. returns the
+// full joined length like snprintf. no terminator is written
+size_t cnxml_flat_text_copy(cnxml_flat_document* doc, uint32_t node, char* buffer, size_t buffer_len) {
+  size_t offs = 0;
+  cnxml_string span = doc->nodes[node].text;
+  uint32_t run = doc->nodes[node].more_text;
+  while (true) {
+    if (offs < buffer_len) {
+      size_t n = span.len < buffer_len - offs ? span.len : buffer_len - offs;
+      memcpy(buffer + offs, span.ptr, n);
+    }
+    offs += span.len;
+    if (run == CNXML_FLAT_NONE) break;
+    if (offs < buffer_len) buffer[offs] = ' ';
+    offs += 1;
+    span = doc->text_runs[run].text;
+    run = doc->text_runs[run].next;
+  }
+  return offs;
+}
+
+void cnxml_flat_free(cnxml_flat_document* doc) {
+  cnxml_context* ctx = doc->ctx;
+  if (doc->nodes != NULL) cnxml_context_dealloc(ctx, doc->nodes);
+  if (doc->attributes != NULL) cnxml_context_dealloc(ctx, doc->attributes);
+  if (doc->text_runs != NULL) cnxml_context_dealloc(ctx, doc->text_runs);
+  cnxml_context_dealloc(ctx, doc);
+}
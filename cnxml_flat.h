@@ -0,0 +1,68 @@
+#ifndef CNXML_FLAT
+#define CNXML_FLAT
+
+#include <stdint.h>
+#include "cnxml.h"
+
+// flat documents: every element in one array, in document order
+//
+// an alternative to cnxml_element trees for read-mostly use. nodes are
+// linked by index instead of pointer, attributes of all nodes live in
+// one parallel array, and a node's descendants are exactly the nodes
+// after it up to subtree_end. walking the whole document is a loop over
+// the array, skipping a subtree is `i = nodes[i].subtree_end`, and
+// freeing is three frees no matter how many nodes there are.
+//
+// strings point into the parser's input like they do for trees, so the
+// input has to outlive the document. text is kept as zero-copy runs:
+// the first in text, any further ones chained from more_text.
+
+#define CNXML_FLAT_NONE UINT32_MAX
+// room reserved up front, per byte of input, but no more than
+// CNXML_FLAT_MAX_RESERVE_BYTES per array. big inputs grow from there
+#define CNXML_FLAT_BYTES_PER_NODE 64
+#define CNXML_FLAT_BYTES_PER_ATTRIBUTE 32
+#define CNXML_FLAT_MAX_RESERVE_BYTES (4 * 1024 * 1024)
+
+typedef struct {
+  cnxml_string name;
+  cnxml_string text;          // FIRST TEXT RUN
+  cnxml_symbol name_symbol;   // CNXML_SYMBOL_NONE IF NOT INTERNED
+  uint32_t parent;            // CNXML_FLAT_NONE FOR ROOTS
+  uint32_t first_child;       // CNXML_FLAT_NONE IF NO CHILDREN
+  uint32_t next_sibling;      // CNXML_FLAT_NONE FOR THE LAST ONE
+  uint32_t subtree_end;       // ONE PAST THE LAST DESCENDANT
+  uint32_t first_attribute;   // INTO attributes
+  uint32_t attribute_count;
+  uint32_t more_text;         // INTO text_runs, CNXML_FLAT_NONE IF ONE RUN
+} cnxml_flat_node;
+
+typedef struct {
+  cnxml_string text;
+  uint32_t next;              // CNXML_FLAT_NONE FOR THE LAST ONE
+} cnxml_flat_text_run;
+
+typedef struct {
+  cnxml_context* ctx;
+  cnxml_flat_node* nodes;     // ROOTS ARE LINKED FROM nodes[0]
+  uint32_t node_count;
+  uint32_t node_capacity;
+  cnxml_attribute* attributes;
+  uint32_t attribute_count;
+  uint32_t attribute_capacity;
+  cnxml_flat_text_run* text_runs;
+  uint32_t text_run_count;
+  uint32_t text_run_capacity;
+} cnxml_flat_document;
+
+/*** FLAT API ***/
+// reads every top-level element until the input ends, like
+// cnxml_parser_read_document, reporting errors to the parser
+CNXML_EXPORT cnxml_flat_document* CNXML_API cnxml_flat_parse(cnxml_parser* parser);
+CNXML_EXPORT int CNXML_API cnxml_flat_get_attribute(cnxml_flat_document* doc, uint32_t node, cnxml_string name, cnxml_string* value_out);
+// text runs joined by single spaces, as for cnxml_element_text_copy
+CNXML_EXPORT size_t CNXML_API cnxml_flat_text_length(cnxml_flat_document* doc, uint32_t node);
+CNXML_EXPORT size_t CNXML_API cnxml_flat_text_copy(cnxml_flat_document* doc, uint32_t node, char* buffer, size_t buffer_len);
+CNXML_EXPORT void CNXML_API cnxml_flat_free(cnxml_flat_document* doc);
+
+#endif//CNXML_FLAT
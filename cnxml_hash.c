@@ -0,0 +1,185 @@
+#include "cnxml_hash.h"
+#include "cnxml_thread.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+  #define CNXML_HASH_X86
+  #ifdef _MSC_VER
+    #include <intrin.h>
+    #include <nmmintrin.h>
+    #define CNXML_HASH_TARGET_SSE42
+  #else
+    #include <nmmintrin.h>
+    #define CNXML_HASH_TARGET_SSE42 __attribute__((target("sse4.2")))
+  #endif
+#endif
+
+static const uint64_t INTERNAL_cnxml_hash_secret[4] = {
+  0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+static inline uint64_t INTERNAL_cnxml_hash_read8(const unsigned char* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t INTERNAL_cnxml_hash_read4(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// 64x64 -> 128 bit multiply, folded back to 64 bits
+static inline uint64_t INTERNAL_cnxml_hash_mix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  uint64_t hi;
+  uint64_t lo = _umul128(a, b, &hi);
+  return lo ^ hi;
+#else
+  uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  return lo ^ hi;
+#endif
+}
+
+/*** PORTABLE ***/
+
+// wyhash, minus the wide loop for long inputs since names are short
+static uint32_t INTERNAL_cnxml_hash_portable(const char* data, size_t len, uint64_t seed) {
+  const unsigned char* p = (const unsigned char*)data;
+  const uint64_t* s = INTERNAL_cnxml_hash_secret;
+  uint64_t a, b;
+
+  seed ^= INTERNAL_cnxml_hash_mix(seed ^ s[0], s[1]);
+  if (len <= 16) {
+    if (len >= 4) {
+      // two overlapping reads from each end cover everything up to 16
+      size_t mid = (len >> 3) << 2;
+      a = (INTERNAL_cnxml_hash_read4(p) << 32) | INTERNAL_cnxml_hash_read4(p + mid);
+      b = (INTERNAL_cnxml_hash_read4(p + len - 4) << 32) | INTERNAL_cnxml_hash_read4(p + len - 4 - mid);
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    while (i > 16) {
+      seed = INTERNAL_cnxml_hash_mix(INTERNAL_cnxml_hash_read8(p) ^ s[1], INTERNAL_cnxml_hash_read8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = INTERNAL_cnxml_hash_read8(p + i - 16);
+    b = INTERNAL_cnxml_hash_read8(p + i - 8);
+  }
+
+  a ^= s[1];
+  b ^= seed;
+  uint64_t lo = a * b;
+  uint64_t hi = INTERNAL_cnxml_hash_mix(a, b) ^ lo;
+  uint64_t h = INTERNAL_cnxml_hash_mix(lo ^ s[0] ^ len, hi ^ s[1]);
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+/*** CRC32C ***/
+
+#ifdef CNXML_HASH_X86
+
+CNXML_HASH_TARGET_SSE42
+static uint32_t INTERNAL_cnxml_hash_crc32c(const char* data, size_t len, uint64_t seed) {
+  const unsigned char* p = (const unsigned char*)data;
+  // crc is linear, so two keys that collide would collide under every
+  // starting value. multiplying each word by a seed dependent odd number
+  // first makes the collisions depend on the seed too
+  uint64_t k = (seed * 2 + 1) * INTERNAL_cnxml_hash_secret[0] | 1;
+  uint64_t crc = (uint32_t)(seed ^ (seed >> 32) ^ len);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    crc = _mm_crc32_u64(crc, INTERNAL_cnxml_hash_read8(p + i) * k);
+  }
+  if (i < len) {
+    // the last 1-7 bytes, read as overlapping words so it's all loads
+    uint64_t tail;
+    if (len >= 8) {
+      tail = INTERNAL_cnxml_hash_read8(p + len - 8);
+    } else if (len >= 4) {
+      tail = (INTERNAL_cnxml_hash_read4(p) << 32) | INTERNAL_cnxml_hash_read4(p + len - 4);
+    } else {
+      tail = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+    }
+    crc = _mm_crc32_u64(crc, tail * k);
+  }
+
+  // spread it out before anyone masks the low bits
+  uint32_t h = (uint32_t)crc;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+static bool INTERNAL_cnxml_hash_cpu_has_sse42(void) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 20)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#endif
+
+/*** DISPATCH ***/
+
+typedef uint32_t INTERNAL_cnxml_hash_func(const char* data, size_t len, uint64_t seed);
+
+// racing initializations all store the same pointer, so an atomic
+// load and store are enough, no lock
+static void* volatile INTERNAL_cnxml_hash_active = NULL;
+
+static INTERNAL_cnxml_hash_func* INTERNAL_cnxml_hash_get(void) {
+  INTERNAL_cnxml_hash_func* func = (INTERNAL_cnxml_hash_func*)cnxml_atomic_load_ptr(&INTERNAL_cnxml_hash_active);
+  if (func != NULL) return func;
+#ifdef CNXML_HASH_X86
+  func = INTERNAL_cnxml_hash_cpu_has_sse42() ? INTERNAL_cnxml_hash_crc32c : INTERNAL_cnxml_hash_portable;
+#else
+  func = INTERNAL_cnxml_hash_portable;
+#endif
+  cnxml_atomic_store_ptr(&INTERNAL_cnxml_hash_active, (void*)func);
+  return func;
+}
+
+uint32_t cnxml_hash_bytes(const char* data, size_t len, uint64_t seed) {
+  return INTERNAL_cnxml_hash_get()(data, len, seed);
+}
+
+cnxml_hash_impl cnxml_hash_get_impl(void) {
+#ifdef CNXML_HASH_X86
+  if (INTERNAL_cnxml_hash_get() == INTERNAL_cnxml_hash_crc32c) return CNXML_HASH_IMPL_CRC32C;
+#endif
+  return CNXML_HASH_IMPL_PORTABLE;
+}
+
+uint32_t cnxml_hash_bytes_with(cnxml_hash_impl impl, const char* data, size_t len, uint64_t seed) {
+#ifdef CNXML_HASH_X86
+  // crc32c only ever gets picked on cpus that have it
+  if (impl == CNXML_HASH_IMPL_CRC32C && INTERNAL_cnxml_hash_get() == INTERNAL_cnxml_hash_crc32c) {
+    return INTERNAL_cnxml_hash_crc32c(data, len, seed);
+  }
+#endif
+  return INTERNAL_cnxml_hash_portable(data, len, seed);
+}
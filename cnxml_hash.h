@@ -0,0 +1,28 @@
+#ifndef CNXML_HASH
+#define CNXML_HASH
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cnxml_common.h"
+
+// hashing for short keys like element and attribute names
+//
+// on x86 cpus with SSE4.2 the crc32 instruction does 8 bytes at a time,
+// everywhere else a wyhash style multiply-mix is used. both finish with
+// a mix so every bit of the result is usable, tables can just mask off
+// the low bits. the implementation is picked once per process, so
+// hashes are only comparable within one run.
+
+typedef enum {
+  CNXML_HASH_IMPL_PORTABLE,
+  CNXML_HASH_IMPL_CRC32C
+} cnxml_hash_impl;
+
+/*** HASH API ***/
+CNXML_EXPORT uint32_t CNXML_API cnxml_hash_bytes(const char* data, size_t len, uint64_t seed);
+CNXML_EXPORT cnxml_hash_impl CNXML_API cnxml_hash_get_impl(void);
+// hashes with a specific implementation, mostly for benchmarking. falls
+// back to the portable one if the cpu doesn't support impl
+CNXML_EXPORT uint32_t CNXML_API cnxml_hash_bytes_with(cnxml_hash_impl impl, const char* data, size_t len, uint64_t seed);
+
+#endif//CNXML_HASH
@@ -53,7 +53,8 @@ CNXML_EXPORT extern cnxml_map cnxml_hashmap_new(cnxml_context* ctx);
 CNXML_EXPORT extern int cnxml_hashmap_iterate(cnxml_map in, cnxml_hashmap_iter_func f, cnxml_any item);
 
 /*
- * Add an element to the hashmap. Return CNXML_MAP_OK or CNXML_MAP_OMEM.
+ * Add an element to the hashmap, replacing the value if the key is
+ * already there. Return CNXML_MAP_OK or CNXML_MAP_OMEM.
  */
 CNXML_EXPORT extern int cnxml_hashmap_put(cnxml_map in, cnxml_string key, cnxml_any value);
 
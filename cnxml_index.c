@@ -0,0 +1,282 @@
+#include "cnxml_index.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CNXML_INDEX_INITIAL_CAPACITY 64
+
+// the tree is walked once, appending a (bucket, element) entry for every
+// name and attribute value seen. once the bucket sizes are known the
+// entries are scattered into one array, so each bucket's elements end up
+// contiguous and in document order
+typedef struct {
+  size_t bucket;
+  cnxml_element* elem;
+} INTERNAL_cnxml_index_entry;
+
+typedef struct {
+  cnxml_element_list* children;
+  size_t next_child;
+} INTERNAL_cnxml_index_frame;
+
+typedef struct {
+  cnxml_index* index;
+  const cnxml_string* attribute_names;
+  int attribute_name_count;
+  INTERNAL_cnxml_index_entry* entries;
+  size_t entry_count;
+  size_t entry_capacity;
+  size_t bucket_capacity;
+  INTERNAL_cnxml_index_frame* frames;
+  size_t frame_count;
+  size_t frame_capacity;
+  INTERNAL_cnxml_index_frame inline_frames[CNXML_INDEX_WALK_INLINE_DEPTH];
+} INTERNAL_cnxml_index_builder;
+
+#define INTERNAL_CNXML_INDEX_BUCKET(any) ((size_t)(uintptr_t)(any) - 1)
+#define INTERNAL_CNXML_INDEX_ANY(bucket) ((cnxml_any)(uintptr_t)((bucket) + 1))
+
+/*** BUILD ***/
+
+static bool INTERNAL_cnxml_index_new_bucket(INTERNAL_cnxml_index_builder* builder, size_t* bucket_out) {
+  cnxml_index* index = builder->index;
+  if (index->bucket_count == builder->bucket_capacity) {
+    size_t new_capacity = builder->bucket_capacity == 0 ? CNXML_INDEX_INITIAL_CAPACITY : builder->bucket_capacity * 2;
+    cnxml_index_bucket* new_buckets = cnxml_context_realloc(index->ctx, index->buckets, sizeof(cnxml_index_bucket) * new_capacity);
+    if (new_buckets == NULL) return false;
+    index->buckets = new_buckets;
+    builder->bucket_capacity = new_capacity;
+  }
+  index->buckets[index->bucket_count] = (cnxml_index_bucket){0, 0};
+  *bucket_out = index->bucket_count;
+  index->bucket_count += 1;
+  return true;
+}
+
+// finds key's bucket in map, adding one if it's new
+static bool INTERNAL_cnxml_index_bucket_for(INTERNAL_cnxml_index_builder* builder, cnxml_map map, cnxml_string key, size_t* bucket_out) {
+  cnxml_any found;
+  if (cnxml_hashmap_get(map, key, &found) == CNXML_MAP_OK) {
+    *bucket_out = INTERNAL_CNXML_INDEX_BUCKET(found);
+    return true;
+  }
+  if (!INTERNAL_cnxml_index_new_bucket(builder, bucket_out)) return false;
+  return cnxml_hashmap_put(map, key, INTERNAL_CNXML_INDEX_ANY(*bucket_out)) == CNXML_MAP_OK;
+}
+
+static bool INTERNAL_cnxml_index_add(INTERNAL_cnxml_index_builder* builder, size_t bucket, cnxml_element* elem) {
+  if (builder->entry_count == builder->entry_capacity) {
+    size_t new_capacity = builder->entry_capacity == 0 ? CNXML_INDEX_INITIAL_CAPACITY : builder->entry_capacity * 2;
+    INTERNAL_cnxml_index_entry* new_entries = cnxml_context_realloc(builder->index->ctx, builder->entries,
+      sizeof(INTERNAL_cnxml_index_entry) * new_capacity);
+    if (new_entries == NULL) return false;
+    builder->entries = new_entries;
+    builder->entry_capacity = new_capacity;
+  }
+  builder->entries[builder->entry_count] = (INTERNAL_cnxml_index_entry){bucket, elem};
+  builder->entry_count += 1;
+  builder->index->buckets[bucket].len += 1;
+  return true;
+}
+
+static bool INTERNAL_cnxml_index_wants_attribute(INTERNAL_cnxml_index_builder* builder, cnxml_string name) {
+  if (builder->attribute_names == NULL) return true;
+  for (int i = 0; i < builder->attribute_name_count; i++) {
+    if (cnxml_string_equal(builder->attribute_names[i], name)) return true;
+  }
+  return false;
+}
+
+static bool INTERNAL_cnxml_index_element(INTERNAL_cnxml_index_builder* builder, cnxml_element* elem) {
+  cnxml_index* index = builder->index;
+  size_t bucket;
+
+  if (index->names != NULL) {
+    if (!INTERNAL_cnxml_index_bucket_for(builder, index->names, elem->name, &bucket)) return false;
+    if (!INTERNAL_cnxml_index_add(builder, bucket, elem)) return false;
+  }
+
+  if (index->attributes != NULL) {
+    for (size_t i = 0; i < elem->attributes.len; i++) {
+      cnxml_attribute* attr = elem->attributes.ptr + i;
+      if (!INTERNAL_cnxml_index_wants_attribute(builder, attr->name)) continue;
+
+      cnxml_map values;
+      if (cnxml_hashmap_get(index->attributes, attr->name, &values) != CNXML_MAP_OK) {
+        values = cnxml_hashmap_new(index->ctx);
+        if (values == NULL) return false;
+        if (cnxml_hashmap_put(index->attributes, attr->name, values) != CNXML_MAP_OK) {
+          cnxml_hashmap_free(values);
+          return false;
+        }
+      }
+      if (!INTERNAL_cnxml_index_bucket_for(builder, values, attr->value, &bucket)) return false;
+      if (!INTERNAL_cnxml_index_add(builder, bucket, elem)) return false;
+    }
+  }
+  return true;
+}
+
+static bool INTERNAL_cnxml_index_push(INTERNAL_cnxml_index_builder* builder, cnxml_element_list* children) {
+  if (builder->frame_count == builder->frame_capacity) {
+    cnxml_context* ctx = builder->index->ctx;
+    size_t new_capacity = builder->frame_capacity * 2;
+    INTERNAL_cnxml_index_frame* new_frames;
+    if (builder->frames == builder->inline_frames) {
+      new_frames = cnxml_context_alloc(ctx, sizeof(INTERNAL_cnxml_index_frame) * new_capacity);
+      if (new_frames != NULL) memcpy(new_frames, builder->inline_frames, sizeof(builder->inline_frames));
+    } else {
+      new_frames = cnxml_context_realloc(ctx, builder->frames, sizeof(INTERNAL_cnxml_index_frame) * new_capacity);
+    }
+    if (new_frames == NULL) return false;
+    builder->frames = new_frames;
+    builder->frame_capacity = new_capacity;
+  }
+  builder->frames[builder->frame_count] = (INTERNAL_cnxml_index_frame){children, 0};
+  builder->frame_count += 1;
+  return true;
+}
+
+// preorder, so entries are appended in document order
+static bool INTERNAL_cnxml_index_walk(INTERNAL_cnxml_index_builder* builder, cnxml_element_list* roots) {
+  if (!INTERNAL_cnxml_index_push(builder, roots)) return false;
+  while (builder->frame_count > 0) {
+    INTERNAL_cnxml_index_frame* frame = builder->frames + builder->frame_count - 1;
+    if (frame->next_child >= frame->children->len) {
+      builder->frame_count -= 1;
+      continue;
+    }
+    cnxml_element* elem = frame->children->ptr + frame->next_child;
+    frame->next_child += 1;
+
+    if (!INTERNAL_cnxml_index_element(builder, elem)) return false;
+    if (elem->children != NULL && elem->children->len > 0) {
+      if (!INTERNAL_cnxml_index_push(builder, elem->children)) return false;
+    }
+  }
+  return true;
+}
+
+// turns bucket sizes into offsets and scatters the entries into place
+static bool INTERNAL_cnxml_index_finish(INTERNAL_cnxml_index_builder* builder) {
+  cnxml_index* index = builder->index;
+  if (builder->entry_count == 0) return true;
+  index->elements = cnxml_context_alloc(index->ctx, sizeof(cnxml_element*) * builder->entry_count);
+  if (index->elements == NULL) return false;
+  index->element_count = builder->entry_count;
+
+  size_t start = 0;
+  for (size_t i = 0; i < index->bucket_count; i++) {
+    index->buckets[i].start = start;
+    start += index->buckets[i].len;
+    index->buckets[i].len = 0;
+  }
+  for (size_t i = 0; i < builder->entry_count; i++) {
+    cnxml_index_bucket* bucket = index->buckets + builder->entries[i].bucket;
+    index->elements[bucket->start + bucket->len] = builder->entries[i].elem;
+    bucket->len += 1;
+  }
+  return true;
+}
+
+cnxml_index* cnxml_index_new_list(cnxml_context* ctx, cnxml_element_list* roots, int flags,
+  const cnxml_string* attribute_names, int attribute_name_count) {
+  if (ctx == NULL || roots == NULL || (attribute_names == NULL && attribute_name_count != 0)) {
+    return (cnxml_index*)CNXML_ERROR_BADARGS;
+  }
+
+  cnxml_index* index = cnxml_context_alloc(ctx, sizeof(cnxml_index));
+  if (index == NULL) {
+    return (cnxml_index*)CNXML_ERROR_ALLOCFAIL;
+  }
+  memset(index, 0, sizeof(cnxml_index));
+  index->ctx = ctx;
+  index->flags = flags;
+
+  bool ok = true;
+  if (flags & CNXML_INDEX_NAMES) {
+    index->names = cnxml_hashmap_new(ctx);
+    ok = index->names != NULL;
+  }
+  if (ok && (flags & CNXML_INDEX_ATTRIBUTES)) {
+    index->attributes = cnxml_hashmap_new(ctx);
+    ok = index->attributes != NULL;
+  }
+  if (!ok) {
+    cnxml_index_free(index);
+    return (cnxml_index*)CNXML_ERROR_ALLOCFAIL;
+  }
+  if (index->names == NULL && index->attributes == NULL) return index;
+
+  INTERNAL_cnxml_index_builder builder;
+  memset(&builder, 0, offsetof(INTERNAL_cnxml_index_builder, inline_frames));
+  builder.index = index;
+  builder.attribute_names = attribute_names;
+  builder.attribute_name_count = attribute_name_count;
+  builder.frames = builder.inline_frames;
+  builder.frame_capacity = CNXML_INDEX_WALK_INLINE_DEPTH;
+
+  ok = INTERNAL_cnxml_index_walk(&builder, roots) && INTERNAL_cnxml_index_finish(&builder);
+
+  if (builder.frames != builder.inline_frames) cnxml_context_dealloc(ctx, builder.frames);
+  if (builder.entries != NULL) cnxml_context_dealloc(ctx, builder.entries);
+  if (!ok) {
+    cnxml_index_free(index);
+    return (cnxml_index*)CNXML_ERROR_ALLOCFAIL;
+  }
+  return index;
+}
+
+cnxml_index* cnxml_index_new(cnxml_context* ctx, cnxml_element* root, int flags,
+  const cnxml_string* attribute_names, int attribute_name_count) {
+  if (root == NULL) {
+    return (cnxml_index*)CNXML_ERROR_BADARGS;
+  }
+  // the list is only read during the build, so it can live here
+  cnxml_element_list roots = {root->ctx, root, 1, 1};
+  return cnxml_index_new_list(ctx, &roots, flags, attribute_names, attribute_name_count);
+}
+
+/*** LOOKUP ***/
+
+static cnxml_index_list INTERNAL_cnxml_index_lookup(const cnxml_index* index, cnxml_map map, cnxml_string key) {
+  cnxml_any found;
+  if (map == NULL || cnxml_hashmap_get(map, key, &found) != CNXML_MAP_OK) {
+    return (cnxml_index_list){NULL, 0};
+  }
+  cnxml_index_bucket* bucket = index->buckets + INTERNAL_CNXML_INDEX_BUCKET(found);
+  return (cnxml_index_list){index->elements + bucket->start, bucket->len};
+}
+
+cnxml_index_list cnxml_index_by_name(const cnxml_index* index, cnxml_string name) {
+  return INTERNAL_cnxml_index_lookup(index, index->names, name);
+}
+
+cnxml_index_list cnxml_index_by_attribute(const cnxml_index* index, cnxml_string name, cnxml_string value) {
+  cnxml_any values;
+  if (index->attributes == NULL || cnxml_hashmap_get(index->attributes, name, &values) != CNXML_MAP_OK) {
+    return (cnxml_index_list){NULL, 0};
+  }
+  return INTERNAL_cnxml_index_lookup(index, values, value);
+}
+
+/*** FREE ***/
+
+static int INTERNAL_cnxml_index_free_values(cnxml_any item, cnxml_string key, cnxml_any values) {
+  (void)item;
+  (void)key;
+  cnxml_hashmap_free(values);
+  return CNXML_MAP_OK;
+}
+
+void cnxml_index_free(cnxml_index* index) {
+  cnxml_context* ctx = index->ctx;
+  if (index->names != NULL) cnxml_hashmap_free(index->names);
+  if (index->attributes != NULL) {
+    cnxml_hashmap_iterate(index->attributes, INTERNAL_cnxml_index_free_values, NULL);
+    cnxml_hashmap_free(index->attributes);
+  }
+  if (index->buckets != NULL) cnxml_context_dealloc(ctx, index->buckets);
+  if (index->elements != NULL) cnxml_context_dealloc(ctx, index->elements);
+  cnxml_context_dealloc(ctx, index);
+}
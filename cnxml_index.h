@@ -0,0 +1,59 @@
+#ifndef CNXML_INDEX
+#define CNXML_INDEX
+
+#include "cnxml.h"
+
+// secondary indexes over a parsed tree
+//
+// built on demand in a single pass over the tree, after which looking
+// up every element with a given name, or every element whose attribute
+// has a given value, is one hash lookup. only the indexes asked for in
+// flags are built, and the attribute index can be limited to a few
+// attribute names, so nothing is paid for lookups that are never made.
+//
+// the index points into the tree: it stays valid as long as the tree
+// is alive and not modified. matches are listed in document order.
+// lookups don't modify the index, so a built index can be shared
+// between threads.
+
+#define CNXML_INDEX_NAMES 1
+#define CNXML_INDEX_ATTRIBUTES 2
+
+#define CNXML_INDEX_WALK_INLINE_DEPTH 64
+
+// a view into the index's storage, owned by the index
+typedef struct {
+  cnxml_element** ptr;
+  size_t len;
+} cnxml_index_list;
+
+typedef struct {
+  size_t start; // INTO elements
+  size_t len;
+} cnxml_index_bucket;
+
+typedef struct {
+  cnxml_context* ctx;
+  int flags;
+  cnxml_map names;              // NAME -> BUCKET NUMBER + 1, NULL IF NOT BUILT
+  cnxml_map attributes;         // ATTRIBUTE NAME -> cnxml_map OF VALUE -> BUCKET NUMBER + 1
+  cnxml_index_bucket* buckets;
+  size_t bucket_count;
+  cnxml_element** elements;     // EVERY BUCKET'S ELEMENTS, BACK TO BACK
+  size_t element_count;
+} cnxml_index;
+
+/*** INDEX API ***/
+// attribute_names limits the attribute index to those attributes, NULL
+// indexes all of them. the root itself is indexed too
+CNXML_EXPORT cnxml_index* CNXML_API cnxml_index_new(cnxml_context* ctx, cnxml_element* root, int flags,
+  const cnxml_string* attribute_names, int attribute_name_count);
+// indexes every tree in roots, e.g. from cnxml_parser_read_document
+CNXML_EXPORT cnxml_index* CNXML_API cnxml_index_new_list(cnxml_context* ctx, cnxml_element_list* roots, int flags,
+  const cnxml_string* attribute_names, int attribute_name_count);
+// empty if there are no matches or the index wasn't built
+CNXML_EXPORT cnxml_index_list CNXML_API cnxml_index_by_name(const cnxml_index* index, cnxml_string name);
+CNXML_EXPORT cnxml_index_list CNXML_API cnxml_index_by_attribute(const cnxml_index* index, cnxml_string name, cnxml_string value);
+CNXML_EXPORT void CNXML_API cnxml_index_free(cnxml_index* index);
+
+#endif//CNXML_INDEX
@@ -0,0 +1,175 @@
+#include "cnxml_intern.h"
+#include "cnxml_hash.h"
+#include <string.h>
+
+/*** INTERN TABLE ***/
+
+// frees the first shard_count shards, alloc_lock and the table itself.
+// table_new uses it to back out of a half-built table
+static void INTERNAL_cnxml_intern_release(cnxml_intern_table* table, int shard_count) {
+  for (int i = 0; i < shard_count; i++) {
+    cnxml_context_dealloc(table->ctx, table->shards[i].slots);
+    cnxml_mutex_destroy(&table->shards[i].lock);
+  }
+  cnxml_mutex_destroy(&table->alloc_lock);
+  cnxml_context_dealloc(table->ctx, table);
+}
+
+cnxml_intern_table* cnxml_intern_table_new(cnxml_context* ctx) {
+  if (ctx == NULL) {
+    return (cnxml_intern_table*)CNXML_ERROR_BADARGS;
+  }
+  cnxml_intern_table* table = cnxml_context_alloc(ctx, sizeof(cnxml_intern_table));
+  if (table == NULL) {
+    return (cnxml_intern_table*)CNXML_ERROR_ALLOCFAIL;
+  }
+  memset(table, 0, sizeof(cnxml_intern_table));
+  table->ctx = ctx;
+  if (cnxml_mutex_init(&table->alloc_lock) != CNXML_ERROR_OK) {
+    cnxml_context_dealloc(ctx, table);
+    return (cnxml_intern_table*)CNXML_ERROR_ALLOCFAIL;
+  }
+
+  for (int i = 0; i < CNXML_INTERN_SHARD_COUNT; i++) {
+    cnxml_intern_shard* shard = table->shards + i;
+    shard->capacity = CNXML_INTERN_SHARD_INITIAL_CAPACITY;
+    shard->slots = cnxml_context_alloc(ctx, sizeof(cnxml_intern_slot) * shard->capacity);
+    if (shard->slots == NULL) {
+      INTERNAL_cnxml_intern_release(table, i);
+      return (cnxml_intern_table*)CNXML_ERROR_ALLOCFAIL;
+    }
+    if (cnxml_mutex_init(&shard->lock) != CNXML_ERROR_OK) {
+      cnxml_context_dealloc(ctx, shard->slots);
+      INTERNAL_cnxml_intern_release(table, i);
+      return (cnxml_intern_table*)CNXML_ERROR_ALLOCFAIL;
+    }
+    memset(shard->slots, 0, sizeof(cnxml_intern_slot) * shard->capacity);
+  }
+  return table;
+}
+
+static uint32_t INTERNAL_cnxml_intern_hash(cnxml_string name) {
+  return cnxml_hash_bytes(name.ptr, name.len, 0);
+}
+
+static cnxml_string* INTERNAL_cnxml_intern_entry(cnxml_intern_table* table, cnxml_symbol symbol) {
+  return table->pages[symbol / CNXML_INTERN_PAGE_SIZE] + symbol % CNXML_INTERN_PAGE_SIZE;
+}
+
+// returns the slot holding name, or the empty slot it would go in
+static cnxml_intern_slot* INTERNAL_cnxml_intern_probe(cnxml_intern_table* table, cnxml_intern_shard* shard, cnxml_string name, uint32_t hash) {
+  uint32_t mask = shard->capacity - 1;
+  uint32_t index = hash & mask;
+  while (true) {
+    cnxml_intern_slot* slot = shard->slots + index;
+    if (slot->symbol == CNXML_SYMBOL_NONE) return slot;
+    if (slot->hash == hash && cnxml_string_equal(*INTERNAL_cnxml_intern_entry(table, slot->symbol), name)) return slot;
+    index = (index + 1) & mask;
+  }
+}
+
+// called with the shard and alloc locks held
+static bool INTERNAL_cnxml_intern_grow(cnxml_intern_table* table, cnxml_intern_shard* shard) {
+  uint32_t new_capacity = shard->capacity * 2;
+  cnxml_intern_slot* new_slots = cnxml_context_alloc(table->ctx, sizeof(cnxml_intern_slot) * new_capacity);
+  if (new_slots == NULL) return false;
+  memset(new_slots, 0, sizeof(cnxml_intern_slot) * new_capacity);
+
+  for (uint32_t i = 0; i < shard->capacity; i++) {
+    cnxml_intern_slot slot = shard->slots[i];
+    if (slot.symbol == CNXML_SYMBOL_NONE) continue;
+    uint32_t index = slot.hash & (new_capacity - 1);
+    while (new_slots[index].symbol != CNXML_SYMBOL_NONE) index = (index + 1) & (new_capacity - 1);
+    new_slots[index] = slot;
+  }
+
+  cnxml_context_dealloc(table->ctx, shard->slots);
+  shard->slots = new_slots;
+  shard->capacity = new_capacity;
+  return true;
+}
+
+// called with the shard and alloc locks held
+static cnxml_symbol INTERNAL_cnxml_intern_add(cnxml_intern_table* table, cnxml_string name) {
+  cnxml_symbol symbol = table->symbol_count + 1;
+  uint32_t page = symbol / CNXML_INTERN_PAGE_SIZE;
+  if (page >= CNXML_INTERN_MAX_PAGES) return CNXML_SYMBOL_NONE;
+  if (table->pages[page] == NULL) {
+    table->pages[page] = cnxml_context_alloc(table->ctx, sizeof(cnxml_string) * CNXML_INTERN_PAGE_SIZE);
+    if (table->pages[page] == NULL) return CNXML_SYMBOL_NONE;
+  }
+
+  // keep a copy, the name may point into a source that goes away
+  char* copy = cnxml_context_alloc(table->ctx, name.len == 0 ? 1 : name.len);
+  if (copy == NULL) return CNXML_SYMBOL_NONE;
+  memcpy(copy, name.ptr, name.len);
+
+  *INTERNAL_cnxml_intern_entry(table, symbol) = cnxml_string_newlen(copy, name.len);
+  table->symbol_count = symbol;
+  return symbol;
+}
+
+// the symbol for name, adding it if it's new. CNXML_SYMBOL_NONE if out
+// of memory or symbols
+cnxml_symbol cnxml_intern(cnxml_intern_table* table, cnxml_string name) {
+  uint32_t hash = INTERNAL_cnxml_intern_hash(name);
+  cnxml_intern_shard* shard = table->shards + (hash >> 28) % CNXML_INTERN_SHARD_COUNT;
+
+  cnxml_mutex_lock(&shard->lock);
+  cnxml_intern_slot* slot = INTERNAL_cnxml_intern_probe(table, shard, name, hash);
+  cnxml_symbol symbol = slot->symbol;
+  if (symbol == CNXML_SYMBOL_NONE) {
+    cnxml_mutex_lock(&table->alloc_lock);
+    // keep at least a quarter of the shard free
+    if ((shard->count + 1) * 4 > shard->capacity * 3) {
+      if (INTERNAL_cnxml_intern_grow(table, shard)) {
+        slot = INTERNAL_cnxml_intern_probe(table, shard, name, hash);
+      } else {
+        slot = NULL;
+      }
+    }
+    if (slot != NULL) symbol = INTERNAL_cnxml_intern_add(table, name);
+    cnxml_mutex_unlock(&table->alloc_lock);
+
+    if (symbol != CNXML_SYMBOL_NONE) {
+      slot->hash = hash;
+      slot->symbol = symbol;
+      shard->count += 1;
+    }
+  }
+  cnxml_mutex_unlock(&shard->lock);
+  return symbol;
+}
+
+// like cnxml_intern, but never adds. CNXML_SYMBOL_NONE if name is new
+cnxml_symbol cnxml_intern_find(cnxml_intern_table* table, cnxml_string name) {
+  uint32_t hash = INTERNAL_cnxml_intern_hash(name);
+  cnxml_intern_shard* shard = table->shards + (hash >> 28) % CNXML_INTERN_SHARD_COUNT;
+
+  cnxml_mutex_lock(&shard->lock);
+  cnxml_symbol symbol = INTERNAL_cnxml_intern_probe(table, shard, name, hash)->symbol;
+  cnxml_mutex_unlock(&shard->lock);
+  return symbol;
+}
+
+// the table's own copy of the name, valid as long as the table
+cnxml_string cnxml_intern_name(cnxml_intern_table* table, cnxml_symbol symbol) {
+  if (symbol == CNXML_SYMBOL_NONE || symbol / CNXML_INTERN_PAGE_SIZE >= CNXML_INTERN_MAX_PAGES) return CNXML_STRING_EMPTY;
+  if (table->pages[symbol / CNXML_INTERN_PAGE_SIZE] == NULL) return CNXML_STRING_EMPTY;
+  return *INTERNAL_cnxml_intern_entry(table, symbol);
+}
+
+size_t cnxml_intern_count(cnxml_intern_table* table) {
+  return table->symbol_count;
+}
+
+void cnxml_intern_table_free(cnxml_intern_table* table) {
+  cnxml_context* ctx = table->ctx;
+  for (uint32_t symbol = 1; symbol <= table->symbol_count; symbol++) {
+    cnxml_context_dealloc(ctx, INTERNAL_cnxml_intern_entry(table, symbol)->ptr);
+  }
+  for (int i = 0; i < CNXML_INTERN_MAX_PAGES; i++) {
+    if (table->pages[i] != NULL) cnxml_context_dealloc(ctx, table->pages[i]);
+  }
+  INTERNAL_cnxml_intern_release(table, CNXML_INTERN_SHARD_COUNT);
+}
@@ -0,0 +1,55 @@
+#ifndef CNXML_INTERN
+#define CNXML_INTERN
+
+#include <stdint.h>
+#include "cnxml_common.h"
+#include "cnxml_string.h"
+#include "cnxml_thread.h"
+
+// shared table of element and attribute names
+//
+// each distinct name gets a small integer symbol the first time it's
+// seen, and keeps it for the life of the table. a table is attached to
+// contexts with cnxml_context_set_symbols; everything parsed through
+// them then carries symbols, so names can be compared and attributes
+// looked up without touching the bytes. one table can be shared by any
+// number of contexts and threads.
+//
+// lookups only lock one of CNXML_INTERN_SHARD_COUNT shards. symbol to
+// name lookups don't lock at all, the name pages never move once
+// allocated.
+
+#define CNXML_INTERN_SHARD_COUNT 16
+#define CNXML_INTERN_SHARD_INITIAL_CAPACITY 64
+#define CNXML_INTERN_PAGE_SIZE 4096
+#define CNXML_INTERN_MAX_PAGES 1024
+
+typedef struct {
+  uint32_t hash;
+  cnxml_symbol symbol; // CNXML_SYMBOL_NONE IF EMPTY
+} cnxml_intern_slot;
+
+typedef struct {
+  cnxml_mutex lock;
+  cnxml_intern_slot* slots;
+  uint32_t capacity; // POWER OF TWO
+  uint32_t count;
+} cnxml_intern_shard;
+
+struct _cnxml_intern_table {
+  cnxml_context* ctx;
+  cnxml_intern_shard shards[CNXML_INTERN_SHARD_COUNT];
+  cnxml_mutex alloc_lock; // everything allocated through ctx, and symbol_count
+  uint32_t symbol_count;  // SYMBOLS START AT 1
+  cnxml_string* pages[CNXML_INTERN_MAX_PAGES];
+};
+
+/*** INTERN API ***/
+CNXML_EXPORT cnxml_intern_table* CNXML_API cnxml_intern_table_new(cnxml_context* ctx);
+CNXML_EXPORT cnxml_symbol CNXML_API cnxml_intern(cnxml_intern_table* table, cnxml_string name);
+CNXML_EXPORT cnxml_symbol CNXML_API cnxml_intern_find(cnxml_intern_table* table, cnxml_string name);
+CNXML_EXPORT cnxml_string CNXML_API cnxml_intern_name(cnxml_intern_table* table, cnxml_symbol symbol);
+CNXML_EXPORT size_t CNXML_API cnxml_intern_count(cnxml_intern_table* table);
+CNXML_EXPORT void CNXML_API cnxml_intern_table_free(cnxml_intern_table* table);
+
+#endif//CNXML_INTERN
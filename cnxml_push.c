@@ -0,0 +1,147 @@
+#include "cnxml_push.h"
+#include "cnxml_scan.h"
+
+/*** PUSH PARSER ***/
+
+cnxml_push_parser* cnxml_push_parser_new(cnxml_context* ctx, cnxml_push_event_func* callback, cnxml_any userdata) {
+  if (ctx == NULL || callback == NULL) {
+    return (cnxml_push_parser*)CNXML_ERROR_BADARGS;
+  }
+  cnxml_push_parser* parser = cnxml_context_alloc(ctx, sizeof(cnxml_push_parser));
+  if (parser == NULL) {
+    return (cnxml_push_parser*)CNXML_ERROR_ALLOCFAIL;
+  }
+
+  parser->ctx = ctx;
+  parser->callback = callback;
+  parser->userdata = userdata;
+  parser->buffer_capacity = CNXML_PUSH_PARSER_INITIAL_CAPACITY;
+  parser->buffer_len = 0;
+  parser->scan_index = 0;
+  parser->consumed = 0;
+  parser->finished = false;
+  parser->buffer = cnxml_context_alloc(ctx, parser->buffer_capacity);
+  if (parser->buffer == NULL) {
+    cnxml_context_dealloc(ctx, parser);
+    return (cnxml_push_parser*)CNXML_ERROR_ALLOCFAIL;
+  }
+
+  parser->tokenizer = cnxml_tokenizer_new(ctx, parser->buffer, 0);
+  if (CNXML_IS_ERROR(parser->tokenizer)) {
+    cnxml_push_parser* err = (cnxml_push_parser*)parser->tokenizer;
+    cnxml_context_dealloc(ctx, parser->buffer);
+    cnxml_context_dealloc(ctx, parser);
+    return err;
+  }
+  parser->reader = cnxml_reader_new(ctx, parser->tokenizer);
+  if (CNXML_IS_ERROR(parser->reader)) {
+    cnxml_push_parser* err = (cnxml_push_parser*)parser->reader;
+    cnxml_tokenizer_free(parser->tokenizer);
+    cnxml_context_dealloc(ctx, parser->buffer);
+    cnxml_context_dealloc(ctx, parser);
+    return err;
+  }
+  return parser;
+}
+
+static size_t INTERNAL_cnxml_push_skip_past(const char* data, size_t from, size_t len, const char* needle, size_t needle_len) {
+  size_t found = cnxml_scan_string(data + from, len - from, needle, needle_len);
+  if (found == len - from) return 0;
+  return from + found + needle_len;
+}
+
+// finds the end of the last complete unit (tag, comment, processing
+// instruction or text run) starting at parser->scan_index
+static size_t INTERNAL_cnxml_push_complete_len(cnxml_push_parser* parser) {
+  const char* data = parser->buffer;
+  size_t len = parser->buffer_len;
+  size_t pos = parser->scan_index;
+
+  while (pos < len) {
+    size_t end;
+    if (data[pos] != '<') {
+      // text is only complete once the next markup starts
+      size_t lt = cnxml_scan_char(data + pos, len - pos, '<');
+      if (lt == len - pos) break;
+      pos += lt;
+      continue;
+    }
+
+    if (pos + 1 >= len) break;
+    if (data[pos + 1] == '!') {
+      if (pos + 4 > len) break;
+      if (data[pos + 2] == '-' && data[pos + 3] == '-') {
+        end = INTERNAL_cnxml_push_skip_past(data, pos + 4, len, "-->", 3);
+      } else {
+        end = INTERNAL_cnxml_push_skip_past(data, pos + 2, len, ">", 1);
+      }
+    } else if (data[pos + 1] == '?') {
+      end = INTERNAL_cnxml_push_skip_past(data, pos + 2, len, "?>", 2);
+    } else {
+      size_t gt = cnxml_scan_tag_end(data + pos, len - pos);
+      end = gt == len - pos ? 0 : pos + gt + 1;
+    }
+    if (end == 0) break;
+    pos = end;
+  }
+
+  parser->scan_index = pos;
+  return pos;
+}
+
+static void INTERNAL_cnxml_push_dispatch(cnxml_push_parser* parser, size_t complete_len, bool final) {
+  cnxml_tokenizer_reset(parser->tokenizer, parser->buffer, complete_len);
+  while (true) {
+    cnxml_reader_event_type type = cnxml_reader_next(parser->reader);
+    if (type == CNXML_READER_EOF && !final) break;
+    parser->reader->event.offset += parser->consumed;
+    parser->callback(parser->userdata, &parser->reader->event);
+    if (type == CNXML_READER_EOF) break;
+  }
+
+  // drop everything that was turned into events
+  size_t remaining = parser->buffer_len - complete_len;
+  memmove(parser->buffer, parser->buffer + complete_len, remaining);
+  parser->buffer_len = remaining;
+  parser->scan_index -= complete_len;
+  parser->consumed += complete_len;
+}
+
+cnxml_error cnxml_push_parser_feed(cnxml_push_parser* parser, const char* data, size_t len) {
+  if (parser->finished || (data == NULL && len > 0)) return CNXML_ERROR_BADARGS;
+
+  if (parser->buffer_len + len > parser->buffer_capacity) {
+    size_t new_capacity = parser->buffer_capacity;
+    while (new_capacity < parser->buffer_len + len) new_capacity *= 2;
+    char* new_buffer = cnxml_context_realloc(parser->ctx, parser->buffer, new_capacity);
+    if (new_buffer == NULL) return CNXML_ERROR_ALLOCFAIL;
+    parser->buffer = new_buffer;
+    parser->buffer_capacity = new_capacity;
+  }
+  memcpy(parser->buffer + parser->buffer_len, data, len);
+  parser->buffer_len += len;
+
+  size_t complete_len = INTERNAL_cnxml_push_complete_len(parser);
+  if (complete_len > 0) INTERNAL_cnxml_push_dispatch(parser, complete_len, false);
+  return CNXML_ERROR_OK;
+}
+
+// flushes whatever is left (incomplete markup is parsed as if the input
+// ended there) and sends the final EOF event
+cnxml_error cnxml_push_parser_finish(cnxml_push_parser* parser) {
+  if (parser->finished) return CNXML_ERROR_BADARGS;
+  parser->finished = true;
+  INTERNAL_cnxml_push_dispatch(parser, parser->buffer_len, true);
+  return CNXML_ERROR_OK;
+}
+
+size_t cnxml_push_parser_depth(cnxml_push_parser* parser) {
+  return parser->reader->depth;
+}
+
+void cnxml_push_parser_free(cnxml_push_parser* parser) {
+  cnxml_reader_free(parser->reader);
+  cnxml_tokenizer_free(parser->tokenizer);
+  cnxml_context_dealloc(parser->ctx, parser->buffer);
+  cnxml_context_dealloc(parser->ctx, parser);
+}
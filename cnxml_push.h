@@ -0,0 +1,39 @@
+#ifndef CNXML_PUSH
+#define CNXML_PUSH
+
+#include "cnxml.h"
+#include "cnxml_reader.h"
+
+// push-mode parser for input that arrives in chunks
+//
+// chunks are buffered only until the markup or text they contain is
+// complete, then turned into cnxml_reader events. event strings point
+// into the internal buffer and are only valid during the callback;
+// event offsets are relative to the start of the whole stream.
+
+typedef void cnxml_push_event_func(cnxml_any userdata, cnxml_reader_event* event);
+
+typedef struct {
+  cnxml_context* ctx;
+  cnxml_push_event_func* callback;
+  cnxml_any userdata;
+  char* buffer;
+  size_t buffer_len;
+  size_t buffer_capacity;
+  size_t scan_index; // start of the first incomplete unit in buffer
+  size_t consumed;   // bytes already dropped from the front of buffer
+  cnxml_tokenizer* tokenizer;
+  cnxml_reader* reader;
+  bool finished;
+} cnxml_push_parser;
+
+#define CNXML_PUSH_PARSER_INITIAL_CAPACITY 4096
+
+/*** PUSH PARSER API ***/
+CNXML_EXPORT cnxml_push_parser* CNXML_API cnxml_push_parser_new(cnxml_context* ctx, cnxml_push_event_func* callback, cnxml_any userdata);
+CNXML_EXPORT cnxml_error CNXML_API cnxml_push_parser_feed(cnxml_push_parser* parser, const char* data, size_t len);
+CNXML_EXPORT cnxml_error CNXML_API cnxml_push_parser_finish(cnxml_push_parser* parser);
+CNXML_EXPORT size_t CNXML_API cnxml_push_parser_depth(cnxml_push_parser* parser);
+CNXML_EXPORT void CNXML_API cnxml_push_parser_free(cnxml_push_parser* parser);
+
+#endif//CNXML_PUSH
@@ -0,0 +1,268 @@
+#include "cnxml_query.h"
+#include "cnxml_intern.h"
+#include <string.h>
+
+/*** COMPILE ***/
+
+static bool INTERNAL_cnxml_query_is_name_char(char c) {
+  switch (c) {
+  case '\0': case '/': case '[': case ']': case '=': case '@':
+  case '\'': case '"': case '*': case ' ': case '\t': case '\n': case '\r':
+    return false;
+  default:
+    return true;
+  }
+}
+
+// reads a name at expr[*pos], returns false if there isn't one
+static bool INTERNAL_cnxml_query_read_name(char* expr, size_t* pos, cnxml_string* name_out) {
+  size_t start = *pos;
+  while (INTERNAL_cnxml_query_is_name_char(expr[*pos])) *pos += 1;
+  if (*pos == start) return false;
+  *name_out = cnxml_string_newlen(expr + start, *pos - start);
+  return true;
+}
+
+// only looks names up, so queries don't grow the shared table. a name
+// it hasn't seen can't be on any interned element yet, and steps
+// without a symbol are matched by comparing strings
+static cnxml_symbol INTERNAL_cnxml_query_find_symbol(cnxml_intern_table* symbols, cnxml_string name) {
+  if (symbols == NULL) return CNXML_SYMBOL_NONE;
+  return cnxml_intern_find(symbols, name);
+}
+
+// fills in query->steps from query->source. the arrays are sized for
+// the worst case up front, so this can't fail on memory
+static bool INTERNAL_cnxml_query_parse(cnxml_query* query, cnxml_query_predicate* predicates, size_t* pos) {
+  char* expr = query->source;
+  *pos = 0;
+  query->absolute = expr[0] == '/';
+
+  while (true) {
+    cnxml_query_step* step = query->steps + query->step_count;
+    step->axis = CNXML_QUERY_AXIS_CHILD;
+    if (expr[*pos] == '/') {
+      *pos += 1;
+      if (expr[*pos] == '/') {
+        step->axis = CNXML_QUERY_AXIS_DESCENDANT;
+        *pos += 1;
+      }
+    } else if (query->step_count > 0) {
+      return false;
+    }
+
+    step->name = CNXML_STRING_EMPTY;
+    step->name_symbol = CNXML_SYMBOL_NONE;
+    if (expr[*pos] == '*') {
+      *pos += 1;
+    } else if (INTERNAL_cnxml_query_read_name(expr, pos, &step->name)) {
+      step->name_symbol = INTERNAL_cnxml_query_find_symbol(query->symbols, step->name);
+    } else {
+      return false;
+    }
+
+    step->predicates = predicates;
+    step->predicate_count = 0;
+    while (expr[*pos] == '[') {
+      cnxml_query_predicate* pred = predicates;
+      *pos += 1;
+      if (expr[*pos] != '@') return false;
+      *pos += 1;
+      if (!INTERNAL_cnxml_query_read_name(expr, pos, &pred->name)) return false;
+      pred->name_symbol = INTERNAL_cnxml_query_find_symbol(query->symbols, pred->name);
+      pred->has_value = false;
+      pred->value = CNXML_STRING_EMPTY;
+
+      if (expr[*pos] == '=') {
+        *pos += 1;
+        char quote = expr[*pos];
+        if (quote != '\'' && quote != '"') return false;
+        *pos += 1;
+        size_t start = *pos;
+        while (expr[*pos] != quote) {
+          if (expr[*pos] == '\0') return false;
+          *pos += 1;
+        }
+        pred->value = cnxml_string_newlen(expr + start, *pos - start);
+        pred->has_value = true;
+        *pos += 1;
+      }
+      if (expr[*pos] != ']') return false;
+      *pos += 1;
+
+      predicates += 1;
+      step->predicate_count += 1;
+    }
+
+    query->step_count += 1;
+    if (expr[*pos] == '\0') return true;
+    if (expr[*pos] != '/' || query->step_count == CNXML_QUERY_MAX_STEPS) return false;
+  }
+}
+
+cnxml_query* cnxml_query_compile(cnxml_context* ctx, const char* expr, size_t* error_offset) {
+  if (error_offset != NULL) *error_offset = 0;
+  if (ctx == NULL || expr == NULL) {
+    return (cnxml_query*)CNXML_ERROR_BADARGS;
+  }
+
+  // every step but the first starts with a '/', every predicate with a '['
+  size_t len = strlen(expr);
+  int max_steps = 1;
+  int max_predicates = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (expr[i] == '/') max_steps += 1;
+    if (expr[i] == '[') max_predicates += 1;
+  }
+
+  cnxml_query* query = cnxml_context_alloc(ctx, sizeof(cnxml_query));
+  if (query == NULL) {
+    return (cnxml_query*)CNXML_ERROR_ALLOCFAIL;
+  }
+  query->ctx = ctx;
+  query->symbols = ctx->symbols;
+  query->step_count = 0;
+  query->steps = cnxml_context_alloc(ctx, sizeof(cnxml_query_step) * max_steps);
+  cnxml_query_predicate* predicates = cnxml_context_alloc(ctx, sizeof(cnxml_query_predicate) * (max_predicates + 1));
+  query->source = cnxml_context_alloc(ctx, len + 1);
+  if (query->steps == NULL || predicates == NULL || query->source == NULL) {
+    if (predicates != NULL) cnxml_context_dealloc(ctx, predicates);
+    cnxml_query_free(query);
+    return (cnxml_query*)CNXML_ERROR_ALLOCFAIL;
+  }
+  memcpy(query->source, expr, len + 1);
+
+  size_t pos;
+  if (!INTERNAL_cnxml_query_parse(query, predicates, &pos)) {
+    if (error_offset != NULL) *error_offset = pos;
+    query->step_count = 0;
+    cnxml_context_dealloc(ctx, predicates);
+    cnxml_query_free(query);
+    return (cnxml_query*)CNXML_ERROR_BADARGS;
+  }
+  return query;
+}
+
+void cnxml_query_free(cnxml_query* query) {
+  cnxml_context* ctx = query->ctx;
+  // all the steps' predicates share the array the first one points to
+  if (query->steps != NULL && query->step_count > 0) cnxml_context_dealloc(ctx, query->steps[0].predicates);
+  if (query->steps != NULL) cnxml_context_dealloc(ctx, query->steps);
+  if (query->source != NULL) cnxml_context_dealloc(ctx, query->source);
+  cnxml_context_dealloc(ctx, query);
+}
+
+/*** RUN ***/
+
+static bool INTERNAL_cnxml_query_match_step(const cnxml_query* query, const cnxml_query_step* step, cnxml_element* elem) {
+  // symbols are only comparable when the tree was interned into the
+  // same table the query was compiled against
+  bool symbols = query->symbols != NULL && elem->ctx != NULL && elem->ctx->symbols == query->symbols;
+
+  if (step->name.len > 0) {
+    if (symbols && elem->name_symbol != CNXML_SYMBOL_NONE && step->name_symbol != CNXML_SYMBOL_NONE) {
+      if (elem->name_symbol != step->name_symbol) return false;
+    } else if (!cnxml_string_equal(elem->name, step->name)) {
+      return false;
+    }
+  }
+
+  for (int i = 0; i < step->predicate_count; i++) {
+    const cnxml_query_predicate* pred = step->predicates + i;
+    cnxml_string value;
+    int found;
+    if (symbols && pred->name_symbol != CNXML_SYMBOL_NONE) {
+      found = cnxml_element_get_attribute_symbol(elem, pred->name_symbol, &value);
+    } else {
+      found = cnxml_element_get_attribute(elem, pred->name, &value);
+    }
+    if (found != CNXML_MAP_OK) return false;
+    if (pred->has_value && !cnxml_string_equal(value, pred->value)) return false;
+  }
+  return true;
+}
+
+static void INTERNAL_cnxml_query_iter_start(cnxml_query_iter* iter, const cnxml_query* query, cnxml_element_list* children) {
+  iter->query = query;
+  iter->frames = iter->inline_frames;
+  iter->frame_capacity = CNXML_QUERY_INLINE_DEPTH;
+  iter->frame_count = 0;
+  iter->truncated = false;
+  if (children == NULL || query->step_count == 0) return;
+  iter->frames[0] = (cnxml_query_frame){children, 0, 1};
+  iter->frame_count = 1;
+}
+
+// absolute paths start at root, relative ones at its children
+void cnxml_query_iter_init(cnxml_query_iter* iter, const cnxml_query* query, cnxml_element* root) {
+  if (query->absolute) {
+    iter->root_list = (cnxml_element_list){root->ctx, root, 1, 1};
+    INTERNAL_cnxml_query_iter_start(iter, query, &iter->root_list);
+  } else {
+    INTERNAL_cnxml_query_iter_start(iter, query, root->children);
+  }
+}
+
+void cnxml_query_iter_init_list(cnxml_query_iter* iter, const cnxml_query* query, cnxml_element_list* roots) {
+  INTERNAL_cnxml_query_iter_start(iter, query, roots);
+}
+
+// swaps in a caller-owned stack for trees nested deeper than
+// CNXML_QUERY_INLINE_DEPTH. has to come before the first
+// cnxml_query_next, and frames must outlive the iterator
+void cnxml_query_iter_set_stack(cnxml_query_iter* iter, cnxml_query_frame* frames, size_t capacity) {
+  if (frames == NULL || capacity < iter->frame_count) return;
+  memcpy(frames, iter->frames, sizeof(cnxml_query_frame) * iter->frame_count);
+  iter->frames = frames;
+  iter->frame_capacity = capacity;
+}
+
+// next match in document order, or NULL when there are no more
+cnxml_element* cnxml_query_next(cnxml_query_iter* iter) {
+  const cnxml_query* query = iter->query;
+  const uint64_t last = (uint64_t)1 << (query->step_count - 1);
+  const uint64_t all = last | (last - 1);
+
+  while (iter->frame_count > 0) {
+    cnxml_query_frame* frame = iter->frames + iter->frame_count - 1;
+    if (frame->next_child >= frame->children->len) {
+      iter->frame_count -= 1;
+      continue;
+    }
+    cnxml_element* elem = frame->children->ptr + frame->next_child;
+    frame->next_child += 1;
+
+    // descendant steps carry on past a level they didn't match at, and
+    // every step matched here moves on to the next one for the children
+    uint64_t matched = 0;
+    uint64_t child_pending = 0;
+    uint64_t pending = frame->pending;
+    while (pending != 0) {
+      uint64_t bit = pending & (~pending + 1);
+      pending ^= bit;
+      int k = 0;
+      while (((uint64_t)1 << k) != bit) k++;
+      const cnxml_query_step* step = query->steps + k;
+      if (step->axis == CNXML_QUERY_AXIS_DESCENDANT) child_pending |= bit;
+      if (INTERNAL_cnxml_query_match_step(query, step, elem)) matched |= bit;
+    }
+    child_pending |= (matched << 1) & all;
+
+    if (child_pending != 0 && elem->children != NULL && elem->children->len > 0) {
+      if (iter->frame_count == iter->frame_capacity) {
+        iter->truncated = true;
+      } else {
+        iter->frames[iter->frame_count] = (cnxml_query_frame){elem->children, 0, child_pending};
+        iter->frame_count += 1;
+      }
+    }
+    if ((matched & last) != 0) return elem;
+  }
+  return NULL;
+}
+
+cnxml_element* cnxml_query_first(const cnxml_query* query, cnxml_element* root) {
+  cnxml_query_iter iter;
+  cnxml_query_iter_init(&iter, query, root);
+  return cnxml_query_next(&iter);
+}
@@ -0,0 +1,84 @@
+#ifndef CNXML_QUERY
+#define CNXML_QUERY
+
+#include <stdint.h>
+#include "cnxml.h"
+
+// compiled path queries over parsed trees
+//
+// supports a small xpath subset: name steps, `*`, `/` for children,
+// `//` for descendants and attribute predicates `[@name]` and
+// `[@name='value']`, e.g. `//Entity/Component[@kind='c1']`. a query is
+// compiled once and can then be run over any number of trees, from any
+// number of threads.
+//
+// running a query doesn't allocate: the iterator walks the tree with a
+// fixed stack of CNXML_QUERY_INLINE_DEPTH frames, which the caller can
+// replace with a bigger one for deeper trees. subtrees that can't match
+// any remaining step aren't visited at all. matches come out in
+// document order, each element once.
+//
+// a path starting with `/` matches from the root itself, anything else
+// from its children. over a list of roots (cnxml_parser_read_document)
+// both mean the roots. an initialized iterator points into itself, so
+// it mustn't be copied.
+
+#define CNXML_QUERY_MAX_STEPS 64
+#define CNXML_QUERY_INLINE_DEPTH 64
+
+typedef enum {
+  CNXML_QUERY_AXIS_CHILD,
+  CNXML_QUERY_AXIS_DESCENDANT
+} cnxml_query_axis;
+
+typedef struct {
+  cnxml_string name;
+  cnxml_string value;
+  cnxml_symbol name_symbol; // CNXML_SYMBOL_NONE IF NOT INTERNED
+  bool has_value;           // FALSE FOR [@name]
+} cnxml_query_predicate;
+
+typedef struct {
+  cnxml_query_axis axis;
+  cnxml_string name;        // EMPTY FOR *
+  cnxml_symbol name_symbol; // CNXML_SYMBOL_NONE IF NOT INTERNED OR *
+  cnxml_query_predicate* predicates;
+  int predicate_count;
+} cnxml_query_step;
+
+typedef struct {
+  cnxml_context* ctx;
+  cnxml_intern_table* symbols; // TABLE THE SYMBOLS BELONG TO, NULL IF NONE
+  bool absolute;
+  cnxml_query_step* steps;
+  int step_count;
+  char* source;                // COPY OF THE EXPRESSION, NAMES POINT INTO IT
+} cnxml_query;
+
+typedef struct {
+  cnxml_element_list* children;
+  size_t next_child;
+  uint64_t pending; // STEPS THE CHILDREN ARE TESTED AGAINST
+} cnxml_query_frame;
+
+typedef struct {
+  const cnxml_query* query;
+  cnxml_element_list root_list; // STANDS IN FOR THE ROOT'S PARENT
+  cnxml_query_frame* frames;
+  size_t frame_count;
+  size_t frame_capacity;
+  bool truncated;               // A SUBTREE WAS SKIPPED FOR LACK OF FRAMES
+  cnxml_query_frame inline_frames[CNXML_QUERY_INLINE_DEPTH];
+} cnxml_query_iter;
+
+/*** QUERY API ***/
+// error_offset (optional) gets the position of a syntax error
+CNXML_EXPORT cnxml_query* CNXML_API cnxml_query_compile(cnxml_context* ctx, const char* expr, size_t* error_offset);
+CNXML_EXPORT void CNXML_API cnxml_query_iter_init(cnxml_query_iter* iter, const cnxml_query* query, cnxml_element* root);
+CNXML_EXPORT void CNXML_API cnxml_query_iter_init_list(cnxml_query_iter* iter, const cnxml_query* query, cnxml_element_list* roots);
+CNXML_EXPORT void CNXML_API cnxml_query_iter_set_stack(cnxml_query_iter* iter, cnxml_query_frame* frames, size_t capacity);
+CNXML_EXPORT cnxml_element* CNXML_API cnxml_query_next(cnxml_query_iter* iter);
+CNXML_EXPORT cnxml_element* CNXML_API cnxml_query_first(const cnxml_query* query, cnxml_element* root);
+CNXML_EXPORT void CNXML_API cnxml_query_free(cnxml_query* query);
+
+#endif//CNXML_QUERY
@@ -0,0 +1,154 @@
+#include "cnxml_reader.h"
+
+/*** READER ***/
+
+cnxml_reader* cnxml_reader_new(cnxml_context* ctx, cnxml_tokenizer* tokenizer) {
+  if (tokenizer == NULL) {
+    return (cnxml_reader*)CNXML_ERROR_BADARGS;
+  }
+  if (ctx == NULL) {
+    ctx = tokenizer->ctx;
+  }
+  cnxml_reader* reader = cnxml_context_alloc(ctx, sizeof(cnxml_reader));
+  if (reader == NULL) {
+    return (cnxml_reader*)CNXML_ERROR_ALLOCFAIL;
+  }
+
+  reader->ctx = ctx;
+  reader->tokenizer = tokenizer;
+  reader->state = CNXML_READER_STATE_CONTENT;
+  reader->element_name = CNXML_STRING_EMPTY;
+  reader->depth = 0;
+  reader->event = (cnxml_reader_event){CNXML_READER_EOF, CNXML_STRING_EMPTY, CNXML_STRING_EMPTY, 0, 0, 0};
+  return reader;
+}
+
+static cnxml_reader_event_type INTERNAL_cnxml_reader_emit(cnxml_reader* reader, cnxml_reader_event_type type, cnxml_string name, cnxml_string value, size_t offset) {
+  reader->event.type = type;
+  reader->event.name = name;
+  reader->event.value = value;
+  reader->event.offset = offset;
+  reader->event.depth = reader->depth;
+  return type;
+}
+
+static cnxml_reader_event_type INTERNAL_cnxml_reader_error(cnxml_reader* reader, cnxml_parser_error_type error, cnxml_string name, size_t offset) {
+  reader->event.error = error;
+  return INTERNAL_cnxml_reader_emit(reader, CNXML_READER_ERROR, name, CNXML_STRING_EMPTY, offset);
+}
+
+static cnxml_reader_event_type INTERNAL_cnxml_reader_next_in_tag(cnxml_reader* reader) {
+  cnxml_tokenizer* tokenizer = reader->tokenizer;
+  cnxml_token tok = cnxml_tokenizer_next_token(tokenizer);
+  size_t offset = tokenizer->current_index;
+
+  switch (tok.type) {
+  case CNXML_TOKEN_EOF:
+    reader->state = CNXML_READER_STATE_CONTENT;
+    return INTERNAL_cnxml_reader_emit(reader, CNXML_READER_EOF, CNXML_STRING_EMPTY, CNXML_STRING_EMPTY, offset);
+  case CNXML_TOKEN_CLOSEGREATER:
+    reader->state = CNXML_READER_STATE_CONTENT;
+    return cnxml_reader_next(reader);
+  case CNXML_TOKEN_SLASH:
+    if (cnxml_tokenizer_cur_char(tokenizer) == '>') cnxml_tokenizer_move(tokenizer, 1);
+    reader->state = CNXML_READER_STATE_CONTENT;
+    INTERNAL_cnxml_reader_emit(reader, CNXML_READER_END_ELEMENT, reader->element_name, CNXML_STRING_EMPTY, offset);
+    if (reader->depth > 0) reader->depth -= 1; // a stray end tag stays at 0
+    return CNXML_READER_END_ELEMENT;
+  case CNXML_TOKEN_STRING: {
+    cnxml_string name = tok.content;
+    // on errors the offending token is left for the next call, so a
+    // stray '>' or '/>' still ends the tag
+    size_t before = tokenizer->current_index;
+    tok = cnxml_tokenizer_next_token(tokenizer);
+    if (tok.type != CNXML_TOKEN_EQUAL) {
+      tokenizer->current_index = before;
+      return INTERNAL_cnxml_reader_error(reader, CNXML_PARSER_ERROR_MISSING_EQUALS_SIGN, name, before);
+    }
+    before = tokenizer->current_index;
+    tok = cnxml_tokenizer_next_token(tokenizer);
+    if (tok.type != CNXML_TOKEN_STRING) {
+      tokenizer->current_index = before;
+      return INTERNAL_cnxml_reader_error(reader, CNXML_PARSER_ERROR_MISSING_ATTRIBUTE_VALUE, name, before);
+    }
+    return INTERNAL_cnxml_reader_emit(reader, CNXML_READER_ATTRIBUTE, name, tok.content, (size_t)(name.ptr - tokenizer->data));
+  }
+  default:
+    reader->state = CNXML_READER_STATE_CONTENT;
+    return INTERNAL_cnxml_reader_error(reader, CNXML_PARSER_ERROR_NO_CLOSING_SYMBOL_FOUND, reader->element_name, offset);
+  }
+}
+
+cnxml_reader_event_type cnxml_reader_next(cnxml_reader* reader) {
+  cnxml_tokenizer* tokenizer = reader->tokenizer;
+
+  if (reader->state == CNXML_READER_STATE_TAG) {
+    return INTERNAL_cnxml_reader_next_in_tag(reader);
+  }
+
+  cnxml_tokenizer_skip_whitespace(tokenizer);
+  size_t offset = tokenizer->current_index;
+
+  if (cnxml_tokenizer_is_eof(tokenizer)) {
+    return INTERNAL_cnxml_reader_emit(reader, CNXML_READER_EOF, CNXML_STRING_EMPTY, CNXML_STRING_EMPTY, offset);
+  }
+
+  if (cnxml_tokenizer_cur_char(tokenizer) != '<') {
+    cnxml_string text = cnxml_tokenizer_read_text(tokenizer);
+    return INTERNAL_cnxml_reader_emit(reader, CNXML_READER_TEXT, CNXML_STRING_EMPTY, text, offset);
+  }
+
+  cnxml_tokenizer_move(tokenizer, 1);
+
+  if (cnxml_tokenizer_cur_char(tokenizer) == '/') {
+    cnxml_tokenizer_move(tokenizer, 1);
+    cnxml_token end_name = cnxml_tokenizer_next_token(tokenizer);
+    if (end_name.type != CNXML_TOKEN_STRING) {
+      return INTERNAL_cnxml_reader_error(reader, CNXML_PARSER_ERROR_MISSING_ELEMENT_NAME, CNXML_STRING_EMPTY, tokenizer->current_index);
+    }
+    cnxml_token close_greater = cnxml_tokenizer_next_token(tokenizer);
+    if (close_greater.type != CNXML_TOKEN_CLOSEGREATER) {
+      return INTERNAL_cnxml_reader_error(reader, CNXML_PARSER_ERROR_NO_CLOSING_SYMBOL_FOUND, end_name.content, tokenizer->current_index);
+    }
+    INTERNAL_cnxml_reader_emit(reader, CNXML_READER_END_ELEMENT, end_name.content, CNXML_STRING_EMPTY, offset);
+    if (reader->depth > 0) reader->depth -= 1;
+    return CNXML_READER_END_ELEMENT;
+  }
+
+  cnxml_token name = cnxml_tokenizer_next_token(tokenizer);
+  if (name.type != CNXML_TOKEN_STRING) {
+    return INTERNAL_cnxml_reader_error(reader, CNXML_PARSER_ERROR_MISSING_ELEMENT_NAME, CNXML_STRING_EMPTY, tokenizer->current_index);
+  }
+
+  reader->depth += 1;
+  reader->element_name = name.content;
+  reader->state = CNXML_READER_STATE_TAG;
+  return INTERNAL_cnxml_reader_emit(reader, CNXML_READER_START_ELEMENT, name.content, CNXML_STRING_EMPTY, offset);
+}
+
+// skips the rest of the element whose START_ELEMENT was just returned,
+// ending on its END_ELEMENT (or EOF)
+cnxml_reader_event_type cnxml_reader_skip_element(cnxml_reader* reader) {
+  size_t depth = reader->depth;
+  while (true) {
+    cnxml_reader_event_type type = cnxml_reader_next(reader);
+    if (type == CNXML_READER_EOF) return type;
+    if (type == CNXML_READER_END_ELEMENT && reader->event.depth == depth) return type;
+  }
+}
+
+const char* cnxml_reader_event_type_name(cnxml_reader_event_type type) {
+  switch (type) {
+  case CNXML_READER_START_ELEMENT: return "START_ELEMENT";
+  case CNXML_READER_ATTRIBUTE: return "ATTRIBUTE";
+  case CNXML_READER_TEXT: return "TEXT";
+  case CNXML_READER_END_ELEMENT: return "END_ELEMENT";
+  case CNXML_READER_ERROR: return "ERROR";
+  case CNXML_READER_EOF: return "EOF";
+  default: return "UNKNOWN";
+  }
+}
+
+void cnxml_reader_free(cnxml_reader* reader) {
+  cnxml_context_dealloc(reader->ctx, reader);
+}
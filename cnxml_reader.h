@@ -0,0 +1,50 @@
+#ifndef CNXML_READER
+#define CNXML_READER
+
+#include "cnxml.h"
+
+// pull-style reader on top of cnxml_tokenizer
+//
+// every event is returned in reader->event, names and values are
+// views into the tokenizer's data and nothing is allocated per event.
+
+typedef enum {
+  CNXML_READER_START_ELEMENT,
+  CNXML_READER_ATTRIBUTE,
+  CNXML_READER_TEXT,
+  CNXML_READER_END_ELEMENT,
+  CNXML_READER_ERROR,
+  CNXML_READER_EOF
+} cnxml_reader_event_type;
+
+typedef struct {
+  cnxml_reader_event_type type;
+  cnxml_string name;                // element or attribute name
+  cnxml_string value;               // attribute value or text
+  cnxml_parser_error_type error;    // ONLY FOR CNXML_READER_ERROR
+  size_t offset;                    // byte offset of the event in the input
+  size_t depth;                     // 1 for the root element and its contents
+} cnxml_reader_event;
+
+typedef enum {
+  CNXML_READER_STATE_CONTENT,
+  CNXML_READER_STATE_TAG
+} cnxml_reader_state;
+
+typedef struct {
+  cnxml_context* ctx;
+  cnxml_tokenizer* tokenizer;
+  cnxml_reader_state state;
+  cnxml_string element_name; // name of the last start tag
+  size_t depth;
+  cnxml_reader_event event;
+} cnxml_reader;
+
+/*** READER API ***/
+CNXML_EXPORT cnxml_reader* CNXML_API cnxml_reader_new(cnxml_context* ctx, cnxml_tokenizer* tokenizer);
+CNXML_EXPORT cnxml_reader_event_type CNXML_API cnxml_reader_next(cnxml_reader* reader);
+CNXML_EXPORT cnxml_reader_event_type CNXML_API cnxml_reader_skip_element(cnxml_reader* reader);
+CNXML_EXPORT const char* CNXML_API cnxml_reader_event_type_name(cnxml_reader_event_type type);
+CNXML_EXPORT void CNXML_API cnxml_reader_free(cnxml_reader* reader);
+
+#endif//CNXML_READER
@@ -0,0 +1,399 @@
+#include "cnxml_scan.h"
+#include "cnxml_thread.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+  #define CNXML_SCAN_X86
+  #include <emmintrin.h>
+  #include <immintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+    #define CNXML_SCAN_TARGET_AVX2
+  #else
+    #define CNXML_SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+  #endif
+#endif
+
+static inline unsigned int INTERNAL_cnxml_scan_ctz(unsigned int mask) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return (unsigned int)idx;
+#else
+  return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+
+static inline unsigned int INTERNAL_cnxml_scan_popcount(unsigned int mask) {
+#ifdef _MSC_VER
+  return (unsigned int)__popcnt(mask);
+#else
+  return (unsigned int)__builtin_popcount(mask);
+#endif
+}
+
+static inline bool INTERNAL_cnxml_scan_is_punctuation_or_whitespace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '<' || c == '>' || c == '=' || c == '/';
+}
+
+/*** SCALAR ***/
+
+static size_t INTERNAL_cnxml_scan_punctuation_or_whitespace_scalar(const char* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (INTERNAL_cnxml_scan_is_punctuation_or_whitespace(data[i])) return i;
+  }
+  return len;
+}
+
+static size_t INTERNAL_cnxml_scan_char_scalar(const char* data, size_t len, char c) {
+  const char* found = memchr(data, c, len);
+  return found == NULL ? len : (size_t)(found - data);
+}
+
+// finds the first position where both needle[0] and needle[1] match
+static size_t INTERNAL_cnxml_scan_pair_scalar(const char* data, size_t len, char a, char b) {
+  for (size_t i = 0; i + 1 < len; i++) {
+    if (data[i] == a && data[i + 1] == b) return i;
+  }
+  return len;
+}
+
+static size_t INTERNAL_cnxml_scan_any3_scalar(const char* data, size_t len, char a, char b, char c) {
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] == a || data[i] == b || data[i] == c) return i;
+  }
+  return len;
+}
+
+static size_t INTERNAL_cnxml_scan_count_char_scalar(const char* data, size_t len, char c) {
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    count += data[i] == c;
+  }
+  return count;
+}
+
+/*** SSE2 ***/
+
+#ifdef CNXML_SCAN_X86
+
+static size_t INTERNAL_cnxml_scan_punctuation_or_whitespace_sse2(const char* data, size_t len) {
+  const __m128i sp = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i gt = _mm_set1_epi8('>');
+  const __m128i eq = _mm_set1_epi8('=');
+  const __m128i slash = _mm_set1_epi8('/');
+
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    __m128i hit = _mm_or_si128(
+      _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr))
+      ),
+      _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, eq), _mm_cmpeq_epi8(v, slash))
+      )
+    );
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+    if (mask != 0) return i + INTERNAL_cnxml_scan_ctz(mask);
+  }
+  return i + INTERNAL_cnxml_scan_punctuation_or_whitespace_scalar(data + i, len - i);
+}
+
+static size_t INTERNAL_cnxml_scan_char_sse2(const char* data, size_t len, char c) {
+  const __m128i needle = _mm_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+    if (mask != 0) return i + INTERNAL_cnxml_scan_ctz(mask);
+  }
+  return i + INTERNAL_cnxml_scan_char_scalar(data + i, len - i, c);
+}
+
+static size_t INTERNAL_cnxml_scan_pair_sse2(const char* data, size_t len, char a, char b) {
+  const __m128i first = _mm_set1_epi8(a);
+  const __m128i second = _mm_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 17 <= len; i += 16) {
+    __m128i v0 = _mm_loadu_si128((const __m128i*)(data + i));
+    __m128i v1 = _mm_loadu_si128((const __m128i*)(data + i + 1));
+    __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(v0, first), _mm_cmpeq_epi8(v1, second));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+    if (mask != 0) return i + INTERNAL_cnxml_scan_ctz(mask);
+  }
+  size_t rest = INTERNAL_cnxml_scan_pair_scalar(data + i, len - i, a, b);
+  return rest == len - i ? len : i + rest;
+}
+
+static size_t INTERNAL_cnxml_scan_any3_sse2(const char* data, size_t len, char a, char b, char c) {
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  const __m128i vc = _mm_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)), _mm_cmpeq_epi8(v, vc));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+    if (mask != 0) return i + INTERNAL_cnxml_scan_ctz(mask);
+  }
+  return i + INTERNAL_cnxml_scan_any3_scalar(data + i, len - i, a, b, c);
+}
+
+static size_t INTERNAL_cnxml_scan_count_char_sse2(const char* data, size_t len, char c) {
+  const __m128i needle = _mm_set1_epi8(c);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    count += INTERNAL_cnxml_scan_popcount((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+  }
+  return count + INTERNAL_cnxml_scan_count_char_scalar(data + i, len - i, c);
+}
+
+/*** AVX2 ***/
+
+CNXML_SCAN_TARGET_AVX2
+static size_t INTERNAL_cnxml_scan_punctuation_or_whitespace_avx2(const char* data, size_t len) {
+  const __m256i sp = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lt = _mm256_set1_epi8('<');
+  const __m256i gt = _mm256_set1_epi8('>');
+  const __m256i eq = _mm256_set1_epi8('=');
+  const __m256i slash = _mm256_set1_epi8('/');
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+    __m256i hit = _mm256_or_si256(
+      _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr))
+      ),
+      _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, gt)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, eq), _mm256_cmpeq_epi8(v, slash))
+      )
+    );
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+    if (mask != 0) return i + INTERNAL_cnxml_scan_ctz(mask);
+  }
+  return i + INTERNAL_cnxml_scan_punctuation_or_whitespace_sse2(data + i, len - i);
+}
+
+CNXML_SCAN_TARGET_AVX2
+static size_t INTERNAL_cnxml_scan_char_avx2(const char* data, size_t len, char c) {
+  const __m256i needle = _mm256_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+    if (mask != 0) return i + INTERNAL_cnxml_scan_ctz(mask);
+  }
+  return i + INTERNAL_cnxml_scan_char_sse2(data + i, len - i, c);
+}
+
+CNXML_SCAN_TARGET_AVX2
+static size_t INTERNAL_cnxml_scan_pair_avx2(const char* data, size_t len, char a, char b) {
+  const __m256i first = _mm256_set1_epi8(a);
+  const __m256i second = _mm256_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 33 <= len; i += 32) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i*)(data + i));
+    __m256i v1 = _mm256_loadu_si256((const __m256i*)(data + i + 1));
+    __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(v0, first), _mm256_cmpeq_epi8(v1, second));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+    if (mask != 0) return i + INTERNAL_cnxml_scan_ctz(mask);
+  }
+  size_t rest = INTERNAL_cnxml_scan_pair_sse2(data + i, len - i, a, b);
+  return rest == len - i ? len : i + rest;
+}
+
+CNXML_SCAN_TARGET_AVX2
+static size_t INTERNAL_cnxml_scan_any3_avx2(const char* data, size_t len, char a, char b, char c) {
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vb = _mm256_set1_epi8(b);
+  const __m256i vc = _mm256_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+    __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)), _mm256_cmpeq_epi8(v, vc));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+    if (mask != 0) return i + INTERNAL_cnxml_scan_ctz(mask);
+  }
+  return i + INTERNAL_cnxml_scan_any3_sse2(data + i, len - i, a, b, c);
+}
+
+CNXML_SCAN_TARGET_AVX2
+static size_t INTERNAL_cnxml_scan_count_char_avx2(const char* data, size_t len, char c) {
+  const __m256i needle = _mm256_set1_epi8(c);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+    count += INTERNAL_cnxml_scan_popcount((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+  }
+  return count + INTERNAL_cnxml_scan_count_char_sse2(data + i, len - i, c);
+}
+
+static bool INTERNAL_cnxml_scan_cpu_has_avx2(void) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuidex(info, 0, 0);
+  if (info[0] < 7) return false;
+  __cpuidex(info, 1, 0);
+  // osxsave + avx, then check the os actually saves ymm state
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+  if ((_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+/*** DISPATCH ***/
+
+typedef struct {
+  cnxml_scan_impl impl;
+  size_t (*punctuation_or_whitespace)(const char* data, size_t len);
+  size_t (*find_char)(const char* data, size_t len, char c);
+  size_t (*find_pair)(const char* data, size_t len, char a, char b);
+  size_t (*find_any3)(const char* data, size_t len, char a, char b, char c);
+  size_t (*count_char)(const char* data, size_t len, char c);
+} INTERNAL_cnxml_scan_funcs;
+
+static const INTERNAL_cnxml_scan_funcs INTERNAL_cnxml_scan_scalar_funcs = {
+  CNXML_SCAN_IMPL_SCALAR,
+  INTERNAL_cnxml_scan_punctuation_or_whitespace_scalar,
+  INTERNAL_cnxml_scan_char_scalar,
+  INTERNAL_cnxml_scan_pair_scalar,
+  INTERNAL_cnxml_scan_any3_scalar,
+  INTERNAL_cnxml_scan_count_char_scalar
+};
+
+#ifdef CNXML_SCAN_X86
+static const INTERNAL_cnxml_scan_funcs INTERNAL_cnxml_scan_sse2_funcs = {
+  CNXML_SCAN_IMPL_SSE2,
+  INTERNAL_cnxml_scan_punctuation_or_whitespace_sse2,
+  INTERNAL_cnxml_scan_char_sse2,
+  INTERNAL_cnxml_scan_pair_sse2,
+  INTERNAL_cnxml_scan_any3_sse2,
+  INTERNAL_cnxml_scan_count_char_sse2
+};
+
+static const INTERNAL_cnxml_scan_funcs INTERNAL_cnxml_scan_avx2_funcs = {
+  CNXML_SCAN_IMPL_AVX2,
+  INTERNAL_cnxml_scan_punctuation_or_whitespace_avx2,
+  INTERNAL_cnxml_scan_char_avx2,
+  INTERNAL_cnxml_scan_pair_avx2,
+  INTERNAL_cnxml_scan_any3_avx2,
+  INTERNAL_cnxml_scan_count_char_avx2
+};
+#endif
+
+// racing initializations all store the same pointer, so an atomic
+// load and store are enough, no lock
+static void* volatile INTERNAL_cnxml_scan_active = NULL;
+
+static void INTERNAL_cnxml_scan_set_active(const INTERNAL_cnxml_scan_funcs* funcs) {
+  cnxml_atomic_store_ptr(&INTERNAL_cnxml_scan_active, (void*)funcs);
+}
+
+static const INTERNAL_cnxml_scan_funcs* INTERNAL_cnxml_scan_get(void) {
+  const INTERNAL_cnxml_scan_funcs* funcs = cnxml_atomic_load_ptr(&INTERNAL_cnxml_scan_active);
+  if (funcs != NULL) return funcs;
+#ifdef CNXML_SCAN_X86
+  funcs = INTERNAL_cnxml_scan_cpu_has_avx2() ? &INTERNAL_cnxml_scan_avx2_funcs : &INTERNAL_cnxml_scan_sse2_funcs;
+#else
+  funcs = &INTERNAL_cnxml_scan_scalar_funcs;
+#endif
+  INTERNAL_cnxml_scan_set_active(funcs);
+  return funcs;
+}
+
+size_t cnxml_scan_punctuation_or_whitespace(const char* data, size_t len) {
+  return INTERNAL_cnxml_scan_get()->punctuation_or_whitespace(data, len);
+}
+
+size_t cnxml_scan_char(const char* data, size_t len, char c) {
+  return INTERNAL_cnxml_scan_get()->find_char(data, len, c);
+}
+
+size_t cnxml_scan_any3(const char* data, size_t len, char a, char b, char c) {
+  return INTERNAL_cnxml_scan_get()->find_any3(data, len, a, b, c);
+}
+
+size_t cnxml_scan_string(const char* data, size_t len, const char* needle, size_t needle_len) {
+  if (needle_len == 0) return 0;
+  if (needle_len == 1) return cnxml_scan_char(data, len, needle[0]);
+
+  const INTERNAL_cnxml_scan_funcs* funcs = INTERNAL_cnxml_scan_get();
+  size_t offs = 0;
+  while (offs + needle_len <= len) {
+    size_t found = funcs->find_pair(data + offs, len - offs, needle[0], needle[1]);
+    if (found == len - offs) return len;
+    offs += found;
+    if (offs + needle_len > len) return len;
+    if (memcmp(data + offs + 2, needle + 2, needle_len - 2) == 0) return offs;
+    offs += 1;
+  }
+  return len;
+}
+
+size_t cnxml_scan_count_char(const char* data, size_t len, char c) {
+  return INTERNAL_cnxml_scan_get()->count_char(data, len, c);
+}
+
+// the '>' ending the tag that starts at data[0], skipping any inside
+// double-quoted attribute values
+size_t cnxml_scan_tag_end(const char* data, size_t len) {
+  size_t pos = 1;
+  while (pos < len) {
+    size_t rest = len - pos;
+    size_t gt = cnxml_scan_char(data + pos, rest, '>');
+    size_t quote = cnxml_scan_char(data + pos, gt, '"');
+    if (quote == gt) {
+      return pos + gt;
+    }
+    pos += quote + 1;
+    size_t close = cnxml_scan_char(data + pos, len - pos, '"');
+    if (close == len - pos) return len;
+    pos += close + 1;
+  }
+  return len;
+}
+
+cnxml_scan_impl cnxml_scan_get_impl(void) {
+  return INTERNAL_cnxml_scan_get()->impl;
+}
+
+bool cnxml_scan_set_impl(cnxml_scan_impl impl) {
+  switch (impl) {
+  case CNXML_SCAN_IMPL_SCALAR:
+    INTERNAL_cnxml_scan_set_active(&INTERNAL_cnxml_scan_scalar_funcs);
+    return true;
+#ifdef CNXML_SCAN_X86
+  case CNXML_SCAN_IMPL_SSE2:
+    INTERNAL_cnxml_scan_set_active(&INTERNAL_cnxml_scan_sse2_funcs);
+    return true;
+  case CNXML_SCAN_IMPL_AVX2:
+    if (!INTERNAL_cnxml_scan_cpu_has_avx2()) return false;
+    INTERNAL_cnxml_scan_set_active(&INTERNAL_cnxml_scan_avx2_funcs);
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef CNXML_SCAN
+#define CNXML_SCAN
+
+#include <stddef.h>
+#include "cnxml_common.h"
+
+// vectorized byte scanning used by the tokenizer's hot loops
+//
+// the implementation (AVX2, SSE2 or scalar) is picked at runtime the
+// first time any of these is called. every function returns an offset
+// into data, or len if nothing was found.
+
+typedef enum {
+  CNXML_SCAN_IMPL_SCALAR,
+  CNXML_SCAN_IMPL_SSE2,
+  CNXML_SCAN_IMPL_AVX2
+} cnxml_scan_impl;
+
+/*** SCAN API ***/
+
+// first whitespace, '<', '>', '=' or '/'
+CNXML_EXPORT size_t CNXML_API cnxml_scan_punctuation_or_whitespace(const char* data, size_t len);
+CNXML_EXPORT size_t CNXML_API cnxml_scan_char(const char* data, size_t len, char c);
+// first a, b or c. pass the same char twice to look for fewer
+CNXML_EXPORT size_t CNXML_API cnxml_scan_any3(const char* data, size_t len, char a, char b, char c);
+// first occurrence of needle (length >= 1)
+CNXML_EXPORT size_t CNXML_API cnxml_scan_string(const char* data, size_t len, const char* needle, size_t needle_len);
+// the '>' closing the tag at data[0], ignoring quoted ones
+CNXML_EXPORT size_t CNXML_API cnxml_scan_tag_end(const char* data, size_t len);
+CNXML_EXPORT size_t CNXML_API cnxml_scan_count_char(const char* data, size_t len, char c);
+CNXML_EXPORT cnxml_scan_impl CNXML_API cnxml_scan_get_impl(void);
+// forces a specific implementation, mostly for benchmarking. returns
+// false if the cpu doesn't support it
+CNXML_EXPORT bool CNXML_API cnxml_scan_set_impl(cnxml_scan_impl impl);
+
+#endif//CNXML_SCAN
@@ -0,0 +1,266 @@
+#include "cnxml_sink.h"
+#include "cnxml_entity.h"
+#include "cnxml_scan.h"
+#include <string.h>
+
+#ifdef _WIN32
+  #include <io.h>
+#else
+  #include <errno.h>
+  #include <unistd.h>
+#endif
+
+/*** SINK ***/
+
+static cnxml_sink* INTERNAL_cnxml_sink_new(cnxml_context* ctx, cnxml_sink_kind kind, size_t buffer_size) {
+  if (ctx == NULL) {
+    return (cnxml_sink*)CNXML_ERROR_BADARGS;
+  }
+  if (buffer_size == 0) buffer_size = CNXML_SINK_DEFAULT_BUFFER_SIZE;
+
+  cnxml_sink* sink = cnxml_context_alloc(ctx, sizeof(cnxml_sink));
+  if (sink == NULL) {
+    return (cnxml_sink*)CNXML_ERROR_ALLOCFAIL;
+  }
+  sink->buffer = cnxml_context_alloc(ctx, buffer_size);
+  if (sink->buffer == NULL) {
+    cnxml_context_dealloc(ctx, sink);
+    return (cnxml_sink*)CNXML_ERROR_ALLOCFAIL;
+  }
+
+  sink->ctx = ctx;
+  sink->kind = kind;
+  sink->writer = NULL;
+  sink->userdata = NULL;
+  sink->fd = -1;
+  sink->file = NULL;
+  sink->buffer_len = 0;
+  sink->buffer_capacity = buffer_size;
+  sink->error = CNXML_ERROR_OK;
+  return sink;
+}
+
+cnxml_sink* cnxml_sink_new(cnxml_context* ctx, cnxml_writer_func* writer, cnxml_any userdata, size_t buffer_size) {
+  if (writer == NULL) {
+    return (cnxml_sink*)CNXML_ERROR_BADARGS;
+  }
+  cnxml_sink* sink = INTERNAL_cnxml_sink_new(ctx, CNXML_SINK_CALLBACK, buffer_size);
+  if ((size_t)sink >= CNXML_ERRORPTR_FIRST && (size_t)sink <= CNXML_ERRORPTR_LAST) return sink;
+  sink->writer = writer;
+  sink->userdata = userdata;
+  return sink;
+}
+
+cnxml_sink* cnxml_sink_new_fd(cnxml_context* ctx, int fd, size_t buffer_size) {
+  if (fd < 0) {
+    return (cnxml_sink*)CNXML_ERROR_BADARGS;
+  }
+  cnxml_sink* sink = INTERNAL_cnxml_sink_new(ctx, CNXML_SINK_FD, buffer_size);
+  if ((size_t)sink >= CNXML_ERRORPTR_FIRST && (size_t)sink <= CNXML_ERRORPTR_LAST) return sink;
+  sink->fd = fd;
+  return sink;
+}
+
+cnxml_sink* cnxml_sink_new_file(cnxml_context* ctx, FILE* file, size_t buffer_size) {
+  if (file == NULL) {
+    return (cnxml_sink*)CNXML_ERROR_BADARGS;
+  }
+  cnxml_sink* sink = INTERNAL_cnxml_sink_new(ctx, CNXML_SINK_FILE, buffer_size);
+  if ((size_t)sink >= CNXML_ERRORPTR_FIRST && (size_t)sink <= CNXML_ERRORPTR_LAST) return sink;
+  sink->file = file;
+  return sink;
+}
+
+// sets up a callback sink over a caller-owned buffer, e.g. on the stack.
+// such a sink must not be passed to cnxml_sink_free
+void cnxml_sink_init(cnxml_sink* sink, cnxml_writer_func* writer, cnxml_any userdata, char* buffer, size_t buffer_size) {
+  sink->ctx = NULL;
+  sink->kind = CNXML_SINK_CALLBACK;
+  sink->writer = writer;
+  sink->userdata = userdata;
+  sink->fd = -1;
+  sink->file = NULL;
+  sink->buffer = buffer;
+  sink->buffer_len = 0;
+  sink->buffer_capacity = buffer_size;
+  sink->error = CNXML_ERROR_OK;
+}
+
+static cnxml_error INTERNAL_cnxml_sink_write_fd(int fd, const char* data, size_t len) {
+  while (len > 0) {
+#ifdef _WIN32
+    int written = _write(fd, data, (unsigned int)len);
+    if (written < 0) return CNXML_ERROR_IO;
+#else
+    ssize_t written = write(fd, data, len);
+    if (written < 0 && errno == EINTR) continue;
+    if (written < 0) return CNXML_ERROR_IO;
+#endif
+    data += written;
+    len -= (size_t)written;
+  }
+  return CNXML_ERROR_OK;
+}
+
+static void INTERNAL_cnxml_sink_emit(cnxml_sink* sink, const char* data, size_t len) {
+  if (len == 0 || sink->error != CNXML_ERROR_OK) return;
+  switch (sink->kind) {
+  case CNXML_SINK_CALLBACK:
+    sink->writer(sink->userdata, data, len);
+    break;
+  case CNXML_SINK_FD:
+    sink->error = INTERNAL_cnxml_sink_write_fd(sink->fd, data, len);
+    break;
+  case CNXML_SINK_FILE:
+    // anything the caller left in the FILE's own buffer goes out first
+    if (fflush(sink->file) != 0) {
+      sink->error = CNXML_ERROR_IO;
+      break;
+    }
+#ifdef _WIN32
+    sink->error = INTERNAL_cnxml_sink_write_fd(_fileno(sink->file), data, len);
+#else
+    sink->error = INTERNAL_cnxml_sink_write_fd(fileno(sink->file), data, len);
+#endif
+    break;
+  }
+}
+
+void cnxml_sink_write(cnxml_sink* sink, const char* data, size_t len) {
+  if (len <= sink->buffer_capacity - sink->buffer_len) {
+    memcpy(sink->buffer + sink->buffer_len, data, len);
+    sink->buffer_len += len;
+    return;
+  }
+
+  INTERNAL_cnxml_sink_emit(sink, sink->buffer, sink->buffer_len);
+  sink->buffer_len = 0;
+  if (len >= sink->buffer_capacity) {
+    // too big to be worth copying
+    INTERNAL_cnxml_sink_emit(sink, data, len);
+    return;
+  }
+  memcpy(sink->buffer, data, len);
+  sink->buffer_len = len;
+}
+
+void cnxml_sink_write_repeat(cnxml_sink* sink, const char* data, size_t len, size_t count) {
+  // an empty indent string would otherwise still cost a call per level
+  if (len == 0) return;
+  for (size_t i = 0; i < count; i++) {
+    cnxml_sink_write(sink, data, len);
+  }
+}
+
+// values shorter than this are copied into the buffer a word at a time,
+// checking each word as it goes, instead of being scanned by a call into
+// the vectorized scan first and then copied
+#define CNXML_SINK_ESCAPE_SCAN_MIN_LENGTH 64
+
+#define CNXML_SINK_WORD_ONES 0x0101010101010101ULL
+#define CNXML_SINK_WORD_HIGHS 0x8080808080808080ULL
+
+// nonzero if any byte of word is c
+static inline uint64_t INTERNAL_cnxml_sink_word_has(uint64_t word, char c) {
+  uint64_t x = word ^ (CNXML_SINK_WORD_ONES * (unsigned char)c);
+  return (x - CNXML_SINK_WORD_ONES) & ~x & CNXML_SINK_WORD_HIGHS;
+}
+
+static inline uint64_t INTERNAL_cnxml_sink_word_needs_escape(uint64_t word, char quote) {
+  return INTERNAL_cnxml_sink_word_has(word, '&') | INTERNAL_cnxml_sink_word_has(word, '<') | INTERNAL_cnxml_sink_word_has(word, quote);
+}
+
+// copies data to out up to the first byte that needs escaping, returning
+// how many were copied. the last few bytes are checked with loads that
+// overlap the ones before instead of one by one, which matters because
+// most attribute values are only a handful of bytes long
+static size_t INTERNAL_cnxml_sink_copy_clean(const char* data, size_t len, char quote, char* out) {
+  size_t i = 0;
+  if (len >= 8) {
+    uint64_t word;
+    for (; i + 8 <= len; i += 8) {
+      memcpy(&word, data + i, 8);
+      if (INTERNAL_cnxml_sink_word_needs_escape(word, quote)) goto bytes;
+      memcpy(out + i, &word, 8);
+    }
+    if (i == len) return len;
+    memcpy(&word, data + len - 8, 8);
+    if (INTERNAL_cnxml_sink_word_needs_escape(word, quote)) goto bytes;
+    memcpy(out + len - 8, &word, 8);
+    return len;
+  }
+  if (len >= 4) {
+    uint32_t head, tail;
+    memcpy(&head, data, 4);
+    memcpy(&tail, data + len - 4, 4);
+    // the two halves overlap when len < 8, between them they cover every byte
+    if (INTERNAL_cnxml_sink_word_needs_escape(head | ((uint64_t)tail << 32), quote)) goto bytes;
+    memcpy(out, &head, 4);
+    memcpy(out + len - 4, &tail, 4);
+    return len;
+  }
+
+bytes:
+  for (; i < len; i++) {
+    char c = data[i];
+    if (c == '&' || c == '<' || c == quote) break;
+    out[i] = c;
+  }
+  return i;
+}
+
+// clean runs go out in bulk; only the bytes that need escaping are
+// handled one by one. unless CNXML_SINK_ESCAPE_ALL is given, a '&' that
+// already starts a reference is kept, so text taken from a parsed
+// document, where references are left undecoded, is written back
+// unchanged
+void cnxml_sink_write_escaped(cnxml_sink* sink, const char* data, size_t len, int flags) {
+  char quote = (flags & CNXML_SINK_ESCAPE_ATTRIBUTE) ? '"' : '<';
+  size_t pos = 0;
+  while (pos < len) {
+    size_t rest = len - pos;
+    size_t run;
+    if (rest < CNXML_SINK_ESCAPE_SCAN_MIN_LENGTH && rest <= sink->buffer_capacity - sink->buffer_len) {
+      run = INTERNAL_cnxml_sink_copy_clean(data + pos, rest, quote, sink->buffer + sink->buffer_len);
+      sink->buffer_len += run;
+    } else {
+      run = cnxml_scan_any3(data + pos, rest, '&', '<', quote);
+      cnxml_sink_write(sink, data + pos, run);
+    }
+    pos += run;
+    if (pos == len) break;
+
+    switch (data[pos]) {
+    case '&': {
+      size_t ref = (flags & CNXML_SINK_ESCAPE_ALL) ? 0 : cnxml_entity_reference_length(data + pos, len - pos);
+      if (ref > 0) {
+        cnxml_sink_write(sink, data + pos, ref);
+        pos += ref;
+        continue;
+      }
+      cnxml_sink_write(sink, "&amp;", 5);
+      break;
+    }
+    case '<':
+      cnxml_sink_write(sink, "&lt;", 4);
+      break;
+    default:
+      cnxml_sink_write(sink, "&quot;", 6);
+      break;
+    }
+    pos += 1;
+  }
+}
+
+cnxml_error cnxml_sink_flush(cnxml_sink* sink) {
+  INTERNAL_cnxml_sink_emit(sink, sink->buffer, sink->buffer_len);
+  sink->buffer_len = 0;
+  return sink->error;
+}
+
+// flushes whatever is still buffered before freeing
+void cnxml_sink_free(cnxml_sink* sink) {
+  cnxml_sink_flush(sink);
+  cnxml_context_dealloc(sink->ctx, sink->buffer);
+  cnxml_context_dealloc(sink->ctx, sink);
+}
@@ -0,0 +1,54 @@
+#ifndef CNXML_SINK
+#define CNXML_SINK
+
+#include <stdio.h>
+#include "cnxml_common.h"
+#include "cnxml_hashmap.h"
+
+typedef void cnxml_writer_func(cnxml_any userdata, const char* buffer, size_t length);
+
+// buffered output for the serializer
+//
+// small writes are collected in the buffer and handed to the target in
+// one go when it fills up or on cnxml_sink_flush. fd and FILE targets
+// are written with write(2) directly.
+
+typedef enum {
+  CNXML_SINK_CALLBACK,
+  CNXML_SINK_FD,
+  CNXML_SINK_FILE
+} cnxml_sink_kind;
+
+typedef struct {
+  cnxml_context* ctx; // NULL FOR SINKS SET UP WITH cnxml_sink_init
+  cnxml_sink_kind kind;
+  cnxml_writer_func* writer;
+  cnxml_any userdata;
+  int fd;
+  FILE* file;
+  char* buffer;
+  size_t buffer_len;
+  size_t buffer_capacity;
+  cnxml_error error; // first error hit while writing, sticky
+} cnxml_sink;
+
+#define CNXML_SINK_DEFAULT_BUFFER_SIZE (64 * 1024)
+
+// flags for cnxml_sink_write_escaped
+#define CNXML_SINK_ESCAPE_ATTRIBUTE 1  // '"' too, for attribute values
+#define CNXML_SINK_ESCAPE_ALL 2        // every '&', even one starting a reference
+
+/*** SINK API ***/
+CNXML_EXPORT cnxml_sink* CNXML_API cnxml_sink_new(cnxml_context* ctx, cnxml_writer_func* writer, cnxml_any userdata, size_t buffer_size);
+CNXML_EXPORT cnxml_sink* CNXML_API cnxml_sink_new_fd(cnxml_context* ctx, int fd, size_t buffer_size);
+CNXML_EXPORT cnxml_sink* CNXML_API cnxml_sink_new_file(cnxml_context* ctx, FILE* file, size_t buffer_size);
+CNXML_EXPORT void CNXML_API cnxml_sink_init(cnxml_sink* sink, cnxml_writer_func* writer, cnxml_any userdata, char* buffer, size_t buffer_size);
+CNXML_EXPORT void CNXML_API cnxml_sink_write(cnxml_sink* sink, const char* data, size_t len);
+// escapes '&' and '<'. by default a '&' that starts a reference is kept,
+// since parsed values still hold theirs undecoded
+CNXML_EXPORT void CNXML_API cnxml_sink_write_escaped(cnxml_sink* sink, const char* data, size_t len, int flags);
+CNXML_EXPORT void CNXML_API cnxml_sink_write_repeat(cnxml_sink* sink, const char* data, size_t len, size_t count);
+CNXML_EXPORT cnxml_error CNXML_API cnxml_sink_flush(cnxml_sink* sink);
+CNXML_EXPORT void CNXML_API cnxml_sink_free(cnxml_sink* sink);
+
+#endif//CNXML_SINK
@@ -0,0 +1,240 @@
+#include "cnxml_source.h"
+
+#ifdef _WIN32
+  #include <stdio.h>
+#else
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+static const char INTERNAL_cnxml_source_empty[1] = {0};
+
+/*** SOURCE ***/
+
+#ifdef _WIN32
+
+static cnxml_error INTERNAL_cnxml_source_read_all(cnxml_source* source, const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) return CNXML_ERROR_IO;
+
+  size_t capacity = CNXML_SOURCE_READ_CHUNK_SIZE;
+  size_t len = 0;
+  char* buf = cnxml_context_alloc(source->ctx, capacity);
+  if (buf == NULL) {
+    fclose(f);
+    return CNXML_ERROR_ALLOCFAIL;
+  }
+  while (true) {
+    if (len == capacity) {
+      char* new_buf = cnxml_context_realloc(source->ctx, buf, capacity * 2);
+      if (new_buf == NULL) {
+        cnxml_context_dealloc(source->ctx, buf);
+        fclose(f);
+        return CNXML_ERROR_ALLOCFAIL;
+      }
+      buf = new_buf;
+      capacity *= 2;
+    }
+    size_t got = fread(buf + len, 1, capacity - len, f);
+    if (got == 0) break;
+    len += got;
+  }
+  fclose(f);
+
+  source->kind = CNXML_SOURCE_BUFFERED;
+  source->data = buf;
+  source->data_len = len;
+  return CNXML_ERROR_OK;
+}
+
+static cnxml_error INTERNAL_cnxml_source_load(cnxml_source* source, const char* path) {
+  return INTERNAL_cnxml_source_read_all(source, path);
+}
+
+#else
+
+// reads everything from fd; pread is used while the fd is seekable so
+// the file position is never touched
+static cnxml_error INTERNAL_cnxml_source_read_all(cnxml_source* source, int fd, size_t size_hint) {
+  size_t capacity = size_hint > 0 ? size_hint + 1 : CNXML_SOURCE_READ_CHUNK_SIZE;
+  size_t len = 0;
+  bool seekable = true;
+  char* buf = cnxml_context_alloc(source->ctx, capacity);
+  if (buf == NULL) return CNXML_ERROR_ALLOCFAIL;
+
+  while (true) {
+    if (len == capacity) {
+      char* new_buf = cnxml_context_realloc(source->ctx, buf, capacity * 2);
+      if (new_buf == NULL) {
+        cnxml_context_dealloc(source->ctx, buf);
+        return CNXML_ERROR_ALLOCFAIL;
+      }
+      buf = new_buf;
+      capacity *= 2;
+    }
+    ssize_t got = seekable ? pread(fd, buf + len, capacity - len, (off_t)len) : read(fd, buf + len, capacity - len);
+    if (got < 0 && seekable && errno == ESPIPE) {
+      seekable = false;
+      continue;
+    }
+    if (got < 0 && errno == EINTR) continue;
+    if (got < 0) {
+      cnxml_context_dealloc(source->ctx, buf);
+      return CNXML_ERROR_IO;
+    }
+    if (got == 0) break;
+    len += (size_t)got;
+  }
+
+  source->kind = CNXML_SOURCE_BUFFERED;
+  source->data = buf;
+  source->data_len = len;
+  return CNXML_ERROR_OK;
+}
+
+static cnxml_error INTERNAL_cnxml_source_load(cnxml_source* source, const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return CNXML_ERROR_IO;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return CNXML_ERROR_IO;
+  }
+
+  if (S_ISREG(st.st_mode) && st.st_size == 0) {
+    close(fd);
+    source->kind = CNXML_SOURCE_MAPPED;
+    source->data = INTERNAL_cnxml_source_empty;
+    source->data_len = 0;
+    return CNXML_ERROR_OK;
+  }
+
+  // small files are cheaper to read than to map and unmap
+  if (S_ISREG(st.st_mode) && (size_t)st.st_size >= CNXML_SOURCE_MAP_THRESHOLD) {
+    int prot = source->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* map = mmap(NULL, (size_t)st.st_size, prot, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+      close(fd);
+      source->kind = CNXML_SOURCE_MAPPED;
+      source->data = map;
+      source->data_len = (size_t)st.st_size;
+      return CNXML_ERROR_OK;
+    }
+  }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  cnxml_error err = INTERNAL_cnxml_source_read_all(source, fd, S_ISREG(st.st_mode) ? (size_t)st.st_size : 0);
+  close(fd);
+  return err;
+}
+
+#endif
+
+static cnxml_source* INTERNAL_cnxml_source_open(cnxml_context* ctx, const char* path, bool writable) {
+  if (ctx == NULL || path == NULL) {
+    return (cnxml_source*)CNXML_ERROR_BADARGS;
+  }
+  cnxml_source* source = cnxml_context_alloc(ctx, sizeof(cnxml_source));
+  if (source == NULL) {
+    return (cnxml_source*)CNXML_ERROR_ALLOCFAIL;
+  }
+  source->ctx = ctx;
+  source->writable = writable;
+
+  cnxml_error err = INTERNAL_cnxml_source_load(source, path);
+  if (err != CNXML_ERROR_OK) {
+    cnxml_context_dealloc(ctx, source);
+    return (cnxml_source*)err;
+  }
+  return source;
+}
+
+cnxml_source* cnxml_source_open(cnxml_context* ctx, const char* path) {
+  return INTERNAL_cnxml_source_open(ctx, path, false);
+}
+
+// like cnxml_source_open, but data may be modified in place. a mapping
+// is copy-on-write, so changes never reach the file and only the pages
+// written to stop being shared with the page cache
+cnxml_source* cnxml_source_open_private(cnxml_context* ctx, const char* path) {
+  return INTERNAL_cnxml_source_open(ctx, path, true);
+}
+
+// makes a mapped source read-only again once it's been modified
+void cnxml_source_protect(cnxml_source* source) {
+#ifndef _WIN32
+  if (source->kind == CNXML_SOURCE_MAPPED && source->writable && source->data_len > 0) {
+    mprotect((void*)source->data, source->data_len, PROT_READ);
+  }
+#endif
+  source->writable = false;
+}
+
+cnxml_tokenizer* cnxml_source_tokenizer(cnxml_source* source) {
+  return cnxml_tokenizer_new(source->ctx, source->data, source->data_len);
+}
+
+// feeds a file into a push parser chunk by chunk and finishes it, for
+// input that shouldn't be held in memory all at once. the push parser
+// copies what it still needs, so one read buffer is enough
+cnxml_error cnxml_source_stream(cnxml_context* ctx, const char* path, cnxml_push_parser* parser, size_t chunk_size) {
+  if (ctx == NULL || path == NULL || parser == NULL) return CNXML_ERROR_BADARGS;
+  if (chunk_size == 0) chunk_size = CNXML_SOURCE_READ_CHUNK_SIZE;
+
+  char* buf = cnxml_context_alloc(ctx, chunk_size);
+  if (buf == NULL) return CNXML_ERROR_ALLOCFAIL;
+  cnxml_error err = CNXML_ERROR_OK;
+
+#ifdef _WIN32
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    cnxml_context_dealloc(ctx, buf);
+    return CNXML_ERROR_IO;
+  }
+  size_t got;
+  while (err == CNXML_ERROR_OK && (got = fread(buf, 1, chunk_size, f)) > 0) {
+    err = cnxml_push_parser_feed(parser, buf, got);
+  }
+  fclose(f);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    cnxml_context_dealloc(ctx, buf);
+    return CNXML_ERROR_IO;
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  while (err == CNXML_ERROR_OK) {
+    ssize_t got = read(fd, buf, chunk_size);
+    if (got < 0 && errno == EINTR) continue;
+    if (got < 0) err = CNXML_ERROR_IO;
+    if (got <= 0) break;
+    err = cnxml_push_parser_feed(parser, buf, (size_t)got);
+  }
+  close(fd);
+#endif
+
+  cnxml_context_dealloc(ctx, buf);
+  if (err != CNXML_ERROR_OK) return err;
+  return cnxml_push_parser_finish(parser);
+}
+
+void cnxml_source_free(cnxml_source* source) {
+#ifndef _WIN32
+  if (source->kind == CNXML_SOURCE_MAPPED) {
+    if (source->data_len > 0) munmap((void*)source->data, source->data_len);
+    cnxml_context_dealloc(source->ctx, source);
+    return;
+  }
+#endif
+  cnxml_context_dealloc(source->ctx, (void*)source->data);
+  cnxml_context_dealloc(source->ctx, source);
+}
@@ -0,0 +1,40 @@
+#ifndef CNXML_SOURCE
+#define CNXML_SOURCE
+
+#include "cnxml.h"
+#include "cnxml_push.h"
+
+// input files for the tokenizer
+//
+// regular files of at least CNXML_SOURCE_MAP_THRESHOLD bytes are mapped
+// read-only, so with the tokenizer working on views into its data the
+// whole parse is zero-copy. smaller files, and anything that can't be
+// mapped (pipes, character devices, /proc files), are read into a
+// buffer instead. every string parsed from a source points into it, so
+// the source has to outlive the elements.
+
+typedef enum {
+  CNXML_SOURCE_MAPPED,
+  CNXML_SOURCE_BUFFERED
+} cnxml_source_kind;
+
+typedef struct {
+  cnxml_context* ctx;
+  cnxml_source_kind kind;
+  const char* data;
+  size_t data_len;
+  bool writable;           // ONLY FROM cnxml_source_open_private
+} cnxml_source;
+
+#define CNXML_SOURCE_READ_CHUNK_SIZE (64 * 1024)
+#define CNXML_SOURCE_MAP_THRESHOLD (64 * 1024)
+
+/*** SOURCE API ***/
+CNXML_EXPORT cnxml_source* CNXML_API cnxml_source_open(cnxml_context* ctx, const char* path);
+CNXML_EXPORT cnxml_source* CNXML_API cnxml_source_open_private(cnxml_context* ctx, const char* path);
+CNXML_EXPORT void CNXML_API cnxml_source_protect(cnxml_source* source);
+CNXML_EXPORT cnxml_tokenizer* CNXML_API cnxml_source_tokenizer(cnxml_source* source);
+CNXML_EXPORT cnxml_error CNXML_API cnxml_source_stream(cnxml_context* ctx, const char* path, cnxml_push_parser* parser, size_t chunk_size);
+CNXML_EXPORT void CNXML_API cnxml_source_free(cnxml_source* source);
+
+#endif//CNXML_SOURCE
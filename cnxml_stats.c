@@ -0,0 +1,57 @@
+#include "cnxml_stats.h"
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <time.h>
+#endif
+
+/*** STATS ***/
+
+// zeroes the counters, leaving the settings alone
+void cnxml_parse_stats_reset(cnxml_parse_stats* stats) {
+  bool split_tokenize_time = stats->split_tokenize_time;
+  memset(stats, 0, sizeof(cnxml_parse_stats));
+  stats->split_tokenize_time = split_tokenize_time;
+}
+
+double cnxml_parse_stats_build_seconds(const cnxml_parse_stats* stats) {
+  double build = stats->parse_seconds - stats->tokenize_seconds;
+  return build < 0 ? 0 : build;
+}
+
+void cnxml_parse_stats_print(FILE* f, const cnxml_parse_stats* stats) {
+  fprintf(f, "bytes: %llu\n", (unsigned long long)stats->bytes);
+  fprintf(f, "tokens:");
+  for (int i = 0; i < CNXML_STATS_TOKEN_TYPES; i++) {
+    fprintf(f, " %s=%llu", cnxml_tokenizer_token_type_name((cnxml_token_type)i), (unsigned long long)stats->tokens[i]);
+  }
+  fprintf(f, "\n");
+  fprintf(f, "elements: %llu\n", (unsigned long long)stats->elements);
+  fprintf(f, "attributes: %llu\n", (unsigned long long)stats->attributes);
+  fprintf(f, "max depth: %llu\n", (unsigned long long)stats->max_depth);
+  fprintf(f, "skipped: comments=%llu instructions=%llu declarations=%llu\n", (unsigned long long)stats->comment_bytes,
+    (unsigned long long)stats->instruction_bytes, (unsigned long long)stats->declaration_bytes);
+  fprintf(f, "allocations: %llu (%llu bytes)\n", (unsigned long long)stats->alloc_count, (unsigned long long)stats->alloc_bytes);
+  fprintf(f, "hashmap rehashes: %llu\n", (unsigned long long)stats->hashmap_rehashes);
+  if (stats->split_tokenize_time) {
+    fprintf(f, "time: parse=%.6fs (tokenize=%.6fs build=%.6fs) free=%.6fs\n", stats->parse_seconds,
+      stats->tokenize_seconds, cnxml_parse_stats_build_seconds(stats), stats->free_seconds);
+  } else {
+    fprintf(f, "time: parse=%.6fs free=%.6fs\n", stats->parse_seconds, stats->free_seconds);
+  }
+}
+
+double cnxml_stats_now(void) {
+#ifdef _WIN32
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
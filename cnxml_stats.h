@@ -0,0 +1,64 @@
+#ifndef CNXML_STATS
+#define CNXML_STATS
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cnxml.h"
+
+// per-parse statistics
+//
+// point a context at a cnxml_parse_stats with cnxml_context_set_stats
+// and everything parsed, allocated and freed through it is counted
+// there. counters only ever add up, so reset the struct between parses
+// to get per-file numbers. a stats struct must only be used by one
+// thread at a time.
+//
+// recording is only compiled in with CNXML_ENABLE_STATS (the cmake
+// option of the same name). without it cnxml_context_set_stats returns
+// false and the parser carries no extra code at all. with it, a context
+// without stats pays one pointer check per tokenizer call and
+// allocation.
+//
+// splitting parse time into tokenizing and tree building means reading
+// the clock around every token, which can double the parse time of tag
+// heavy input. it's off unless split_tokenize_time is set; otherwise
+// tokenize_seconds stays 0.
+
+#define CNXML_STATS_TOKEN_TYPES (CNXML_TOKEN_EOF + 1)
+
+struct _cnxml_parse_stats {
+  bool split_tokenize_time;                     // SETTING, KEPT BY cnxml_parse_stats_reset
+  uint64_t bytes;                               // INPUT CONSUMED BY THE PARSER
+  uint64_t tokens[CNXML_STATS_TOKEN_TYPES];     // BY cnxml_token_type
+  uint64_t elements;
+  uint64_t attributes;
+  uint64_t max_depth;
+  uint64_t comment_bytes;                       // <!-- ... -->
+  uint64_t instruction_bytes;                   // <? ... ?>
+  uint64_t declaration_bytes;                   // <!DOCTYPE ...> AND FRIENDS
+  uint64_t alloc_count;                         // THROUGH cnxml_context, ARENA OR NOT
+  uint64_t alloc_bytes;
+  uint64_t hashmap_rehashes;
+  double parse_seconds;                         // WALL TIME IN THE PARSER
+  double tokenize_seconds;                      // PART OF parse_seconds, IF SPLIT
+  double free_seconds;                          // ELEMENT FREES AND ARENA RESETS
+};
+
+#ifdef CNXML_ENABLE_STATS
+  // runs stmt with `stats` bound to ctx's stats, if it has any
+  #define CNXML_STATS_RECORD(ctx, stmt) do { \
+    cnxml_parse_stats* stats = (ctx)->stats; \
+    if (stats != NULL) { stmt; } \
+  } while (0)
+#else
+  #define CNXML_STATS_RECORD(ctx, stmt) ((void)0)
+#endif
+
+/*** STATS API ***/
+CNXML_EXPORT void CNXML_API cnxml_parse_stats_reset(cnxml_parse_stats* stats);
+// tree building time, i.e. parse_seconds without tokenize_seconds
+CNXML_EXPORT double CNXML_API cnxml_parse_stats_build_seconds(const cnxml_parse_stats* stats);
+CNXML_EXPORT void CNXML_API cnxml_parse_stats_print(FILE* f, const cnxml_parse_stats* stats);
+CNXML_EXPORT double CNXML_API cnxml_stats_now(void);
+
+#endif//CNXML_STATS
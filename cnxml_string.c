@@ -16,9 +16,9 @@ cnxml_string cnxml_string_new(const char* cstring) {
   return cnxml_string_newlen(cstring, strlen(cstring));
 }
 
-cnxml_string cnxml_string_sub(cnxml_string str, int start_pos, int len) {
+cnxml_string cnxml_string_sub(cnxml_string str, size_t start_pos, size_t len) {
   if (start_pos == 0 && len == str.len) return str;
-  if (start_pos > str.len || len > (str.len - start_pos - 1)) {
+  if (start_pos > str.len || len > str.len - start_pos) {
     return (cnxml_string){NULL, 0};
   } else {
     return (cnxml_string){str.ptr + start_pos, len};
@@ -27,16 +27,16 @@ cnxml_string cnxml_string_sub(cnxml_string str, int start_pos, int len) {
 
 bool cnxml_string_equal(cnxml_string a, cnxml_string b) {
 	if (a.len != b.len) return false;
-	for (int i = 0; i < a.len; i++) {
+	for (size_t i = 0; i < a.len; i++) {
 		if (a.ptr[i] != b.ptr[i]) return false;
 	}
 	return true;
 }
 
 bool cnxml_string_cequal(cnxml_string a, const char* b) {
-	int b_len = strlen(b);
+	size_t b_len = strlen(b);
 	if (a.len != b_len) return false;
-	for (int i = 0; i < a.len; i++) {
+	for (size_t i = 0; i < a.len; i++) {
 		if (a.ptr[i] != b[i]) return false;
 	}
 	return true;
@@ -50,7 +50,7 @@ void cnxml_string_print(FILE* f, cnxml_string str) {
 }
 
 cnxml_string cnxml_string_concat(cnxml_context* ctx, cnxml_string a, cnxml_string b) {
-	char* new_buf = ctx->alloc(a.len + b.len);
+	char* new_buf = cnxml_context_alloc(ctx, a.len + b.len);
 	for (size_t i = 0; i < a.len; i++) {
 		new_buf[i] = a.ptr[i];
 	}
@@ -63,7 +63,7 @@ cnxml_string cnxml_string_concat(cnxml_context* ctx, cnxml_string a, cnxml_strin
 
 cnxml_string cnxml_string_concat3(cnxml_context* ctx, cnxml_string a, cnxml_string b, cnxml_string c) {
 	const size_t new_len = a.len + b.len + c.len;
-	char* new_buf = ctx->alloc(new_len);
+	char* new_buf = cnxml_context_alloc(ctx, new_len);
 	for (size_t i = 0; i < a.len; i++) {
 		new_buf[i] = a.ptr[i];
 	}
@@ -77,7 +77,7 @@ cnxml_string cnxml_string_concat3(cnxml_context* ctx, cnxml_string a, cnxml_stri
 }
 
 cnxml_string* cnxml_string_stored(cnxml_context* ctx, cnxml_string str) {
-	cnxml_string* new_str = ctx->alloc(sizeof(cnxml_string));
+	cnxml_string* new_str = cnxml_context_alloc(ctx, sizeof(cnxml_string));
 	new_str->ptr = str.ptr;
 	new_str->len = str.len;
 	return new_str;
@@ -17,7 +17,7 @@ typedef struct {
 
 CNXML_EXPORT cnxml_string CNXML_API cnxml_string_new(const char* cstring);
 CNXML_EXPORT cnxml_string CNXML_API cnxml_string_newlen(const char* cstring, size_t len);
-CNXML_EXPORT cnxml_string CNXML_API cnxml_string_sub(cnxml_string str, int start_pos, int len);
+CNXML_EXPORT cnxml_string CNXML_API cnxml_string_sub(cnxml_string str, size_t start_pos, size_t len);
 CNXML_EXPORT cnxml_string CNXML_API cnxml_string_concat(cnxml_context* ctx, cnxml_string a, cnxml_string b);
 CNXML_EXPORT cnxml_string CNXML_API cnxml_string_concat3(cnxml_context* ctx, cnxml_string a, cnxml_string b, cnxml_string c);
 CNXML_EXPORT cnxml_string* CNXML_API cnxml_string_stored(cnxml_context* ctx, cnxml_string str);
@@ -0,0 +1,92 @@
+#include "cnxml_thread.h"
+
+#ifndef _WIN32
+  #include <unistd.h>
+#endif
+
+/*** THREAD ***/
+
+#ifdef _WIN32
+static DWORD WINAPI INTERNAL_cnxml_thread_main(LPVOID arg) {
+  cnxml_thread* thread = arg;
+  thread->func(thread->arg);
+  return 0;
+}
+#else
+static void* INTERNAL_cnxml_thread_main(void* arg) {
+  cnxml_thread* thread = arg;
+  thread->func(thread->arg);
+  return NULL;
+}
+#endif
+
+// thread has to stay where it is until cnxml_thread_join
+cnxml_error cnxml_thread_start(cnxml_thread* thread, cnxml_thread_func* func, cnxml_any arg) {
+  if (thread == NULL || func == NULL) {
+    return CNXML_ERROR_BADARGS;
+  }
+  thread->func = func;
+  thread->arg = arg;
+#ifdef _WIN32
+  thread->handle = CreateThread(NULL, 0, INTERNAL_cnxml_thread_main, thread, 0, NULL);
+  if (thread->handle == NULL) return CNXML_ERROR_ALLOCFAIL;
+#else
+  if (pthread_create(&thread->handle, NULL, INTERNAL_cnxml_thread_main, thread) != 0) {
+    return CNXML_ERROR_ALLOCFAIL;
+  }
+#endif
+  return CNXML_ERROR_OK;
+}
+
+void cnxml_thread_join(cnxml_thread* thread) {
+#ifdef _WIN32
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+#else
+  pthread_join(thread->handle, NULL);
+#endif
+}
+
+int cnxml_thread_cpu_count(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+#endif
+}
+
+/*** MUTEX ***/
+
+cnxml_error cnxml_mutex_init(cnxml_mutex* mutex) {
+#ifdef _WIN32
+  InitializeSRWLock(&mutex->handle);
+#else
+  if (pthread_mutex_init(&mutex->handle, NULL) != 0) return CNXML_ERROR_ALLOCFAIL;
+#endif
+  return CNXML_ERROR_OK;
+}
+
+void cnxml_mutex_lock(cnxml_mutex* mutex) {
+#ifdef _WIN32
+  AcquireSRWLockExclusive(&mutex->handle);
+#else
+  pthread_mutex_lock(&mutex->handle);
+#endif
+}
+
+void cnxml_mutex_unlock(cnxml_mutex* mutex) {
+#ifdef _WIN32
+  ReleaseSRWLockExclusive(&mutex->handle);
+#else
+  pthread_mutex_unlock(&mutex->handle);
+#endif
+}
+
+void cnxml_mutex_destroy(cnxml_mutex* mutex) {
+#ifndef _WIN32
+  pthread_mutex_destroy(&mutex->handle);
+#endif
+}
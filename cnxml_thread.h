@@ -0,0 +1,97 @@
+#ifndef CNXML_THREAD
+#define CNXML_THREAD
+
+#include <stdint.h>
+#include "cnxml_common.h"
+#include "cnxml_hashmap.h"
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
+
+// minimal threads, locks and atomics, just enough for the batch parser,
+// the document splitter and the intern table
+
+typedef void cnxml_thread_func(cnxml_any arg);
+
+typedef struct {
+#ifdef _WIN32
+  HANDLE handle;
+#else
+  pthread_t handle;
+#endif
+  cnxml_thread_func* func;
+  cnxml_any arg;
+} cnxml_thread;
+
+typedef struct {
+#ifdef _WIN32
+  SRWLOCK handle;
+#else
+  pthread_mutex_t handle;
+#endif
+} cnxml_mutex;
+
+/*** THREAD API ***/
+CNXML_EXPORT cnxml_error CNXML_API cnxml_thread_start(cnxml_thread* thread, cnxml_thread_func* func, cnxml_any arg);
+CNXML_EXPORT void CNXML_API cnxml_thread_join(cnxml_thread* thread);
+CNXML_EXPORT int CNXML_API cnxml_thread_cpu_count(void);
+CNXML_EXPORT cnxml_error CNXML_API cnxml_mutex_init(cnxml_mutex* mutex);
+CNXML_EXPORT void CNXML_API cnxml_mutex_lock(cnxml_mutex* mutex);
+CNXML_EXPORT void CNXML_API cnxml_mutex_unlock(cnxml_mutex* mutex);
+CNXML_EXPORT void CNXML_API cnxml_mutex_destroy(cnxml_mutex* mutex);
+
+/*** ATOMICS ***/
+static inline uint64_t cnxml_atomic_load_u64(volatile uint64_t* ptr) {
+#ifdef _MSC_VER
+  return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)ptr, 0, 0);
+#else
+  return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void cnxml_atomic_store_u64(volatile uint64_t* ptr, uint64_t value) {
+#ifdef _MSC_VER
+  InterlockedExchange64((volatile LONG64*)ptr, (LONG64)value);
+#else
+  __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// true if *ptr was expected and is now desired
+static inline bool cnxml_atomic_cas_u64(volatile uint64_t* ptr, uint64_t expected, uint64_t desired) {
+#ifdef _MSC_VER
+  return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)ptr, (LONG64)desired, (LONG64)expected) == expected;
+#else
+  return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// returns the value before the add
+static inline uint64_t cnxml_atomic_fetch_add_u64(volatile uint64_t* ptr, uint64_t value) {
+#ifdef _MSC_VER
+  return (uint64_t)InterlockedExchangeAdd64((volatile LONG64*)ptr, (LONG64)value);
+#else
+  return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void* cnxml_atomic_load_ptr(void* volatile* ptr) {
+#ifdef _MSC_VER
+  return InterlockedCompareExchangePointer(ptr, NULL, NULL);
+#else
+  return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void cnxml_atomic_store_ptr(void* volatile* ptr, void* value) {
+#ifdef _MSC_VER
+  InterlockedExchangePointer(ptr, value);
+#else
+  __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+#endif//CNXML_THREAD
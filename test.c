@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "cnxml_hashmap.h"
+#include "cnxml_source.h"
 //#include <gperftools/profiler.h>
 
 int attr_iter(cnxml_any userdata, cnxml_string key, cnxml_any val) {
@@ -28,23 +29,21 @@ int main(int argc, const char** argv) {
   }
 
   const char* path = argv[1];
-  cnxml_context* ctx = cnxml_context_new(malloc, realloc, free);
+  cnxml_context* ctx = cnxml_context_new_arena(malloc, realloc, free, 0);
 
-  FILE* f = fopen(path, "r");
-  fseek(f, 0, SEEK_END);
-  size_t length = ftell(f);
-  fseek(f, 0, SEEK_SET);
-  char* buf = ctx->alloc(length);
-  fread(buf, 1, length, f);
-  fclose(f);
+  cnxml_source* source = cnxml_source_open(ctx, path);
+  if (CNXML_IS_ERROR(source)) {
+    printf("couldn't open %s\n", path);
+    return 1;
+  }
 
-  cnxml_tokenizer* tokenizer = cnxml_tokenizer_new(ctx, buf, length);
+  cnxml_tokenizer* tokenizer = cnxml_source_tokenizer(source);
 
   cnxml_parser* parser = cnxml_parser_new(NULL, tokenizer);
 
   cnxml_element elem = cnxml_parser_read_element(parser);
 
-  for (int i = 0; i < parser->error_count; i++) {
+  for (size_t i = 0; i < parser->error_count; i++) {
     cnxml_parser_error* err = parser->error_buffer[i];
     cnxml_parser_error_print(stdout, err);
     printf("\n");
@@ -54,14 +53,14 @@ int main(int argc, const char** argv) {
   // cnxml_string_print(stdout, elem.name);
   // printf("\n");
 
-  // printf("CHILDCOUNT: %d\n", cnxml_element_list_length(elem.children));
+  // printf("CHILDCOUNT: %llu\n", (unsigned long long)cnxml_element_list_length(elem.children));
 
   // printf("TEXT: ");
   // cnxml_string_print(stdout, elem.text_content);
   // printf("\n");
 
   printf("ATTRIBUTES:\n");
-  cnxml_hashmap_iterate(elem.attributes, attr_iter, NULL);
+  cnxml_element_iterate_attributes(&elem, attr_iter, NULL);
 
   // while (!cnxml_tokenizer_is_eof(tokenizer)) {
   //   cnxml_token t = cnxml_tokenizer_next_token(tokenizer);
@@ -70,10 +69,10 @@ int main(int argc, const char** argv) {
 
   cnxml_element_write(elem, writer, stdout);
 
-  free(buf);
   cnxml_element_free(elem);
   cnxml_parser_free(parser);
   cnxml_tokenizer_free(tokenizer);
+  cnxml_source_free(source);
   cnxml_context_free(ctx);
   //ProfilerStop();
   return 0;